@@ -0,0 +1,80 @@
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include "fake/fake_data.h"
+#include "telegram/broadcast.h"
+#include "telegram/client.h"
+#include "telegram/loopback_transport.h"
+
+namespace {
+class CannedHandler : public telegram::LoopbackHandler {
+public:
+    void Handle(const Request &, Response *response) override {
+        response->body << fake_data::kSendMessageHiJson;
+    }
+};
+
+double NanosSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+}  // namespace
+
+// Size and decoding speed of a subscriber list, the cost of a body built from a
+// prepared text against one escaped per send, and broadcast throughput through the
+// in-process loopback transport.
+int main() {
+    constexpr size_t kSubscribers = 1000000;
+    constexpr int kBodies = 1000000;
+    auto path = (std::filesystem::temp_directory_path() / "bench_subscribers").string();
+
+    std::mt19937_64 random(1);
+    std::vector<int64_t> chat_ids;
+    for (size_t i = 0; i < kSubscribers; ++i) {
+        chat_ids.push_back(static_cast<int64_t>(random() % 7000000000));
+    }
+    telegram::SubscriberList::Write(path, chat_ids);
+    telegram::SubscriberList subscribers(path);
+
+    auto start = std::chrono::steady_clock::now();
+    int64_t sum = 0;
+    auto cursor = subscribers.Begin();
+    for (int64_t chat_id; cursor.Next(&chat_id);) {
+        sum += chat_id;
+    }
+    std::cout << "list: " << std::fixed << std::setprecision(2)
+              << static_cast<double>(std::filesystem::file_size(path)) / subscribers.Size()
+              << " bytes/id, " << NanosSince(start) / subscribers.Size() << " ns/id to decode"
+              << " (checksum " << sum << ")" << std::endl;
+
+    std::string text(1000, 'x');
+    text += "\n\"quoted\"\n";
+    const telegram::PreparedText prepared(text);
+    std::string body;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kBodies; ++i) {
+        telegram::RequestBuilder::BuildSendMessageBody(text, 104519755 + i, std::nullopt, &body);
+    }
+    auto escaped = NanosSince(start) / kBodies;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kBodies; ++i) {
+        telegram::RequestBuilder::BuildSendMessageBody(prepared, 104519755 + i, std::nullopt,
+                                                       &body);
+    }
+    std::cout << "body: " << escaped << " ns escaped per send, "
+              << NanosSince(start) / kBodies << " ns prepared" << std::endl;
+
+    auto transport =
+        std::make_shared<telegram::LoopbackTransport>(std::make_shared<CannedHandler>());
+    telegram::Client client(transport, "bot123",
+                            {.pool_size = 8, .rate_limit = {.enabled = false}});
+    telegram::SendQueue queue(&client, {.senders = 8});
+    start = std::chrono::steady_clock::now();
+    auto result = telegram::Broadcast(&queue, prepared, subscribers, {.window = 1024});
+    std::cout << "broadcast: " << std::setprecision(0)
+              << result.sent / (NanosSince(start) / 1e9) << " messages/s" << std::endl;
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,57 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "telegram/command_router.h"
+
+namespace {
+constexpr int kLookups = 10000000;
+
+// Routes N generated command names and compares a lookup in the perfect hash with
+// the chain of string comparisons it replaces.
+template <size_t N>
+void Run() {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < N; ++i) {
+        names.push_back("command_" + std::to_string(i * 7919));
+    }
+    telegram::CommandRoute<size_t> routes[N];
+    for (size_t i = 0; i < N; ++i) {
+        routes[i] = {names[i], i};
+    }
+    telegram::CommandRouter<size_t, N> router(routes);
+
+    size_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kLookups; ++i) {
+        sum += *router.Find(names[i % N]);
+    }
+    std::chrono::duration<double, std::nano> hashed = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kLookups; ++i) {
+        const std::string &name = names[i % N];
+        for (size_t j = 0; j < N; ++j) {
+            if (name == routes[j].name) {
+                sum += j;
+                break;
+            }
+        }
+    }
+    std::chrono::duration<double, std::nano> chained = std::chrono::steady_clock::now() - start;
+
+    std::cout << std::setw(10) << N << std::setw(12) << std::fixed << std::setprecision(1)
+              << hashed.count() / kLookups << std::setw(12) << chained.count() / kLookups
+              << std::setw(22) << sum << std::endl;
+}
+}  // namespace
+
+int main() {
+    std::cout << std::setw(10) << "commands" << std::setw(12) << "ns/router" << std::setw(12)
+              << "ns/chain" << std::setw(22) << "checksum" << std::endl;
+    Run<8>();
+    Run<64>();
+    Run<512>();
+}
@@ -0,0 +1,49 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <Poco/DeflatingStream.h>
+
+#include "fake/fake.h"
+#include "fake/fake_data.h"
+#include "telegram/client.h"
+
+namespace {
+size_t CompressedSize(const std::string &data, Poco::DeflatingStreamBuf::StreamType type) {
+    std::ostringstream out;
+    Poco::DeflatingOutputStream deflating(out, type);
+    deflating << data;
+    deflating.close();
+    return out.str().size();
+}
+}  // namespace
+
+// Fetches a 100-message getUpdates batch from the fake server with and without
+// response compression.
+int main() {
+    constexpr int kCalls = 500;
+
+    auto batch = fake_data::GetUpdatesJson(100);
+    std::cout << "batch of 100 updates: " << batch.size() << " bytes, gzip "
+              << CompressedSize(batch, Poco::DeflatingStreamBuf::STREAM_GZIP) << " bytes, deflate "
+              << CompressedSize(batch, Poco::DeflatingStreamBuf::STREAM_ZLIB) << " bytes"
+              << std::endl;
+
+    for (std::string content_encoding : {"", "gzip", "deflate"}) {
+        telegram::FakeServer fake{"Large getUpdates", content_encoding};
+        fake.Start();
+        telegram::Client client(fake.GetUrl(), "bot123");
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kCalls; ++i) {
+            client.FetchUpdates(0, 851793506);
+        }
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << std::setw(10) << (content_encoding.empty() ? "identity" : content_encoding)
+                  << std::setw(12) << std::fixed << std::setprecision(1) << elapsed.count() / kCalls
+                  << " us/getUpdates" << std::endl;
+        fake.StopAndCheckExpectations();
+    }
+}
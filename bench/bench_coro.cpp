@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "fake/fake.h"
+#include "telegram/async_client.h"
+
+namespace {
+// One conversation chains two API calls with a think pause between them.
+telegram::Task<> Conversation(telegram::AsyncClient &client, int64_t chat_id) {
+    co_await client.SendMessage("Hi!", chat_id);
+    co_await client.Loop()->Sleep(std::chrono::milliseconds(10));
+    co_await client.SendMessage("Hi!", chat_id);
+}
+}  // namespace
+
+// Runs many concurrent conversations on one event loop against the fake server.
+// On the client's I/O executor at most io_threads requests are in flight, however
+// many conversations wait on them; from the loop itself (the "loop" rows) requests
+// are limited by the connections alone, and no thread besides the loop's is used.
+int main() {
+    constexpr size_t kConnections = 16;
+
+    telegram::FakeServer fake{"Send message throughput"};
+    fake.Start();
+
+    std::cout << std::setw(12) << "io_threads" << std::setw(14) << "conversations"
+              << std::setw(12) << "seconds" << std::setw(14) << "conv/s" << std::setw(14)
+              << "msg/s" << std::endl;
+    // Zero stands for the loop.
+    for (size_t io_threads : {1, 4, 16, 0}) {
+        telegram::Client client(fake.GetUrl(), "bot123",
+                                {.pool_size = kConnections,
+                                 .io_threads = std::max<size_t>(io_threads, 1),
+                                 .rate_limit = {.enabled = false}});
+
+        for (int conversations : {100, 1000, 5000}) {
+            telegram::EventLoop loop;
+            telegram::AsyncClient async_client(
+                &client, &loop,
+                {.endpoint = io_threads ? "" : fake.GetUrl(), .connections = kConnections});
+
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < conversations; ++i) {
+                loop.Spawn(Conversation(async_client, 104519755 + i));
+            }
+            loop.Run();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            std::cout << std::setw(12) << (io_threads ? std::to_string(io_threads) : "loop")
+                      << std::setw(14) << conversations << std::setw(12) << std::fixed
+                      << std::setprecision(2) << elapsed.count() << std::setw(14)
+                      << std::setprecision(0) << conversations / elapsed.count()
+                      << std::setw(14) << 2 * conversations / elapsed.count() << std::endl;
+        }
+    }
+
+    fake.StopAndCheckExpectations();
+}
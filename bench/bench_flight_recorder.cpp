@@ -0,0 +1,46 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+
+#include "telegram/flight_recorder.h"
+
+namespace {
+constexpr int kEvents = 2000000;
+
+double NanosPerEvent(size_t threads) {
+    auto &recorder = telegram::FlightRecorder::Global();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            for (int i = 0; i < kEvents; ++i) {
+                recorder.Record("update", i, 0);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (kEvents * static_cast<double>(threads));
+}
+}  // namespace
+
+// The cost of recording an event from one and from several threads sharing the
+// ring, and of writing the whole ring out as the crash handler does.
+int main() {
+    std::cout << std::fixed << std::setprecision(1);
+    for (size_t threads : {1, 4}) {
+        std::cout << std::setw(16) << threads << " threads" << std::setw(10)
+                  << NanosPerEvent(threads) << " ns" << std::endl;
+    }
+
+    auto fd = open("/dev/null", O_WRONLY);
+    auto start = std::chrono::steady_clock::now();
+    telegram::FlightRecorder::Global().Dump(fd, "bench");
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::setw(24) << "dump" << std::setw(10) << elapsed.count() << " us" << std::endl;
+}
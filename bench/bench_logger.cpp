@@ -0,0 +1,64 @@
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string_view>
+#include <fcntl.h>
+
+#include "telegram/logger.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr int kRounds = 100;
+constexpr int kRecordsPerRound = 10000;
+
+std::string_view command = "random";
+
+void Print(std::string_view name, Clock::duration elapsed) {
+    std::chrono::duration<double, std::nano> nanos = elapsed;
+    std::cout << std::setw(24) << name << std::setw(10)
+              << nanos.count() / (kRounds * kRecordsPerRound) << " ns" << std::endl;
+}
+}  // namespace
+
+// The cost of logging a command the way HandleUpdate did, with a flushed stream,
+// and through the logger into /dev/null: a record below the level, a record put
+// into the ring, and formatting and writing the records afterwards.
+int main() {
+    std::cout << std::fixed << std::setprecision(1);
+
+    std::ofstream stream("/dev/null");
+    auto start = Clock::now();
+    for (int i = 0; i < kRounds * kRecordsPerRound; ++i) {
+        stream << '/' << command << ' ' << i << std::endl;
+    }
+    Print("stream with endl", Clock::now() - start);
+
+    auto fd = open("/dev/null", O_WRONLY);
+    // Flushed by hand between rounds, so the rings never fill up.
+    telegram::Logger logger({.fd = fd,
+                             .records_per_thread = kRecordsPerRound,
+                             .flush_interval = std::chrono::hours(1),
+                             .burst = kRounds * kRecordsPerRound});
+    start = Clock::now();
+    for (int i = 0; i < kRounds * kRecordsPerRound; ++i) {
+        logger.Log(telegram::LogLevel::kDebug, "/{} {}", command, i);
+    }
+    Print("below level", Clock::now() - start);
+
+    Clock::duration logging{};
+    Clock::duration writing{};
+    for (int round = 0; round < kRounds; ++round) {
+        start = Clock::now();
+        for (int i = 0; i < kRecordsPerRound; ++i) {
+            logger.Log(telegram::LogLevel::kInfo, "/{} {}", command, i);
+        }
+        auto logged = Clock::now();
+        logger.Flush();
+        logging += logged - start;
+        writing += Clock::now() - logged;
+    }
+    Print("logged", logging);
+    Print("formatted and written", writing);
+}
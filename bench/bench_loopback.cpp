@@ -0,0 +1,45 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "fake/fake_data.h"
+#include "telegram/client.h"
+#include "telegram/loopback_transport.h"
+
+namespace {
+// Answers every API method with a canned reply, without checking the request.
+class CannedHandler : public telegram::LoopbackHandler {
+public:
+    void Handle(const Request &request, Response *response) override {
+        if (request.uri.find("/getUpdates") != std::string::npos) {
+            response->body << fake_data::kGetUpdatesFourMessagesJson;
+        } else {
+            response->body << fake_data::kSendMessageHiJson;
+        }
+    }
+};
+
+template <class F>
+void Measure(const char *name, int calls, F &&call) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; ++i) {
+        call(i);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::setw(14) << name << std::setw(14) << std::fixed << std::setprecision(0)
+              << calls / elapsed.count() << " calls/s" << std::endl;
+}
+}  // namespace
+
+// Drives the client through the in-process loopback transport, so only request
+// building, response parsing and the client's own overhead are measured.
+int main() {
+    constexpr int kCalls = 200000;
+
+    auto transport =
+        std::make_shared<telegram::LoopbackTransport>(std::make_shared<CannedHandler>());
+    telegram::Client client(transport, "bot123", {.rate_limit = {.enabled = false}});
+
+    Measure("sendMessage", kCalls, [&](int i) { client.SendMessage("Hi!", 104519755, i); });
+    Measure("getUpdates", kCalls, [&](int i) { client.FetchUpdates(20, 851793506 + i); });
+}
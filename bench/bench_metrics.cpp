@@ -0,0 +1,67 @@
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "telegram/metrics.h"
+
+namespace {
+double ThreadCpuNanos() {
+    timespec now{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return static_cast<double>(now.tv_sec) * 1e9 + static_cast<double>(now.tv_nsec);
+}
+
+// Runs record(i) kCalls times on each of the threads and returns the CPU time per
+// call, which does not depend on how many cores the threads share.
+template <class F>
+double Measure(int threads, F record) {
+    constexpr int kCalls = 10000000;
+    std::vector<double> cpu(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&record, &cpu, t] {
+            auto start = ThreadCpuNanos();
+            for (int i = 0; i < kCalls; ++i) {
+                record(i);
+            }
+            cpu[t] = ThreadCpuNanos() - start;
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    double total = 0;
+    for (auto nanos : cpu) {
+        total += nanos;
+    }
+    return total / (static_cast<double>(kCalls) * threads);
+}
+}  // namespace
+
+// The cost of recording a counter increment and a histogram value, from one thread
+// and from several recording into the same metric at once.
+int main() {
+    telegram::MetricsRegistry metrics;
+    auto &counter = metrics.GetCounter("bench_total", "Bench");
+    auto &histogram = metrics.GetHistogram("bench_seconds", "Bench");
+
+    std::cout << std::setw(10) << "threads" << std::setw(14) << "counter ns" << std::setw(16)
+              << "histogram ns" << std::setw(16) << "with clock ns" << std::endl;
+    for (int threads : {1, 4, 8}) {
+        auto add = Measure(threads, [&](int) { counter.Add(); });
+        auto record = Measure(threads, [&](int i) {
+            histogram.Record(std::chrono::nanoseconds(1000 + (i & 0xffff) * 997));
+        });
+        auto since = Measure(threads, [&](int) {
+            histogram.RecordSince(telegram::Histogram::Clock::now());
+        });
+        std::cout << std::setw(10) << threads << std::fixed << std::setprecision(1)
+                  << std::setw(14) << add << std::setw(16) << record << std::setw(16) << since
+                  << std::endl;
+    }
+    std::cout << "recorded " << histogram.Read().count << ", p99 "
+              << histogram.Read().Quantile(0.99).count() << " ns" << std::endl;
+}
@@ -0,0 +1,39 @@
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+#include "telegram/offset_store.h"
+
+// Stores offsets at every durability level and group commit size and reports the
+// cost per stored offset and per commit.
+int main() {
+    constexpr int kStores = 2000;
+    auto path = (std::filesystem::temp_directory_path() / "bench_offset_store").string();
+
+    std::cout << std::setw(12) << "durability" << std::setw(8) << "group" << std::setw(14)
+              << "us/store" << std::setw(14) << "us/commit" << std::endl;
+    const std::pair<const char *, telegram::Durability> levels[] = {
+        {"none", telegram::Durability::kNone},
+        {"fdatasync", telegram::Durability::kFdatasync},
+        {"dsync", telegram::Durability::kDsync},
+    };
+    for (auto [name, durability] : levels) {
+        for (size_t group : {1, 16, 256}) {
+            std::filesystem::remove(path);
+            telegram::OffsetStore store(path, {.durability = durability, .commit_every = group});
+
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 1; i <= kStores; ++i) {
+                store.Store(i);
+            }
+            std::chrono::duration<double, std::micro> elapsed =
+                std::chrono::steady_clock::now() - start;
+
+            std::cout << std::setw(12) << name << std::setw(8) << group << std::setw(14)
+                      << std::fixed << std::setprecision(2) << elapsed.count() / kStores
+                      << std::setw(14) << elapsed.count() / (kStores / group) << std::endl;
+        }
+    }
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,34 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "telegram/rate_limiter.h"
+
+// Reserves sends for a growing number of distinct chats, each chat messaging
+// once per second of simulated time, and reports the cost per reservation.
+int main() {
+    using namespace std::chrono_literals;
+    constexpr int kSeconds = 3;
+
+    std::cout << std::setw(12) << "chats" << std::setw(14) << "ns/reserve" << std::setw(14)
+              << "tracked" << std::endl;
+    for (int64_t chats : {1000, 100000, 1000000, 4000000}) {
+        // A limit no real bot gets, so the global bucket never delays the simulation.
+        telegram::RateLimiter limiter({.global = {1e9, 1000000}, .per_chat = {1, 3}});
+        auto simulated = telegram::RateLimiter::Clock::now();
+        auto step = std::chrono::duration_cast<telegram::RateLimiter::Clock::duration>(1s) / chats;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int second = 0; second < kSeconds; ++second) {
+            for (int64_t chat_id = 0; chat_id < chats; ++chat_id) {
+                limiter.Reserve(chat_id * 7919 - 1000000000000, simulated);
+                simulated += step;
+            }
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << std::setw(12) << chats << std::setw(14) << std::fixed << std::setprecision(1)
+                  << elapsed.count() / (chats * kSeconds) << std::setw(14)
+                  << limiter.TrackedChats() << std::endl;
+    }
+}
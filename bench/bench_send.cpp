@@ -0,0 +1,45 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "fake/fake.h"
+#include "telegram/client.h"
+
+// Measures sendMessage throughput against the fake server for growing pool sizes.
+// Every pool connection is driven by its own sender thread.
+int main() {
+    constexpr int kMessagesPerThread = 200;
+
+    telegram::FakeServer fake{"Send message throughput"};
+    fake.Start();
+
+    std::cout << std::setw(10) << "pool" << std::setw(14) << "messages" << std::setw(14)
+              << "msg/s" << std::endl;
+    for (size_t pool_size : {1, 2, 4, 8, 16}) {
+        // Measures the transport, so the Telegram rate limits are switched off.
+        telegram::Client client(fake.GetUrl(), "bot123",
+                                {.pool_size = pool_size, .rate_limit = {.enabled = false}});
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> senders;
+        for (size_t i = 0; i < pool_size; ++i) {
+            senders.emplace_back([&client, i] {
+                for (int j = 0; j < kMessagesPerThread; ++j) {
+                    client.SendMessage("Hi!", 104519755 + i);
+                }
+            });
+        }
+        for (auto &sender : senders) {
+            sender.join();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        auto total = pool_size * kMessagesPerThread;
+        std::cout << std::setw(10) << pool_size << std::setw(14) << total << std::setw(14)
+                  << std::fixed << std::setprecision(0) << total / elapsed.count() << std::endl;
+    }
+
+    fake.StopAndCheckExpectations();
+}
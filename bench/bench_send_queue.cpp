@@ -0,0 +1,54 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "fake/fake_data.h"
+#include "telegram/client.h"
+#include "telegram/loopback_transport.h"
+#include "telegram/send_queue.h"
+
+namespace {
+// Answers sendMessage after a fixed service time, like a distant Bot API.
+class SlowHandler : public telegram::LoopbackHandler {
+public:
+    void Handle(const Request &, Response *response) override {
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        response->body << fake_data::kSendMessageHiJson;
+    }
+};
+}  // namespace
+
+// A broadcast floods the queue with bulk messages while interactive replies keep
+// arriving; reports the queueing delay each class sees.
+int main() {
+    constexpr int kBulk = 20000;
+    constexpr int kChats = 2000;
+    constexpr int kReplies = 200;
+
+    auto transport =
+        std::make_shared<telegram::LoopbackTransport>(std::make_shared<SlowHandler>());
+    telegram::Client client(transport, "bot123",
+                            {.pool_size = 8, .rate_limit = {.enabled = false}});
+    telegram::SendQueue queue(&client, {.senders = 8});
+
+    for (int i = 0; i < kBulk; ++i) {
+        queue.Send(telegram::SendPriority::kBulk, "Broadcast", i % kChats);
+    }
+    for (int i = 0; i < kReplies; ++i) {
+        queue.Send(telegram::SendPriority::kInteractive, "Reply", -1 - i % 50, i);
+        queue.Send(telegram::SendPriority::kNotification, "Reminder", -100 - i % 50);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    queue.Flush();
+
+    const char *names[] = {"interactive", "notification", "bulk"};
+    std::cout << std::setw(14) << "class" << std::setw(10) << "sent" << std::setw(14)
+              << "mean us" << std::setw(14) << "max us" << std::endl;
+    auto stats = queue.Stats();
+    for (size_t i = 0; i < stats.size(); ++i) {
+        std::cout << std::setw(14) << names[i] << std::setw(10) << stats[i].sent << std::setw(14)
+                  << stats[i].mean_delay.count() << std::setw(14) << stats[i].max_delay.count()
+                  << std::endl;
+    }
+}
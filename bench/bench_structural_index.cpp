@@ -0,0 +1,57 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "fake/fake_data.h"
+#include "telegram/update_parser.h"
+
+namespace {
+template <class F>
+double Seconds(int runs, F &&run) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; ++i) {
+        run();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+}  // namespace
+
+// Builds the structural index of getUpdates replies and decodes them from it at
+// every SIMD level the CPU supports.
+int main() {
+    constexpr size_t kBytes = size_t{1} << 30;
+
+    std::cout << "best level: " << telegram::SimdLevelName(telegram::DetectSimdLevel())
+              << std::endl;
+    std::cout << std::setw(10) << "updates" << std::setw(10) << "level" << std::setw(14)
+              << "index GB/s" << std::setw(14) << "decode GB/s" << std::setw(14) << "updates/s"
+              << std::endl;
+    for (size_t count : {1, 10, 100}) {
+        auto json = fake_data::GetUpdatesJson(count);
+        auto runs = static_cast<int>(kBytes / json.size());
+        for (auto level : {telegram::SimdLevel::kScalar, telegram::SimdLevel::kSse42,
+                           telegram::SimdLevel::kAvx2}) {
+            if (level > telegram::DetectSimdLevel()) {
+                continue;
+            }
+            std::vector<uint32_t> index;
+            auto index_seconds =
+                Seconds(runs, [&] { telegram::BuildStructuralIndex(json, &index, level); });
+
+            telegram::IndexedUpdateParser parser(level);
+            std::vector<telegram::Client::Update> updates;
+            auto decode_seconds = Seconds(runs, [&] {
+                updates.clear();
+                parser.Parse(std::string_view(json), &updates);
+            });
+
+            auto gigabytes = static_cast<double>(json.size()) * runs / 1e9;
+            std::cout << std::setw(10) << count << std::setw(10) << telegram::SimdLevelName(level)
+                      << std::fixed << std::setprecision(2) << std::setw(14)
+                      << gigabytes / index_seconds << std::setw(14) << gigabytes / decode_seconds
+                      << std::setprecision(0) << std::setw(14)
+                      << static_cast<double>(count) * runs / decode_seconds << std::endl;
+        }
+    }
+}
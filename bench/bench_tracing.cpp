@@ -0,0 +1,42 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "telegram/tracing.h"
+
+namespace {
+constexpr int kSpans = 5000000;
+
+double NanosPerSpan(int64_t update_id) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kSpans; ++i) {
+        telegram::Span span("span", update_id);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / kSpans;
+}
+}  // namespace
+
+// The cost of a span with tracing off, for an update left out by sampling, and
+// recorded; and of exporting a full set of per-thread buffers.
+int main() {
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::setw(24) << "tracing off" << std::setw(10) << NanosPerSpan(1) << " ns"
+              << std::endl;
+
+    telegram::Tracer tracer({.sample_every = 2});
+    telegram::Tracer::Install(&tracer);
+    std::cout << std::setw(24) << "not sampled" << std::setw(10) << NanosPerSpan(1) << " ns"
+              << std::endl;
+    std::cout << std::setw(24) << "recorded" << std::setw(10) << NanosPerSpan(2) << " ns"
+              << std::endl;
+
+    std::string trace;
+    auto start = std::chrono::steady_clock::now();
+    tracer.WriteChromeTrace(&trace);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::setw(24) << "export" << std::setw(10) << elapsed.count() << " ms, "
+              << trace.size() << " bytes" << std::endl;
+    telegram::Tracer::Install(nullptr);
+}
@@ -0,0 +1,55 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "fake/fake_data.h"
+#include "telegram/update_parser.h"
+
+namespace {
+template <class Parse>
+double MicrosecondsPerBatch(const std::string &json, int batches, Parse &&parse) {
+    std::vector<telegram::Client::Update> updates;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < batches; ++i) {
+        std::istringstream input(json);
+        updates.clear();
+        parse(input, &updates);
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / batches;
+}
+}  // namespace
+
+// Parses getUpdates replies of growing size through the Poco::JSON DOM, through
+// the streaming parser, and into an UpdateBatch whose texts are then all read.
+int main() {
+    constexpr int kUpdates = 100000;
+
+    std::cout << std::setw(10) << "updates" << std::setw(10) << "bytes" << std::setw(14)
+              << "dom us" << std::setw(14) << "stream us" << std::setw(10) << "speedup"
+              << std::setw(14) << "batch us" << std::endl;
+    for (size_t count : {1, 10, 100}) {
+        auto json = fake_data::GetUpdatesJson(count);
+        auto batches = static_cast<int>(kUpdates / count);
+        auto dom = MicrosecondsPerBatch(json, batches, telegram::ParseUpdatesDom);
+        auto stream = MicrosecondsPerBatch(json, batches, telegram::ParseUpdates);
+
+        telegram::IndexedUpdateParser parser;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < batches; ++i) {
+            std::istringstream input(json);
+            auto batch = std::make_shared<telegram::UpdateBatch>();
+            parser.Parse(input, batch.get());
+            for (size_t j = 0; j < batch->Size(); ++j) {
+                batch->Text(j);
+            }
+        }
+        std::chrono::duration<double, std::micro> batch = std::chrono::steady_clock::now() - start;
+
+        std::cout << std::setw(10) << count << std::setw(10) << json.size() << std::fixed
+                  << std::setprecision(2) << std::setw(14) << dom << std::setw(14) << stream
+                  << std::setw(9) << dom / stream << "x" << std::setw(14)
+                  << batch.count() / batches << std::endl;
+    }
+}
@@ -0,0 +1,33 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "telegram/watchdog.h"
+
+namespace {
+constexpr int kRuns = 5000000;
+
+double NanosPerRun() {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRuns; ++i) {
+        telegram::Watched watched("random", i, i, std::chrono::milliseconds(50));
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / kRuns;
+}
+}  // namespace
+
+// The cost a watched handler pays, with no watchdog and with one scanning the
+// handlers every millisecond.
+int main() {
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::setw(24) << "no watchdog" << std::setw(10) << NanosPerRun() << " ns"
+              << std::endl;
+
+    telegram::Watchdog watchdog({.period = std::chrono::milliseconds(1)},
+                                [](const telegram::Overrun &) {});
+    telegram::Watchdog::Install(&watchdog);
+    std::cout << std::setw(24) << "watched" << std::setw(10) << NanosPerRun() << " ns"
+              << std::endl;
+    telegram::Watchdog::Install(nullptr);
+}
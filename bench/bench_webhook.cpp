@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/HTTPRequestHandlerFactory.h>
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/Net/HTTPServer.h>
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/ServerSocket.h>
+
+#include "fake/fake_data.h"
+#include "telegram/client.h"
+#include "telegram/poller.h"
+#include "telegram/webhook_server.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+std::string MakeUpdate(int64_t update_id) {
+    return R"({"update_id":)" + std::to_string(update_id) + R"(,"message":{"message_id":)" +
+           std::to_string(update_id) + R"(,"chat":{"id":104519755},"text":"/weather"}})";
+}
+
+// A local Bot API: getUpdates holds until an update is posted (or a second has
+// passed) and sendMessage reports when the reply arrived.
+class FakeApi {
+public:
+    void Post(std::string update) {
+        std::lock_guard lock(mutex_);
+        updates_.push_back(std::move(update));
+        changed_.notify_all();
+    }
+
+    Clock::time_point WaitReply() {
+        std::unique_lock lock(mutex_);
+        changed_.wait(lock, [this] { return replies_ > 0; });
+        --replies_;
+        return replied_at_;
+    }
+
+    void GetUpdates(std::ostream &out) {
+        std::unique_lock lock(mutex_);
+        changed_.wait_for(lock, std::chrono::seconds(1), [this] { return !updates_.empty(); });
+        out << R"({"ok":true,"result":[)";
+        for (size_t i = 0; i < updates_.size(); ++i) {
+            out << (i ? "," : "") << updates_[i];
+        }
+        out << "]}";
+        updates_.clear();
+    }
+
+    void SendMessage(std::ostream &out) {
+        {
+            std::lock_guard lock(mutex_);
+            ++replies_;
+            replied_at_ = Clock::now();
+            changed_.notify_all();
+        }
+        out << fake_data::kSendMessageHiJson;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<std::string> updates_;
+    size_t replies_ = 0;
+    Clock::time_point replied_at_;
+};
+
+class ApiHandler : public Poco::Net::HTTPRequestHandler {
+public:
+    explicit ApiHandler(FakeApi *api) : api_(api) {
+    }
+
+    void handleRequest(Poco::Net::HTTPServerRequest &request,
+                       Poco::Net::HTTPServerResponse &response) override {
+        request.stream().ignore(std::numeric_limits<std::streamsize>::max());
+        response.setContentType("application/json");
+        response.setChunkedTransferEncoding(true);
+        if (request.getURI().find("/getUpdates") != std::string::npos) {
+            api_->GetUpdates(response.send());
+        } else {
+            api_->SendMessage(response.send());
+        }
+    }
+
+private:
+    FakeApi *api_;
+};
+
+class ApiFactory : public Poco::Net::HTTPRequestHandlerFactory {
+public:
+    explicit ApiFactory(FakeApi *api) : api_(api) {
+    }
+
+    Poco::Net::HTTPRequestHandler *createRequestHandler(
+        const Poco::Net::HTTPServerRequest &) override {
+        return new ApiHandler(api_);
+    }
+
+private:
+    FakeApi *api_;
+};
+
+void Report(const char *name, std::vector<double> micros) {
+    std::sort(micros.begin(), micros.end());
+    auto at = [&](double q) { return micros[static_cast<size_t>(q * (micros.size() - 1))]; };
+    std::cout << std::setw(22) << name << std::setw(10) << std::fixed << std::setprecision(0)
+              << at(0.5) << std::setw(10) << at(0.99) << std::endl;
+}
+
+// Posts updates one at a time and returns, per update, the time until the
+// response came back (in_response) or until the sendMessage request arrived.
+std::vector<double> DriveWebhook(uint16_t port, FakeApi *api, bool in_response, int updates) {
+    Poco::Net::HTTPClientSession session("localhost", port);
+    session.setKeepAlive(true);
+    std::vector<double> micros;
+    for (int i = 0; i < updates; ++i) {
+        auto body = MakeUpdate(i + 1);
+        Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_POST, "/",
+                                       Poco::Net::HTTPMessage::HTTP_1_1);
+        request.setContentType("application/json");
+        request.setContentLength(static_cast<std::streamsize>(body.size()));
+
+        auto start = Clock::now();
+        session.sendRequest(request) << body;
+        Poco::Net::HTTPResponse response;
+        session.receiveResponse(response).ignore(std::numeric_limits<std::streamsize>::max());
+        auto end = in_response ? Clock::now() : api->WaitReply();
+        micros.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+    return micros;
+}
+}  // namespace
+
+// Latency from an update becoming available to its reply leaving the bot, for long
+// polling, for webhooks replying with sendMessage, and for webhooks answering in
+// the response, all against a Bot API on localhost.
+int main() {
+    constexpr int kUpdates = 2000;
+
+    FakeApi api;
+    Poco::Net::ServerSocket api_socket(Poco::Net::SocketAddress("127.0.0.1", 0));
+    auto *params = new Poco::Net::HTTPServerParams;
+    params->setMaxThreads(16);
+    Poco::Net::HTTPServer api_server(new ApiFactory(&api), api_socket, params);
+    api_server.start();
+    auto endpoint = "http://127.0.0.1:" + std::to_string(api_socket.address().port()) + "/";
+    telegram::Client client(endpoint, "bot123", {.rate_limit = {.enabled = false}});
+
+    std::cout << std::setw(22) << "mode" << std::setw(10) << "p50 us" << std::setw(10) << "p99 us"
+              << std::endl;
+    {
+        telegram::Poller poller(&client, 1, std::nullopt);
+        poller.Start();
+        std::thread handler([&] {
+            while (const auto batch = poller.Next()) {
+                for (size_t i = 0; i < batch->Size(); ++i) {
+                    client.SendMessage("Winter Is Coming", (*batch)[i].chat_id);
+                }
+            }
+        });
+        std::vector<double> micros;
+        for (int i = 0; i < kUpdates; ++i) {
+            auto start = Clock::now();
+            api.Post(MakeUpdate(i + 1));
+            micros.push_back(std::chrono::duration<double, std::micro>(api.WaitReply() - start)
+                                 .count());
+        }
+        poller.Stop();
+        handler.join();
+        Report("long polling", micros);
+    }
+
+    for (bool in_response : {false, true}) {
+        telegram::WebhookServer server(
+            &client, {.host = "127.0.0.1", .port = 0, .reply_in_response = in_response},
+            [](const telegram::UpdateView &update, telegram::ReplyChannel *replies) {
+                replies->SendMessage("Winter Is Coming", update.chat_id);
+            });
+        server.Start();
+        Report(in_response ? "webhook, in response" : "webhook, sendMessage",
+               DriveWebhook(server.Port(), &api, in_response, kUpdates));
+        server.Stop();
+    }
+    api_server.stop();
+}
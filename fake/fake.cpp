@@ -2,6 +2,8 @@
 #include "fake_data.h"
 
 #include <mutex>
+#include <chrono>
+#include <thread>
 #include <iostream>
 #include <stdexcept>
 #include <sstream>
@@ -9,14 +11,62 @@
 #include <Poco/URI.h>
 #include <Poco/Net/HTTPServerRequest.h>
 #include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/HTTPResponse.h>
 #include <Poco/Net/HTTPRequestHandler.h>
 #include <Poco/Net/SocketAddress.h>
 #include <Poco/JSON/Parser.h>
+#include <Poco/DeflatingStream.h>
+
+#include "telegram/loopback_transport.h"
 
 namespace telegram {
 
-using Request = Poco::Net::HTTPServerRequest;
-using Response = Poco::Net::HTTPServerResponse;
+// Test cases see requests through these interfaces, so the same scenario can be
+// served over HTTP or in-process by a LoopbackTransport.
+class Request {
+public:
+    virtual ~Request() = default;
+    virtual const std::string& getURI() const = 0;
+    virtual const std::string& getMethod() const = 0;
+    virtual std::string get(const std::string& name) const = 0;
+    virtual std::istream& stream() = 0;
+};
+
+class Response : public Poco::Net::HTTPResponse {
+public:
+    virtual ~Response() = default;
+
+    std::ostream& send() {
+        auto& body = SendHeaders();
+        if (content_encoding_.empty()) {
+            return body;
+        }
+        auto type = content_encoding_ == "gzip" ? Poco::DeflatingStreamBuf::STREAM_GZIP
+                                                : Poco::DeflatingStreamBuf::STREAM_ZLIB;
+        deflating_ = std::make_unique<Poco::DeflatingOutputStream>(body, type);
+        return *deflating_;
+    }
+
+    // Compresses the body sent afterwards with "gzip" or "deflate".
+    void Compress(const std::string& content_encoding) {
+        content_encoding_ = content_encoding;
+        set("Content-Encoding", content_encoding);
+    }
+
+    void Finish() {
+        if (deflating_) {
+            deflating_->close();
+            deflating_.reset();
+        }
+    }
+
+protected:
+    virtual std::ostream& SendHeaders() = 0;
+
+private:
+    std::string content_encoding_;
+    std::unique_ptr<Poco::DeflatingOutputStream> deflating_;
+};
 
 class CheckFailedException : public std::exception {};
 
@@ -226,42 +276,235 @@ public:
     }
 };
 
+// Accepts any number of sendMessage requests, possibly over several connections at once.
+// Each reply is delayed to emulate the round trip to the real API.
+class SendMessageThroughputTestCase : public TestCase {
+public:
+    static constexpr auto kLatency = std::chrono::milliseconds(5);
+
+    void HandleRequest(Request& request, Response& response) override {
+        ExpectURI(request, "/bot123/sendMessage");
+        ExpectMethod(request, "POST");
+
+        Poco::JSON::Parser parser;
+        parser.parse(request.stream());
+
+        std::this_thread::sleep_for(kLatency);
+        response.setStatus(Response::HTTP_OK);
+        response.send() << fake_data::kSendMessageHiJson;
+    }
+};
+
+class FloodWaitTestCase : public TestCase {
+public:
+    FloodWaitTestCase() {
+        expectations_ = {"Client sends message and is told to retry after 1 second",
+                         "Client sends the message again after retry_after"};
+    }
+
+    void HandleRequest(Request& request, Response& response) override {
+        ExpectURI(request, "/bot123/sendMessage");
+        ExpectMethod(request, "POST");
+
+        Poco::JSON::Parser parser;
+        parser.parse(request.stream());
+
+        if (++fulfilled_ == 1) {
+            first_attempt_ = std::chrono::steady_clock::now();
+            response.setStatus(Response::HTTP_TOO_MANY_REQUESTS);
+            response.send() << fake_data::kTooManyRequestsJson;
+        } else if (fulfilled_ == 2) {
+            if (std::chrono::steady_clock::now() - first_attempt_ < std::chrono::seconds(1)) {
+                Fail("Message resent before retry_after");
+            }
+            response.setStatus(Response::HTTP_OK);
+            response.send() << fake_data::kSendMessageHiJson;
+        } else {
+            Fail("Unexpected extra request");
+        }
+    }
+
+private:
+    std::chrono::steady_clock::time_point first_attempt_;
+};
+
+// Answers every getUpdates with the same batch of 100 messages.
+class LargeGetUpdatesTestCase : public TestCase {
+public:
+    void HandleRequest(Request& request, Response& response) override {
+        // Any query parameters are fine here.
+        auto path = Poco::URI{request.getURI()}.getPath();
+        if (path != "/bot123/getUpdates") {
+            Fail("Invalid Path: expected /bot123/getUpdates, got " + path);
+        }
+        ExpectMethod(request, "GET");
+        response.setStatus(Response::HTTP_OK);
+        response.send() << batch_;
+    }
+
+private:
+    const std::string batch_ = fake_data::GetUpdatesJson(100);
+};
+
+void Serve(TestCase* test_case, const std::string& content_encoding, Request& request,
+           Response& response) {
+    if (!content_encoding.empty() &&
+        request.get("Accept-Encoding").find(content_encoding) != std::string::npos) {
+        response.Compress(content_encoding);
+    }
+    try {
+        test_case->HandleRequest(request, response);
+        response.Finish();
+    } catch (const CheckFailedException& e) {
+        response.setStatus(Response::HTTP_BAD_REQUEST);
+        response.send();
+        response.Finish();
+    } catch (const std::exception& e) {
+        test_case->Fail(e.what());
+        throw;
+    }
+}
+
+class ServerRequest : public Request {
+public:
+    ServerRequest(Poco::Net::HTTPServerRequest& request) : request_{request} {
+    }
+    const std::string& getURI() const override {
+        return request_.getURI();
+    }
+    const std::string& getMethod() const override {
+        return request_.getMethod();
+    }
+    std::string get(const std::string& name) const override {
+        return request_.get(name, "");
+    }
+    std::istream& stream() override {
+        return request_.stream();
+    }
+
+private:
+    Poco::Net::HTTPServerRequest& request_;
+};
+
+class ServerResponse : public Response {
+public:
+    ServerResponse(Poco::Net::HTTPServerResponse& response) : response_{response} {
+    }
+protected:
+    std::ostream& SendHeaders() override {
+        response_.setStatus(getStatus());
+        if (has("Content-Encoding")) {
+            response_.set("Content-Encoding", get("Content-Encoding"));
+        }
+        return response_.send();
+    }
+
+private:
+    Poco::Net::HTTPServerResponse& response_;
+};
+
 class FakeHandler : public Poco::Net::HTTPRequestHandler {
 public:
-    FakeHandler(TestCase* test_case) : test_case_{test_case} {
+    FakeHandler(TestCase* test_case, const std::string& content_encoding)
+        : test_case_{test_case}, content_encoding_{content_encoding} {
     }
 
-    void handleRequest(Request& request, Response& response) override {
+    void handleRequest(Poco::Net::HTTPServerRequest& request,
+                       Poco::Net::HTTPServerResponse& response) override {
         std::lock_guard guard{mutex_};
-        try {
-            test_case_->HandleRequest(request, response);
-        } catch (const CheckFailedException& e) {
-            response.setStatus(Response::HTTP_BAD_REQUEST);
-            response.send();
-        } catch (const std::exception& e) {
-            test_case_->Fail(e.what());
-            throw;
-        }
+        ServerRequest server_request{request};
+        ServerResponse server_response{response};
+        Serve(test_case_, content_encoding_, server_request, server_response);
     }
 
 private:
     std::mutex mutex_;
     TestCase* test_case_;
+    std::string content_encoding_;
 };
 
 class FakeHandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
 public:
-    FakeHandlerFactory(TestCase* test_case) : test_case_{test_case} {
+    FakeHandlerFactory(TestCase* test_case, const std::string& content_encoding)
+        : test_case_{test_case}, content_encoding_{content_encoding} {
+    }
+    Poco::Net::HTTPRequestHandler* createRequestHandler(const Poco::Net::HTTPServerRequest&) override {
+        return new FakeHandler{test_case_, content_encoding_};
+    }
+
+private:
+    TestCase* test_case_;
+    std::string content_encoding_;
+};
+
+class LoopbackRequest : public Request {
+public:
+    LoopbackRequest(const LoopbackHandler::Request& request) : request_{request} {
+    }
+    const std::string& getURI() const override {
+        return request_.uri;
+    }
+    const std::string& getMethod() const override {
+        return request_.method;
+    }
+    std::string get(const std::string& name) const override {
+        if (name == "Content-Type") {
+            return request_.content_type;
+        }
+        if (name == "Accept-Encoding") {
+            return request_.accept_encoding;
+        }
+        return "";
+    }
+    std::istream& stream() override {
+        return request_.body;
+    }
+
+private:
+    const LoopbackHandler::Request& request_;
+};
+
+class LoopbackResponse : public Response {
+public:
+    LoopbackResponse(LoopbackHandler::Response* response) : response_{response} {
     }
-    Poco::Net::HTTPRequestHandler* createRequestHandler(const Request&) override {
-        return new FakeHandler{test_case_};
+
+protected:
+    std::ostream& SendHeaders() override {
+        response_->status = getStatus();
+        response_->content_encoding = get("Content-Encoding", "");
+        return response_->body;
+    }
+
+private:
+    LoopbackHandler::Response* response_;
+};
+
+class FakeLoopbackHandler : public LoopbackHandler {
+public:
+    FakeLoopbackHandler(TestCase* test_case, const std::string& content_encoding)
+        : test_case_{test_case}, content_encoding_{content_encoding} {
+    }
+
+    void Handle(const LoopbackHandler::Request& request,
+                LoopbackHandler::Response* response) override {
+        // The transport calls in from every thread that uses it; test cases keep
+        // their state unsynchronized.
+        std::lock_guard guard{mutex_};
+        LoopbackRequest loopback_request{request};
+        LoopbackResponse loopback_response{response};
+        Serve(test_case_, content_encoding_, loopback_request, loopback_response);
+        response->status = loopback_response.getStatus();
     }
 
 private:
+    std::mutex mutex_;
     TestCase* test_case_;
+    std::string content_encoding_;
 };
 
-FakeServer::FakeServer(const std::string& test_case) {
+FakeServer::FakeServer(const std::string& test_case, const std::string& content_encoding)
+    : content_encoding_{content_encoding} {
     if (test_case == "Single getMe") {
         test_case_ = std::make_unique<SingleGetMeTestCase>();
     } else if (test_case == "getMe error handling") {
@@ -270,6 +513,12 @@ FakeServer::FakeServer(const std::string& test_case) {
         test_case_ = std::make_unique<GetUpdatesAndSendMessagesTestCase>();
     } else if (test_case == "Handle getUpdates offset") {
         test_case_ = std::make_unique<HandleOffsetTestCase>();
+    } else if (test_case == "Send message throughput") {
+        test_case_ = std::make_unique<SendMessageThroughputTestCase>();
+    } else if (test_case == "sendMessage flood wait") {
+        test_case_ = std::make_unique<FloodWaitTestCase>();
+    } else if (test_case == "Large getUpdates") {
+        test_case_ = std::make_unique<LargeGetUpdatesTestCase>();
     } else {
         throw std::runtime_error{"Unknown test case name " + test_case};
     }
@@ -282,7 +531,7 @@ FakeServer::~FakeServer() {
 void FakeServer::Start() {
     Poco::Net::SocketAddress address{"localhost", 8080};
     socket_ = std::make_unique<Poco::Net::ServerSocket>(address);
-    auto* factory = new FakeHandlerFactory(test_case_.get());
+    auto* factory = new FakeHandlerFactory(test_case_.get(), content_encoding_);
     auto* params = new Poco::Net::HTTPServerParams;
     server_ = std::make_unique<Poco::Net::HTTPServer>(factory, *socket_, params);
     server_->start();
@@ -292,6 +541,11 @@ std::string FakeServer::GetUrl() {
     return "http://localhost:8080/";
 }
 
+std::shared_ptr<Transport> FakeServer::MakeLoopbackTransport() {
+    return std::make_shared<LoopbackTransport>(
+        std::make_shared<FakeLoopbackHandler>(test_case_.get(), content_encoding_));
+}
+
 void FakeServer::Stop() {
     if (server_) {
         server_->stop();
@@ -6,21 +6,29 @@
 #include <Poco/Net/HTTPServer.h>
 #include <Poco/Net/ServerSocket.h>
 
+#include "telegram/transport.h"
+
 namespace telegram {
 
 class TestCase;
 
 class FakeServer {
 public:
-    FakeServer(const std::string& test_case);
+    // A non-empty content_encoding ("gzip" or "deflate") compresses every response
+    // whose request accepts that encoding.
+    FakeServer(const std::string& test_case, const std::string& content_encoding = "");
     ~FakeServer();
     void Start();
     std::string GetUrl();
+    // Serves the same scenario in-process; no Start() needed. Requests through the
+    // transport are served one at a time.
+    std::shared_ptr<Transport> MakeLoopbackTransport();
     void Stop();
     void StopAndCheckExpectations();
 
 private:
     std::unique_ptr<TestCase> test_case_;
+    std::string content_encoding_;
     std::unique_ptr<Poco::Net::ServerSocket> socket_;
     std::unique_ptr<Poco::Net::HTTPServer> server_;
 };
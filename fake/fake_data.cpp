@@ -18,6 +18,16 @@ const std::string fake_data::kGetMeErrorJson = R"(
    "error_code" : 401
 })";
 
+const std::string fake_data::kTooManyRequestsJson = R"(
+{
+   "description" : "Too Many Requests: retry after 1",
+   "ok" : false,
+   "error_code" : 429,
+   "parameters" : {
+      "retry_after" : 1
+   }
+})";
+
 const std::string fake_data::kGetUpdatesFourMessagesJson = R"(
 {
    "result" : [
@@ -298,3 +308,44 @@ const std::string fake_data::kGetupdatesOneMessage = R"(
    ],
    "ok" : true
 })";
+
+std::string fake_data::GetUpdatesJson(size_t count) {
+    // Already escaped for JSON; the last one exercises escape decoding.
+    static const char* kTexts[] = {"/random", "/weather", "/styleguide",
+                                   R"(Привет, \"бот\"!\nКак дела? \u263A)"};
+
+    std::string json = "{\n   \"ok\" : true,\n   \"result\" : [";
+    for (size_t i = 0; i < count; ++i) {
+        auto chat_id = std::to_string(104519755 + static_cast<int64_t>(i % 17));
+        json += i == 0 ? "\n" : ",\n";
+        json += R"(      {
+         "message" : {
+            "entities" : [
+               {
+                  "offset" : 0,
+                  "type" : "bot_command",
+                  "length" : 6
+               }
+            ],
+            "chat" : {
+               "type" : "private",
+               "username" : "darth_slon",
+               "first_name" : "Fedor",
+               "id" : )" + chat_id + R"(
+            },
+            "date" : 1510493105,
+            "text" : ")" + kTexts[i % 4] + R"(",
+            "message_id" : )" + std::to_string(i + 1) + R"(,
+            "from" : {
+               "is_bot" : false,
+               "first_name" : "Fedor",
+               "id" : )" + chat_id + R"(,
+               "username" : "darth_slon"
+            }
+         },
+         "update_id" : )" + std::to_string(851793506 + i) + R"(
+      })";
+    }
+    json += "\n   ]\n}";
+    return json;
+}
@@ -1,11 +1,13 @@
 #pragma once
 
 #include <string>
+#include <cstddef>
 
 namespace fake_data {
 extern const std::string kGetMeJson;
 
 extern const std::string kGetMeErrorJson;
+extern const std::string kTooManyRequestsJson;
 
 extern const std::string kGetUpdatesFourMessagesJson;
 extern const std::string kSendMessageHiJson;
@@ -14,4 +16,7 @@ extern const std::string kSendMessageReplyJson;
 extern const std::string kGetUpdatesTwoMessages;
 extern const std::string kGetUpdatesZeroMessages;
 extern const std::string kGetupdatesOneMessage;
+
+// getUpdates reply with `count` private messages spread over 17 chats.
+std::string GetUpdatesJson(size_t count);
 }  // namespace fake_data
@@ -0,0 +1,107 @@
+#include "async_client.h"
+
+telegram::AsyncClient::AsyncClient(Client *client, EventLoop *loop,
+                                   const AsyncClientConfig &config)
+    : client_(client),
+      loop_(loop),
+      http_(config.endpoint.empty()
+                ? nullptr
+                : std::make_unique<LoopHttp>(loop, config.endpoint, config.connections)) {
+}
+
+telegram::AsyncClient::~AsyncClient() = default;
+
+telegram::AsyncClient::Awaiter<telegram::Client::GetMeAnswer> telegram::AsyncClient::GetMe(
+    CancellationToken token) {
+    if (http_) {
+        return OnLoop(GetMeOnLoop(), std::move(token));
+    }
+    return {loop_,
+            [client = client_](auto done) { client->GetMeAsync(std::move(done)); },
+            std::move(token)};
+}
+
+telegram::AsyncClient::Awaiter<std::vector<telegram::Client::Update>>
+telegram::AsyncClient::FetchUpdates(std::optional<int64_t> timeout, std::optional<int64_t> offset,
+                                    CancellationToken token) {
+    if (http_) {
+        return OnLoop(FetchUpdatesOnLoop(timeout, offset), std::move(token));
+    }
+    return {loop_,
+            [client = client_, timeout, offset](auto done) {
+                client->FetchUpdatesAsync(timeout, offset, std::move(done));
+            },
+            std::move(token)};
+}
+
+telegram::AsyncClient::Awaiter<void> telegram::AsyncClient::SendMessage(
+    std::string message, int64_t chat_id, std::optional<int64_t> reply_to_message_id,
+    CancellationToken token) {
+    if (http_) {
+        return OnLoop(SendMessageOnLoop(std::move(message), chat_id, reply_to_message_id),
+                      std::move(token));
+    }
+    return {loop_,
+            [client = client_, message = std::move(message), chat_id,
+             reply_to_message_id](auto done) {
+                client->SendMessageAsync(message, chat_id, reply_to_message_id,
+                                         [done = std::move(done)](std::exception_ptr error) {
+                                             done(error, std::monostate{});
+                                         });
+            },
+            std::move(token)};
+}
+
+telegram::Task<telegram::Client::GetMeAnswer> telegram::AsyncClient::GetMeOnLoop() {
+    std::string path;
+    client_->Requests().BuildPath(ApiMethod::kGetMe, &path);
+    auto start = Histogram::Clock::now();
+    auto reply = co_await http_->RoundTrip(HttpMethodOf(ApiMethod::kGetMe), path, {});
+    std::istringstream is(std::move(reply.body));
+    co_return client_->ReadGetMeReply(reply.status, is, start);
+}
+
+telegram::Task<std::vector<telegram::Client::Update>> telegram::AsyncClient::FetchUpdatesOnLoop(
+    std::optional<int64_t> timeout, std::optional<int64_t> offset) {
+    std::string path;
+    client_->Requests().BuildGetUpdatesPath(timeout, offset, &path);
+    auto start = Histogram::Clock::now();
+    auto reply = co_await http_->RoundTrip(HttpMethodOf(ApiMethod::kGetUpdates), path, {});
+    std::istringstream is(std::move(reply.body));
+    co_return client_->ReadUpdatesReply(reply.status, is, start);
+}
+
+telegram::Task<> telegram::AsyncClient::SendMessageOnLoop(
+    std::string message, int64_t chat_id, std::optional<int64_t> reply_to_message_id) {
+    std::string path;
+    std::string body;
+    client_->Requests().BuildPath(ApiMethod::kSendMessage, &path);
+    RequestBuilder::BuildSendMessageBody(message, chat_id, reply_to_message_id, &body);
+    for (size_t attempt = 0;; ++attempt) {
+        // The rate limits are waited out on the loop rather than on a thread.
+        while (true) {
+            auto now = RateLimiter::Clock::now();
+            auto due = client_->TryAcquireSendSlot(chat_id, now);
+            if (due <= now) {
+                break;
+            }
+            co_await loop_->Sleep(due - now);
+        }
+
+        auto start = Histogram::Clock::now();
+        auto reply = co_await http_->RoundTrip(HttpMethodOf(ApiMethod::kSendMessage), path, body);
+        std::chrono::seconds retry_after{};
+        try {
+            std::istringstream is(std::move(reply.body));
+            client_->ReadSendMessageReply(reply.status, is, chat_id, start);
+            co_return;
+        } catch (const TooManyRequests &error) {
+            if (attempt == client_->MaxSendRetries()) {
+                throw;
+            }
+            retry_after = error.RetryAfter();
+        }
+        // The limiter holds the chat as long, unless the limits are disabled.
+        co_await loop_->Sleep(retry_after);
+    }
+}
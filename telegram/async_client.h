@@ -0,0 +1,179 @@
+#pragma once
+
+#include <mutex>
+#include <variant>
+#include <type_traits>
+#include "client.h"
+#include "event_loop.h"
+#include "loop_http.h"
+
+namespace telegram {
+struct AsyncClientConfig {
+    // An http:// endpoint to reach straight from the loop thread over nonblocking
+    // sockets, such as a local Bot API server or a proxy that adds TLS. Empty: requests
+    // run on the client's I/O executor.
+    std::string endpoint{};
+    // Keep-alive connections to the endpoint; more requests at once wait for one.
+    size_t connections = 16;
+};
+
+// Awaitable front end of Client for coroutines running on an EventLoop:
+//
+//     co_await client.SendMessage("Hi!", chat_id);
+//
+// The awaiting coroutine is resumed on the loop thread, so a suspended conversation
+// holds no thread. With an endpoint in the config, neither does a request in flight:
+// the loop sends it, waits for the sockets and the rate limits, and reads the reply,
+// so thousands of conversations run on the loop thread alone. Without one the
+// blocking exchange runs on the client's I/O executor and holds one of its threads
+// for the whole round trip, so at most ClientConfig::io_threads requests run at once.
+// Either way the client's rate limits and metrics apply. Must outlive the loop's Run().
+class AsyncClient {
+public:
+    AsyncClient(Client *client, EventLoop *loop, const AsyncClientConfig &config = {});
+    ~AsyncClient();
+
+    template <class T>
+    class Awaiter;
+
+    Awaiter<Client::GetMeAnswer> GetMe(CancellationToken token = {});
+
+    Awaiter<std::vector<Client::Update>> FetchUpdates(std::optional<int64_t> timeout = std::nullopt,
+                                                      std::optional<int64_t> offset = std::nullopt,
+                                                      CancellationToken token = {});
+
+    Awaiter<void> SendMessage(std::string message, int64_t chat_id,
+                              std::optional<int64_t> reply_to_message_id = std::nullopt,
+                              CancellationToken token = {});
+
+    EventLoop *Loop() const {
+        return loop_;
+    }
+
+private:
+    // Runs the request as a task of the loop; a cancelled awaiter leaves it to finish.
+    template <class T>
+    Awaiter<T> OnLoop(Task<T> request, CancellationToken token);
+
+    template <class T, class Done>
+    static Task<> Complete(Task<T> request, Done done);
+
+    Task<Client::GetMeAnswer> GetMeOnLoop();
+    Task<std::vector<Client::Update>> FetchUpdatesOnLoop(std::optional<int64_t> timeout,
+                                                         std::optional<int64_t> offset);
+    Task<> SendMessageOnLoop(std::string message, int64_t chat_id,
+                             std::optional<int64_t> reply_to_message_id);
+
+    Client *client_;
+    EventLoop *loop_;
+    // Set when the config has an endpoint.
+    std::unique_ptr<LoopHttp> http_;
+};
+
+template <class T>
+class AsyncClient::Awaiter {
+public:
+    using Value = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+    // Starts the request; the argument must be called exactly once from any thread.
+    using Start = std::function<void(std::function<void(std::exception_ptr, Value)>)>;
+
+    Awaiter(EventLoop *loop, Start start, CancellationToken token)
+        : loop_(loop), start_(std::move(start)), token_(std::move(token)) {
+    }
+
+    bool await_ready() const {
+        return token_.IsCancelled();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        // Shared with the completion, which may arrive after a cancellation resumed us,
+        // and so after this awaiter and its coroutine are gone: nothing below keeps this.
+        auto state = std::make_shared<State>();
+        state_ = state;
+
+        state->subscription = token_.Subscribe([loop = loop_, state, handle] {
+            {
+                std::lock_guard guard(state->mutex);
+                if (state->done) {
+                    return;
+                }
+                state->done = true;
+                state->cancelled = true;
+            }
+            loop->Post([handle] { handle.resume(); });
+        });
+
+        start_([loop = loop_, token = token_, state, handle](std::exception_ptr error,
+                                                             Value value) mutable {
+            // Decided under the lock, so once cancelled the loop is not touched: it may
+            // be gone by now.
+            std::lock_guard guard(state->mutex);
+            if (state->done) {
+                return;
+            }
+            state->done = true;
+            state->error = error;
+            state->value = std::move(value);
+            loop->Post([token = std::move(token), state, handle]() mutable {
+                token.Unsubscribe(state->subscription);
+                handle.resume();
+            });
+        });
+    }
+
+    T await_resume() {
+        if (!state_ || state_->cancelled) {
+            throw OperationCancelled();
+        }
+        if (state_->error) {
+            std::rethrow_exception(state_->error);
+        }
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(state_->value);
+        }
+    }
+
+private:
+    struct State {
+        std::mutex mutex;
+        // Set by whichever of the completion and the cancellation comes first.
+        bool done = false;
+        bool cancelled = false;
+        uint64_t subscription = 0;
+        std::exception_ptr error;
+        Value value{};
+    };
+
+    EventLoop *loop_;
+    Start start_;
+    CancellationToken token_;
+    std::shared_ptr<State> state_;
+};
+
+template <class T>
+AsyncClient::Awaiter<T> AsyncClient::OnLoop(Task<T> request, CancellationToken token) {
+    // Start is copyable, the task is not.
+    auto task = std::make_shared<Task<T>>(std::move(request));
+    return {loop_,
+            [loop = loop_, task](auto done) {
+                loop->Spawn(Complete(std::move(*task), std::move(done)));
+            },
+            std::move(token)};
+}
+
+template <class T, class Done>
+Task<> AsyncClient::Complete(Task<T> request, Done done) {
+    std::exception_ptr error;
+    typename Awaiter<T>::Value value{};
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await request;
+        } else {
+            value = co_await request;
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    done(error, std::move(value));
+}
+}  // namespace telegram
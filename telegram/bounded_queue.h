@@ -0,0 +1,60 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <condition_variable>
+
+namespace telegram {
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {
+    }
+
+    // Blocks while the queue is full. Returns false if the queue was closed.
+    bool Push(T value) {
+        std::unique_lock lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(value));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Blocks while the queue is empty. Returns nullopt once the queue is closed and drained.
+    std::optional<T> Pop() {
+        std::unique_lock lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return std::nullopt;
+        }
+        T value = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return value;
+    }
+
+    void Close() {
+        std::lock_guard guard(mutex_);
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+    size_t Size() const {
+        std::lock_guard guard(mutex_);
+        return items_.size();
+    }
+
+private:
+    const size_t capacity_;
+    mutable std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<T> items_;
+    bool closed_ = false;
+};
+}  // namespace telegram
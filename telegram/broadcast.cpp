@@ -0,0 +1,213 @@
+#include "broadcast.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include "offset_store.h"
+
+namespace {
+constexpr uint32_t kMagic = 0x4c425553;  // "SUBL"
+
+struct Header {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+void AppendVarint(uint64_t value, std::string *out) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+}  // namespace
+
+void telegram::SubscriberList::Write(const std::string &path, std::vector<int64_t> chat_ids) {
+    std::sort(chat_ids.begin(), chat_ids.end());
+    chat_ids.erase(std::unique(chat_ids.begin(), chat_ids.end()), chat_ids.end());
+
+    std::string data(sizeof(Header), '\0');
+    data.reserve(sizeof(Header) + chat_ids.size() * 2);
+    Header header{kMagic, 0, chat_ids.size()};
+    std::memcpy(data.data(), &header, sizeof header);
+    uint64_t previous = 0;
+    for (size_t i = 0; i < chat_ids.size(); ++i) {
+        auto chat_id = static_cast<uint64_t>(chat_ids[i]);
+        if (i == 0) {
+            // Zigzag, so a negative first id stays short.
+            AppendVarint((chat_id << 1) ^ static_cast<uint64_t>(chat_ids[0] >> 63), &data);
+        } else {
+            // Sorted and unique, so every delta is positive; unsigned, so it cannot overflow.
+            AppendVarint(chat_id - previous, &data);
+        }
+        previous = chat_id;
+    }
+
+    auto temp = path + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!out.flush()) {
+            throw std::runtime_error("cannot write " + temp);
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        throw std::system_error(errno, std::generic_category(), "rename " + temp);
+    }
+}
+
+telegram::SubscriberList::SubscriberList(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        ::close(fd);
+        throw std::runtime_error("not a subscriber list: " + path);
+    }
+    map_size_ = static_cast<size_t>(st.st_size);
+    void *map = ::mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "mmap " + path);
+    }
+    ::madvise(map, map_size_, MADV_SEQUENTIAL);
+    map_ = static_cast<const uint8_t *>(map);
+
+    Header header;
+    std::memcpy(&header, map_, sizeof header);
+    // Every id ends in a byte below 0x80, so counting those tells whether the data
+    // holds as many ids as the header says, and Cursor::Next() will not run out.
+    auto *begin = map_ + sizeof(Header);
+    auto *end = map_ + map_size_;
+    auto ends = std::count_if(begin, end, [](uint8_t byte) { return byte < 0x80; });
+    if (header.magic != kMagic || static_cast<uint64_t>(ends) != header.size ||
+        (begin != end && end[-1] >= 0x80)) {
+        ::munmap(map, map_size_);
+        throw std::runtime_error("not a subscriber list: " + path);
+    }
+    size_ = header.size;
+}
+
+telegram::SubscriberList::~SubscriberList() {
+    ::munmap(const_cast<uint8_t *>(map_), map_size_);
+}
+
+telegram::SubscriberList::Cursor telegram::SubscriberList::Begin() const {
+    return Cursor(map_ + sizeof(Header), map_ + map_size_, size_);
+}
+
+bool telegram::SubscriberList::Cursor::Next(int64_t *chat_id) {
+    if (left_ == 0) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        if (data_ == end_ || shift > 63) {
+            throw std::runtime_error("subscriber list is truncated");
+        }
+        auto byte = *data_++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            break;
+        }
+    }
+    if (first_) {
+        first_ = false;
+        previous_ = static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    } else {
+        previous_ = static_cast<int64_t>(static_cast<uint64_t>(previous_) + value);
+    }
+    --left_;
+    *chat_id = previous_;
+    return true;
+}
+
+telegram::BroadcastResult telegram::Broadcast(SendQueue *queue, const PreparedText &text,
+                                              const SubscriberList &subscribers,
+                                              const BroadcastConfig &config) {
+    std::optional<OffsetStore> checkpoint;
+    size_t start = 0;
+    if (!config.checkpoint_path.empty()) {
+        checkpoint.emplace(config.checkpoint_path,
+                           OffsetStoreConfig{.commit_every = config.checkpoint_every});
+        start = std::min(static_cast<size_t>(checkpoint->Load()), subscribers.Size());
+    }
+
+    // Sends finish out of order; the checkpoint is the first position not yet done,
+    // tracked in a ring of flags over the window.
+    const auto window = std::max<size_t>(config.window, 1);
+    std::vector<bool> done(std::bit_ceil(window));
+    const auto mask = done.size() - 1;
+    std::mutex mutex;
+    std::condition_variable progressed;
+    size_t issued = start;
+    size_t low = start;
+    BroadcastResult result{start, 0, 0};
+
+    auto cursor = subscribers.Begin();
+    int64_t chat_id;
+    for (size_t i = 0; i < start; ++i) {
+        cursor.Next(&chat_id);
+    }
+
+    size_t stored = start;
+    std::unique_lock lock(mutex);
+    try {
+        while (cursor.Next(&chat_id)) {
+            progressed.wait(lock, [&] { return issued - low < window; });
+            if (checkpoint && low != stored) {
+                checkpoint->Store(static_cast<int64_t>(low));
+                stored = low;
+            }
+
+            auto position = issued++;
+            lock.unlock();
+            try {
+                queue->Send(SendPriority::kBulk, text, chat_id, std::nullopt,
+                            [&, position](std::exception_ptr error) {
+                                // Notified under the lock: Broadcast returns as soon as it
+                                // is released.
+                                std::lock_guard guard(mutex);
+                                ++(error ? result.failed : result.sent);
+                                done[position & mask] = true;
+                                while (low < issued && done[low & mask]) {
+                                    done[low & mask] = false;
+                                    ++low;
+                                }
+                                progressed.notify_all();
+                            });
+            } catch (...) {
+                // Not queued, so no callback counts it.
+                lock.lock();
+                --issued;
+                throw;
+            }
+            lock.lock();
+        }
+    } catch (...) {
+        // The callbacks of the sends in flight use this frame.
+        progressed.wait(lock, [&] { return low == issued; });
+        throw;
+    }
+    progressed.wait(lock, [&] { return low == issued; });
+    if (checkpoint) {
+        checkpoint->Store(static_cast<int64_t>(low));
+        checkpoint->Flush();
+    }
+    return result;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "request_builder.h"
+#include "send_queue.h"
+
+namespace telegram {
+// A read-only, memory-mapped list of chat ids, sorted and stored as varint
+// deltas: a few bytes per subscriber instead of eight.
+class SubscriberList {
+public:
+    // Sorts and deduplicates the ids and writes them to path, replacing it atomically.
+    static void Write(const std::string &path, std::vector<int64_t> chat_ids);
+
+    // Throws std::runtime_error if the file does not hold as many ids as it says.
+    explicit SubscriberList(const std::string &path);
+    ~SubscriberList();
+
+    SubscriberList(const SubscriberList &) = delete;
+    SubscriberList &operator=(const SubscriberList &) = delete;
+
+    size_t Size() const {
+        return size_;
+    }
+
+    // Decodes the ids in order. Throws std::runtime_error on an id longer than 64 bits.
+    class Cursor {
+    public:
+        bool Next(int64_t *chat_id);
+
+    private:
+        friend class SubscriberList;
+
+        Cursor(const uint8_t *data, const uint8_t *end, size_t size)
+            : data_(data), end_(end), left_(size) {
+        }
+
+        const uint8_t *data_;
+        const uint8_t *end_;
+        size_t left_;
+        int64_t previous_ = 0;
+        bool first_ = true;
+    };
+
+    Cursor Begin() const;
+
+private:
+    const uint8_t *map_ = nullptr;
+    size_t map_size_ = 0;
+    size_t size_ = 0;
+};
+
+struct BroadcastConfig {
+    // Messages handed to the send queue and not yet sent.
+    size_t window = 256;
+    // Where progress is kept for resuming after a crash; none if empty.
+    std::string checkpoint_path{};
+    // Progress is committed after this many messages.
+    size_t checkpoint_every = 256;
+};
+
+struct BroadcastResult {
+    // Subscribers passed over because the checkpoint had them done.
+    size_t resumed;
+    size_t sent;
+    // Chats that blocked the bot or no longer exist, among other errors.
+    size_t failed;
+};
+
+// Sends the text to every subscriber as bulk messages, so interactive replies in
+// the same queue still go first and the client's rate limits set the pace. The
+// body is serialized once; each send only adds the chat id. With a checkpoint a
+// rerun resumes where the last run stopped; messages in flight during a crash may
+// be sent twice.
+BroadcastResult Broadcast(SendQueue *queue, const PreparedText &text,
+                          const SubscriberList &subscribers, const BroadcastConfig &config = {});
+}  // namespace telegram
@@ -1,122 +1,423 @@
 #include "client.h"
-#include <unordered_map>
-#include <fstream>
+#include "poco_transport.h"
+#include "update_parser.h"
+#include "flight_recorder.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <Poco/InflatingStream.h>
 
-Poco::Dynamic::Var telegram::Client::ProduceRequest(
-    const std::string &key, const std::string &method, const Poco::JSON::Object &body_params,
-    const std::unordered_map<std::string, std::string> &query_params,
-    const std::string &http_method) {
-    const std::string path = "/" + key + "/" + method;
-    Poco::URI uri(path);
-    Poco::JSON::Stringifier str;
+namespace {
+Poco::InflatingStreamBuf::StreamType InflatingTypeOf(const std::string &content_encoding) {
+    if (content_encoding == "gzip") {
+        return Poco::InflatingStreamBuf::STREAM_GZIP;
+    }
+    if (content_encoding == "deflate") {
+        return Poco::InflatingStreamBuf::STREAM_ZLIB;
+    }
+    throw std::runtime_error("unsupported Content-Encoding " + content_encoding);
+}
+
+// Reads what the parser left (trailing whitespace, the gzip trailer) so the
+// keep-alive connection is positioned at the next response.
+void Drain(std::istream &is) {
+    is.clear();
+    is.ignore(std::numeric_limits<std::streamsize>::max());
+}
 
-    for (auto &[k, v] : query_params) {
-        uri.addQueryParameter(k, v);
+// Reads a reply up to its top-level "ok" and tells whether it is true, without
+// building a DOM; whatever follows is left to Drain. Telegram puts "ok" first, but
+// any order will do.
+bool SkimOk(std::istream &is) {
+    int depth = 0;
+    bool key = false;
+    for (auto c = is.get(); c != std::istream::traits_type::eof(); c = is.get()) {
+        if (c == '{' || c == '[') {
+            ++depth;
+            key = depth == 1 && c == '{';
+        } else if (c == '}' || c == ']') {
+            --depth;
+        } else if (c == ',') {
+            key = depth == 1;
+        } else if (c == '"') {
+            char name[2];
+            size_t size = 0;
+            for (auto escaped = false; (c = is.get()) != std::istream::traits_type::eof();) {
+                if (!escaped && c == '"') {
+                    break;
+                }
+                escaped = !escaped && c == '\\';
+                if (size < sizeof name) {
+                    name[size] = static_cast<char>(c);
+                }
+                ++size;
+            }
+            if (key && size == 2 && name[0] == 'o' && name[1] == 'k') {
+                char value[4];
+                is >> std::ws;
+                if (is.get() != ':') {
+                    return false;
+                }
+                is >> std::ws;
+                is.read(value, sizeof value);
+                return is.gcount() == sizeof value && std::memcmp(value, "true", 4) == 0;
+            }
+            key = false;
+        }
     }
+    return false;
+}
 
-    Poco::Net::HTTPRequest req(http_method, uri.getPathAndQuery(),
-                               Poco::Net::HTTPMessage::HTTP_1_1);
+telegram::Client::GetMeAnswer ParseGetMe(std::istream &is) {
+    auto o = Poco::JSON::Parser().parse(is).extract<Poco::JSON::Object::Ptr>();
+    auto res = o->getObject("result");
+    auto ido = res->get("id");
+    auto id = ido.convert<uint64_t>();
+    std::string username;
+    if (res->has("username")) {
+        username = res->getValue<std::string>("username");
+    }
+    return {id, std::move(username)};
+}
 
-    req.add("Content-Type", "application/json");
-    std::ostringstream oss;
-    str.condense(body_params, oss);
-    req.add("Content-Length", std::to_string(oss.str().size()));
+std::vector<telegram::Client::Update> ToUpdates(const telegram::UpdateBatch &batch) {
+    std::vector<telegram::Client::Update> result;
+    result.reserve(batch.Size());
+    for (size_t i = 0; i < batch.Size(); ++i) {
+        const auto &entry = batch[i];
+        result.push_back(
+            {entry.update_id, entry.chat_id, entry.message_id, std::string(batch.Text(i))});
+    }
+    return result;
+}
 
-    auto &req_body = session_->sendRequest(req);
-    str.condense(body_params, req_body);
+// The sent message that comes back is of no use; only "ok" is looked at.
+void CheckSent(std::istream &is) {
+    if (!SkimOk(is)) {
+        throw std::runtime_error("sendMessage reply is not ok");
+    }
+}
 
-    Poco::Net::HTTPResponse res;
-    std::istream &is = session_->receiveResponse(res);
+void ParseReply(int status, std::istream &is, const std::function<void(std::istream &)> &parse) {
+    if (status == Poco::Net::HTTPResponse::HTTPStatus::HTTP_OK) {
+        parse(is);
+        Drain(is);
+        return;
+    }
 
-    if (auto status = res.getStatus(); status != Poco::Net::HTTPResponse::HTTPStatus::HTTP_OK) {
-        throw std::runtime_error("error1");
+    // Error replies look like {"ok":false,"description":..,"parameters":{"retry_after":..}},
+    // though a proxy in between may answer with anything.
+    std::string description = "HTTP status " + std::to_string(status);
+    std::chrono::seconds retry_after{1};
+    try {
+        Poco::JSON::Parser parser;
+        auto object = parser.parse(is).extract<Poco::JSON::Object::Ptr>();
+        if (object->has("description")) {
+            description = object->getValue<std::string>("description");
+        }
+        if (auto parameters = object->getObject("parameters");
+            parameters && parameters->has("retry_after")) {
+            retry_after = std::chrono::seconds(parameters->getValue<int64_t>("retry_after"));
+        }
+    } catch (const Poco::Exception &) {
     }
+    Drain(is);
 
-    Poco::JSON::Parser parser;
-    return parser.parse(is);
+    if (status == Poco::Net::HTTPResponse::HTTPStatus::HTTP_TOO_MANY_REQUESTS) {
+        throw telegram::TooManyRequests(description, retry_after);
+    }
+    throw telegram::ApiError(status, description);
 }
+}  // namespace
 
-telegram::Client::GetMeAnswer telegram::Client::GetMe() {
-    auto resp = ProduceRequest(api_key_, "getMe");
+void telegram::Client::Exchange(Connection &connection, ApiMethod method,
+                                const std::function<void(std::istream &)> &parse) {
+    auto start = Histogram::Clock::now();
+    FlightRecorder::Global().Record("request", 0, 0, NameOf(method).data());
+    int status = 0;
+    try {
+        auto reply = [&] {
+            // Sending the request and waiting for the headers: the long poll itself.
+            Span span("request");
+            return connection.RoundTrip(HttpMethodOf(method), accept_encoding_);
+        }();
+        status = reply.status;
+        Span span("reply");
+        if (reply.content_encoding.empty() || reply.content_encoding == "identity") {
+            ParseReply(reply.status, reply.body, parse);
+        } else {
+            // Inflate while parsing; the compressed body is never buffered as a whole.
+            Poco::InflatingInputStream inflated(reply.body,
+                                                InflatingTypeOf(reply.content_encoding));
+            try {
+                ParseReply(reply.status, inflated, parse);
+                Drain(reply.body);
+            } catch (const ApiError &) {
+                Drain(reply.body);
+                throw;
+            }
+        }
+    } catch (const ApiError &) {
+        // The whole reply has been read, the connection is fine for the next request.
+        RecordRequest(method, status, start);
+        throw;
+    } catch (...) {
+        // The connection may hold an unread body or a half-sent request.
+        connection.Reset();
+        RecordRequest(method, status, start);
+        throw;
+    }
+    RecordRequest(method, status, start);
+}
 
-    auto o = resp.extract<Poco::JSON::Object::Ptr>();
-    auto res = o->getObject("result");
-    auto ido = res->get("id");
-    auto id = ido.convert<uint64_t>();
+void telegram::Client::RecordRequest(ApiMethod method, int status,
+                                     Histogram::Clock::time_point start) {
+    // Status 0 when no reply came; the names are literals.
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        Histogram::Clock::now() - start);
+    FlightRecorder::Global().Record("status", status, elapsed.count(), NameOf(method).data());
+    if (!request_latency_) {
+        return;
+    }
+    if (status < 0 || static_cast<size_t>(status) >= kStatuses) {
+        status = 0;
+    }
+    auto &slot = (*request_latency_)[static_cast<size_t>(method) * kStatuses +
+                                     static_cast<size_t>(status)];
+    auto *histogram = slot.load(std::memory_order_acquire);
+    if (!histogram) {
+        // The registry hands out the same histogram to threads racing here.
+        histogram = &metrics_->GetHistogram(
+            "telegram_api_request_seconds", "Bot API request latency",
+            {{"method", std::string(NameOf(method))},
+             {"status", status ? std::to_string(status) : "error"}});
+        slot.store(histogram, std::memory_order_release);
+    }
+    histogram->RecordSince(start);
+}
 
-    return {id};
+telegram::Client::GetMeAnswer telegram::Client::GetMe() {
+    Span span("getMe");
+    GetMeAnswer answer;
+    ProduceRequest(
+        ApiMethod::kGetMe,
+        [this](auto *path, auto *body) {
+            requests_.BuildPath(ApiMethod::kGetMe, path);
+            body->clear();
+        },
+        [&answer](std::istream &is) { answer = ParseGetMe(is); });
+    return answer;
 }
 
 std::vector<telegram::Client::Update> telegram::Client::FetchUpdates(
     std::optional<int64_t> timeout, std::optional<int64_t> offset) {
+    return ToUpdates(*FetchUpdateBatch(timeout, offset));
+}
 
-    std::unordered_map<std::string, std::string> q;
+std::shared_ptr<telegram::UpdateBatch> telegram::Client::FetchUpdateBatch(
+    std::optional<int64_t> timeout, std::optional<int64_t> offset) {
+    return FetchUpdateBatch({.timeout = timeout, .offset = offset});
+}
 
-    if (timeout.has_value()) {
-        q.emplace("timeout", std::to_string(*timeout));
-    }
-    if (offset.has_value()) {
-        q.emplace("offset", std::to_string(*offset));
+std::shared_ptr<telegram::UpdateBatch> telegram::Client::FetchUpdateBatch(
+    const GetUpdatesQuery &query) {
+    Span span("getUpdates");
+    auto batch = std::make_shared<UpdateBatch>();
+    ProduceRequest(
+        ApiMethod::kGetUpdates,
+        [&](auto *path, auto *body) {
+            requests_.BuildGetUpdatesPath(query, path);
+            body->clear();
+        },
+        [this, &batch](std::istream &is) {
+            {
+                Span read("read");
+                IndexedUpdateParser::Read(is, batch.get());
+            }
+            Span parse("parse");
+            update_parser_->Parse(batch.get());
+        });
+    if (!batch->Empty()) {
+        // Ties the poll to the updates it brought.
+        span.SetUpdates((*batch)[0].update_id, (*batch)[batch->Size() - 1].update_id);
     }
+    return batch;
+}
 
-    auto resp = ProduceRequest(api_key_, "getUpdates", Poco::JSON::Object{}, q);
-    std::vector<Update> result;
-    auto object = resp.extract<Poco::JSON::Object::Ptr>();
-    auto arr = object->getArray("result");
-    for (auto &var : *arr) {
-        Update update;
-        auto entry_ptr = var.extract<Poco::JSON::Object::Ptr>();
-        auto message = entry_ptr->get("message");
-        if (message.isEmpty()) {
-            continue;
+void telegram::Client::SendMessage(const std::string &message, int64_t chat_id,
+                                   std::optional<int64_t> reply_to_message_id) {
+    SendText(message, chat_id, reply_to_message_id);
+}
+
+void telegram::Client::SendMessage(const PreparedText &message, int64_t chat_id,
+                                   std::optional<int64_t> reply_to_message_id) {
+    SendText(message, chat_id, reply_to_message_id);
+}
+
+void telegram::Client::AcquireSendSlot(int64_t chat_id) {
+    Span span("rate limit");
+    limiter_.Acquire(chat_id);
+}
+
+telegram::RateLimiter::Clock::time_point telegram::Client::TryAcquireSendSlot(
+    int64_t chat_id, RateLimiter::Clock::time_point now) {
+    return limiter_.TryReserve(chat_id, now);
+}
+
+void telegram::Client::SendMessageInSlot(const std::string &message, int64_t chat_id,
+                                         std::optional<int64_t> reply_to_message_id) {
+    SendTextOnce(message, chat_id, reply_to_message_id);
+}
+
+void telegram::Client::SendMessageInSlot(const PreparedText &message, int64_t chat_id,
+                                         std::optional<int64_t> reply_to_message_id) {
+    SendTextOnce(message, chat_id, reply_to_message_id);
+}
+
+template <class Text>
+void telegram::Client::SendText(const Text &text, int64_t chat_id,
+                                std::optional<int64_t> reply_to_message_id) {
+    for (size_t attempt = 0;; ++attempt) {
+        {
+            Span span("rate limit");
+            limiter_.Acquire(chat_id);
         }
-        auto message_ptr = message.extract<Poco::JSON::Object::Ptr>();
-        auto tmp = entry_ptr->get("update_id");
-        update.update_id = tmp.convert<int64_t>();
-        auto tmp1 = message_ptr->getObject("chat");
-        auto id_var = tmp1->get("id");
-        update.chat_id = id_var.convert<int64_t>();
-        auto tmp2 = message_ptr->get("message_id");
-        update.message_id = tmp2.convert<int64_t>();
-        auto tmp3 = message_ptr->get("text");
-        if (!tmp3.isEmpty()) {
-            update.message = tmp3.convert<std::string>();
+        try {
+            SendTextOnce(text, chat_id, reply_to_message_id);
+            return;
+        } catch (const TooManyRequests &error) {
+            if (attempt == max_send_retries_) {
+                throw;
+            }
+            if (!limiter_enabled_) {
+                std::this_thread::sleep_for(error.RetryAfter());
+            }
         }
-
-        result.push_back(std::move(update));
     }
+}
 
-    std::sort(result.begin(), result.end(),
-              [](auto &&l, auto &&r) { return l.update_id < r.update_id; });
+template <class Text>
+void telegram::Client::SendTextOnce(const Text &text, int64_t chat_id,
+                                    std::optional<int64_t> reply_to_message_id) {
+    try {
+        Span span("sendMessage");
+        ProduceRequest(
+            ApiMethod::kSendMessage,
+            [&](auto *path, auto *body) {
+                requests_.BuildPath(ApiMethod::kSendMessage, path);
+                RequestBuilder::BuildSendMessageBody(text, chat_id, reply_to_message_id, body);
+            },
+            CheckSent);
+    } catch (const TooManyRequests &error) {
+        limiter_.Pause(chat_id, error.RetryAfter());
+        throw;
+    }
+}
 
-    return result;
+telegram::Client::GetMeAnswer telegram::Client::ReadGetMeReply(int status, std::istream &body,
+                                                               Histogram::Clock::time_point start) {
+    GetMeAnswer answer;
+    ReadReply(ApiMethod::kGetMe, status, body, start,
+              [&answer](std::istream &is) { answer = ParseGetMe(is); });
+    return answer;
 }
 
-void telegram::Client::SendMessage(const std::string &message, int64_t chat_id,
-                                   std::optional<int64_t> reply_to_message_id) {
-    Poco::JSON::Object params;
+std::vector<telegram::Client::Update> telegram::Client::ReadUpdatesReply(
+    int status, std::istream &body, Histogram::Clock::time_point start) {
+    UpdateBatch batch;
+    ReadReply(ApiMethod::kGetUpdates, status, body, start, [&batch](std::istream &is) {
+        // update_parser_ belongs to the long-poll connection.
+        IndexedUpdateParser().Parse(is, &batch);
+    });
+    return ToUpdates(batch);
+}
 
-    params.set("text", message);
-    params.set("chat_id", chat_id);
+void telegram::Client::ReadSendMessageReply(int status, std::istream &body, int64_t chat_id,
+                                            Histogram::Clock::time_point start) {
+    try {
+        ReadReply(ApiMethod::kSendMessage, status, body, start, CheckSent);
+    } catch (const TooManyRequests &error) {
+        limiter_.Pause(chat_id, error.RetryAfter());
+        throw;
+    }
+}
 
-    if (reply_to_message_id.has_value()) {
-        params.set("reply_to_message_id", *reply_to_message_id);
+void telegram::Client::ReadReply(ApiMethod method, int status, std::istream &body,
+                                 Histogram::Clock::time_point start,
+                                 const std::function<void(std::istream &)> &parse) {
+    try {
+        ParseReply(status, body, parse);
+    } catch (...) {
+        RecordRequest(method, status, start);
+        throw;
     }
+    RecordRequest(method, status, start);
+}
+
+std::future<telegram::Client::GetMeAnswer> telegram::Client::GetMeAsync() {
+    return Async([this] { return GetMe(); });
+}
 
-    ProduceRequest(api_key_, "sendMessage", params, {}, Poco::Net::HTTPRequest::HTTP_POST);
+std::future<std::vector<telegram::Client::Update>> telegram::Client::FetchUpdatesAsync(
+    std::optional<int64_t> timeout, std::optional<int64_t> offset) {
+    return Async([this, timeout, offset] { return FetchUpdates(timeout, offset); });
 }
 
-telegram::Client::Client(const std::string &api_endpoint, const std::string &api_key)
-    : api_key_(api_key) {
+std::future<void> telegram::Client::SendMessageAsync(std::string message, int64_t chat_id,
+                                                     std::optional<int64_t> reply_to_message_id) {
+    return Async([this, message = std::move(message), chat_id, reply_to_message_id] {
+        SendMessage(message, chat_id, reply_to_message_id);
+    });
+}
 
-    Poco::URI uriobj(api_endpoint);
-    if (api_endpoint.starts_with("https")) {
-        session_ =
-            std::make_unique<Poco::Net::HTTPSClientSession>(uriobj.getHost(), uriobj.getPort());
-    } else {
-        session_ =
-            std::make_unique<Poco::Net::HTTPClientSession>(uriobj.getHost(), uriobj.getPort());
-    }
+void telegram::Client::SendMessageAsync(std::string message, int64_t chat_id,
+                                        std::optional<int64_t> reply_to_message_id,
+                                        Callback callback) {
+    Async(
+        [this, message = std::move(message), chat_id, reply_to_message_id] {
+            SendMessage(message, chat_id, reply_to_message_id);
+        },
+        std::move(callback));
+}
+
+void telegram::Client::GetMeAsync(std::function<void(std::exception_ptr, GetMeAnswer)> callback) {
+    Async([this] { return GetMe(); }, std::move(callback));
+}
+
+void telegram::Client::FetchUpdatesAsync(
+    std::optional<int64_t> timeout, std::optional<int64_t> offset,
+    std::function<void(std::exception_ptr, std::vector<Update>)> callback) {
+    Async([this, timeout, offset] { return FetchUpdates(timeout, offset); }, std::move(callback));
+}
+
+telegram::Executor &telegram::Client::Io() {
+    std::call_once(io_started_, [this] { io_ = std::make_unique<Executor>(io_threads_); });
+    return *io_;
+}
+
+telegram::Client::Client(const std::string &api_endpoint, const std::string &api_key,
+                         const ClientConfig &config)
+    : Client(std::make_shared<PocoTransport>(api_endpoint, config.keep_alive_timeout), api_key,
+             config) {
+}
+
+telegram::Client::Client(std::shared_ptr<Transport> transport, const std::string &api_key,
+                         const ClientConfig &config)
+    : requests_(api_key),
+      transport_(std::move(transport)),
+      connections_(transport_.get(), config.pool_size),
+      long_poll_connections_(transport_.get(), 1),
+      accept_encoding_(config.accept_compressed ? "gzip, deflate" : ""),
+      limiter_(config.rate_limit),
+      update_parser_(std::make_unique<IndexedUpdateParser>()),
+      limiter_enabled_(config.rate_limit.enabled),
+      max_send_retries_(config.max_send_retries),
+      metrics_(config.metrics),
+      request_latency_(metrics_ ? std::make_unique<std::array<std::atomic<Histogram *>,
+                                                             3 * kStatuses>>()
+                                : nullptr),
+      io_threads_(config.io_threads) {
 }
 
 telegram::Client::~Client() {
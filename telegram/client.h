@@ -18,15 +18,81 @@
 #include <Poco/Exception.h>
 #include <Poco/JSON/Object.h>
 #include <Poco/JSON/Parser.h>
+#include <future>
+#include <functional>
+#include "connection_pool.h"
+#include "transport.h"
+#include "executor.h"
+#include "request_builder.h"
+#include "rate_limiter.h"
+#include "update_batch.h"
+#include "metrics.h"
+#include "tracing.h"
 
 namespace telegram {
+class IndexedUpdateParser;
+
+struct ClientConfig {
+    // Number of keep-alive connections to the endpoint; this many requests may run at once.
+    size_t pool_size = 4;
+    std::chrono::seconds keep_alive_timeout{30};
+    // Ask the server for gzip/deflate responses and inflate them while parsing.
+    bool accept_compressed = true;
+    // Threads running the *Async methods and AsyncClient requests; started on the first
+    // asynchronous call. Each blocks for a whole request, so this caps how many of those
+    // are in flight at once. An AsyncClient with an endpoint of its own uses none.
+    size_t io_threads = 4;
+    // SendMessage waits for a token from these buckets before it leases a connection.
+    RateLimiterConfig rate_limit{};
+    // How many times SendMessage retries after a 429 before the error reaches the caller.
+    size_t max_send_retries = 3;
+    // Records the latency of every request as telegram_api_request_seconds by method
+    // and HTTP status ("error" when no reply came). Must outlive the client.
+    MetricsRegistry *metrics = nullptr;
+};
+
+// A non-200 reply; what() is the description the server sent.
+class ApiError : public std::runtime_error {
+public:
+    ApiError(int status, const std::string &description)
+        : std::runtime_error(description), status_(status) {
+    }
+
+    int Status() const {
+        return status_;
+    }
+
+private:
+    int status_;
+};
+
+class TooManyRequests : public ApiError {
+public:
+    TooManyRequests(const std::string &description, std::chrono::seconds retry_after)
+        : ApiError(429, description), retry_after_(retry_after) {
+    }
+
+    std::chrono::seconds RetryAfter() const {
+        return retry_after_;
+    }
+
+private:
+    std::chrono::seconds retry_after_;
+};
+
+// All methods are safe to call from several threads at once.
 class Client {
 public:
-    Client(const std::string &api_endpoint, const std::string &api_key);
+    Client(const std::string &api_endpoint, const std::string &api_key,
+           const ClientConfig &config = ClientConfig{});
+    // Sends requests through the given transport; keep_alive_timeout is ignored.
+    Client(std::shared_ptr<Transport> transport, const std::string &api_key,
+           const ClientConfig &config = ClientConfig{});
     ~Client();
 
     struct GetMeAnswer {
         uint64_t id;
+        std::string username;
     };
 
     GetMeAnswer GetMe();
@@ -41,17 +107,168 @@ public:
     std::vector<Update> FetchUpdates(std::optional<int64_t> timeout = std::nullopt,
                                      std::optional<int64_t> offset = std::nullopt);
 
+    // The same updates without a string per update; see UpdateBatch.
+    std::shared_ptr<UpdateBatch> FetchUpdateBatch(std::optional<int64_t> timeout = std::nullopt,
+                                                  std::optional<int64_t> offset = std::nullopt);
+
+    std::shared_ptr<UpdateBatch> FetchUpdateBatch(const GetUpdatesQuery &query);
+
+    // Waits as long as the rate limits require and retries 429 replies after retry_after.
     void SendMessage(const std::string &message, int64_t chat_id,
                      std::optional<int64_t> reply_to_message_id = std::nullopt);
 
+    // Sends a text serialized ahead of time, skipping the per-call JSON escaping.
+    void SendMessage(const PreparedText &message, int64_t chat_id,
+                     std::optional<int64_t> reply_to_message_id = std::nullopt);
+
+    // Waits for the rate limits as SendMessage does, for a message that leaves some
+    // other way (in a webhook response).
+    void AcquireSendSlot(int64_t chat_id);
+
+    // For callers that schedule sends themselves, as SendQueue does, and must not
+    // block: takes a send slot if the rate limits allow one at now. Otherwise takes
+    // nothing and returns when to ask again.
+    RateLimiter::Clock::time_point TryAcquireSendSlot(
+        int64_t chat_id, RateLimiter::Clock::time_point now = RateLimiter::Clock::now());
+
+    // Sends once, in a slot taken with TryAcquireSendSlot. A 429 pauses the chat in
+    // the limiter and is thrown to the caller, which decides whether to retry.
+    void SendMessageInSlot(const std::string &message, int64_t chat_id,
+                           std::optional<int64_t> reply_to_message_id = std::nullopt);
+
+    void SendMessageInSlot(const PreparedText &message, int64_t chat_id,
+                           std::optional<int64_t> reply_to_message_id = std::nullopt);
+
+    // ClientConfig::max_send_retries.
+    size_t MaxSendRetries() const {
+        return max_send_retries_;
+    }
+
+    // For callers that carry requests over connections of their own, as AsyncClient
+    // does on an event loop: the request comes from Requests() and its whole reply is
+    // handed to the matching Read*Reply, which throws as the blocking method would and
+    // records the latency since start. A 429 to sendMessage pauses the chat.
+    const RequestBuilder &Requests() const {
+        return requests_;
+    }
+
+    GetMeAnswer ReadGetMeReply(int status, std::istream &body, Histogram::Clock::time_point start);
+
+    std::vector<Update> ReadUpdatesReply(int status, std::istream &body,
+                                         Histogram::Clock::time_point start);
+
+    void ReadSendMessageReply(int status, std::istream &body, int64_t chat_id,
+                              Histogram::Clock::time_point start);
+
+    // Non-blocking variants run on the internal I/O executor. Errors are delivered
+    // through the future or as the callback argument (nullptr on success).
+    using Callback = std::function<void(std::exception_ptr)>;
+
+    std::future<GetMeAnswer> GetMeAsync();
+
+    std::future<std::vector<Update>> FetchUpdatesAsync(
+        std::optional<int64_t> timeout = std::nullopt,
+        std::optional<int64_t> offset = std::nullopt);
+
+    std::future<void> SendMessageAsync(std::string message, int64_t chat_id,
+                                       std::optional<int64_t> reply_to_message_id = std::nullopt);
+
+    void SendMessageAsync(std::string message, int64_t chat_id,
+                          std::optional<int64_t> reply_to_message_id, Callback callback);
+
+    void GetMeAsync(std::function<void(std::exception_ptr, GetMeAnswer)> callback);
+
+    void FetchUpdatesAsync(std::optional<int64_t> timeout, std::optional<int64_t> offset,
+                           std::function<void(std::exception_ptr, std::vector<Update>)> callback);
+
 private:
-    Poco::Dynamic::Var ProduceRequest(
-        const std::string &key, const std::string &method,
-        const Poco::JSON::Object &body_params = Poco::JSON::Object{},
-        const std::unordered_map<std::string, std::string> &query_params = {},
-        const std::string &http_method = Poco::Net::HTTPRequest::HTTP_GET);
-
-    const std::string api_key_;
-    std::unique_ptr<Poco::Net::HTTPClientSession> session_;
+    template <class F>
+    std::future<std::invoke_result_t<F>> Async(F f) {
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(f));
+        auto result = task->get_future();
+        Io().Post([task, update_id = TraceScope::Current()] {
+            TraceScope scope(update_id);
+            (*task)();
+        });
+        return result;
+    }
+
+    template <class F, class C>
+    void Async(F f, C callback) {
+        // The update being worked on goes along, for the spans of the request.
+        Io().Post([f = std::move(f), callback = std::move(callback),
+                   update_id = TraceScope::Current()] {
+            TraceScope scope(update_id);
+            using Result = std::invoke_result_t<F>;
+            std::exception_ptr error;
+            if constexpr (std::is_void_v<Result>) {
+                try {
+                    f();
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                callback(error);
+            } else {
+                Result result{};
+                try {
+                    result = f();
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                callback(error, std::move(result));
+            }
+        });
+    }
+
+    Executor &Io();
+
+    template <class Text>
+    void SendText(const Text &text, int64_t chat_id, std::optional<int64_t> reply_to_message_id);
+
+    template <class Text>
+    void SendTextOnce(const Text &text, int64_t chat_id,
+                      std::optional<int64_t> reply_to_message_id);
+
+    // Leases a connection and lets build(&path, &body) fill its reusable buffers;
+    // parse(is) reads a successful reply straight from the response stream.
+    template <class BuildRequest, class ParseReply>
+    void ProduceRequest(ApiMethod method, BuildRequest &&build, ParseReply &&parse) {
+        auto &pool = method == ApiMethod::kGetUpdates ? long_poll_connections_ : connections_;
+        auto connection = pool.Acquire();
+        build(&connection->path, &connection->body);
+        Exchange(*connection, method, parse);
+    }
+
+    void Exchange(Connection &connection, ApiMethod method,
+                  const std::function<void(std::istream &)> &parse);
+
+    void RecordRequest(ApiMethod method, int status, Histogram::Clock::time_point start);
+
+    // Parses a reply that was read elsewhere, as Exchange does.
+    void ReadReply(ApiMethod method, int status, std::istream &body,
+                   Histogram::Clock::time_point start,
+                   const std::function<void(std::istream &)> &parse);
+
+    const RequestBuilder requests_;
+    std::shared_ptr<Transport> transport_;
+    ConnectionPool connections_;
+    // getUpdates gets a connection of its own so a long poll never waits behind sendMessage.
+    ConnectionPool long_poll_connections_;
+    const std::string accept_encoding_;
+    RateLimiter limiter_;
+    // Used only while holding the single long-poll connection, so never concurrently.
+    std::unique_ptr<IndexedUpdateParser> update_parser_;
+    const bool limiter_enabled_;
+    const size_t max_send_retries_;
+
+    static constexpr size_t kStatuses = 600;
+    MetricsRegistry *const metrics_;
+    // The histogram of every method and status, looked up in the registry on first use.
+    std::unique_ptr<std::array<std::atomic<Histogram *>, 3 * kStatuses>> request_latency_;
+
+    const size_t io_threads_;
+    std::once_flag io_started_;
+    // Declared last: its threads must finish before the connections go away.
+    std::unique_ptr<Executor> io_;
 };
 }  // namespace telegram
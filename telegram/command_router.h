@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+
+namespace telegram {
+// "/name@bot args" split into views of the message text.
+struct BotCommand {
+    std::string_view name;
+    // Empty unless the command was addressed to a bot by name.
+    std::string_view bot;
+    std::string_view args;
+};
+
+// Returns nullopt for text that is not a command.
+constexpr std::optional<BotCommand> ParseBotCommand(std::string_view text) {
+    constexpr std::string_view kSpace = " \t\r\n";
+    if (text.size() < 2 || text[0] != '/') {
+        return std::nullopt;
+    }
+    auto end = text.find_first_of(kSpace);
+    auto token = text.substr(1, end == std::string_view::npos ? end : end - 1);
+    auto at = token.find('@');
+
+    BotCommand command{token.substr(0, at), {}, {}};
+    if (at != std::string_view::npos) {
+        command.bot = token.substr(at + 1);
+    }
+    if (end != std::string_view::npos) {
+        auto args = text.find_first_not_of(kSpace, end);
+        if (args != std::string_view::npos) {
+            command.args = text.substr(args);
+        }
+    }
+    if (command.name.empty()) {
+        return std::nullopt;
+    }
+    return command;
+}
+
+template <class Handler>
+struct CommandRoute {
+    std::string_view name;
+    Handler handler;
+    // How long the handler may run before the watchdog reports it; zero leaves it
+    // to the watchdog's default.
+    std::chrono::milliseconds budget{};
+};
+
+// Maps command names to handlers through a perfect hash built at compile time
+// (hash and displace): a lookup hashes the name once, reads one displacement and
+// one slot, and compares one name, however many commands there are.
+template <class Handler, size_t N>
+class CommandRouter {
+public:
+    constexpr explicit CommandRouter(const CommandRoute<Handler> (&routes)[N]) {
+        std::array<uint64_t, N> hashes{};
+        std::array<size_t, kBuckets> sizes{};
+        size_t largest = 0;
+        for (size_t i = 0; i < N; ++i) {
+            routes_[i] = routes[i];
+            hashes[i] = Hash(routes[i].name);
+            largest = std::max(largest, ++sizes[hashes[i] % kBuckets]);
+        }
+        slots_.fill(kEmpty);
+        // Crowded buckets go first, while most slots are still free.
+        for (auto size = largest; size > 0; --size) {
+            for (size_t bucket = 0; bucket < kBuckets; ++bucket) {
+                if (sizes[bucket] == size) {
+                    Place(bucket, hashes);
+                }
+            }
+        }
+    }
+
+    // The handler for the command name, or nullptr.
+    constexpr const Handler *Find(std::string_view name) const {
+        auto index = IndexOf(name);
+        return index ? &routes_[*index].handler : nullptr;
+    }
+
+    // The position of the command's route, for data kept per command alongside.
+    constexpr std::optional<size_t> IndexOf(std::string_view name) const {
+        auto hash = Hash(name);
+        auto slot = slots_[SlotOf(hash, displacements_[hash % kBuckets])];
+        if (slot == kEmpty || routes_[slot].name != name) {
+            return std::nullopt;
+        }
+        return slot;
+    }
+
+    constexpr const CommandRoute<Handler> &Route(size_t index) const {
+        return routes_[index];
+    }
+
+    static constexpr size_t Size() {
+        return N;
+    }
+
+private:
+    static constexpr size_t kBuckets = N / 2 + 1;
+    static constexpr size_t kSlots = std::bit_ceil(2 * N + 1);
+    static constexpr uint16_t kEmpty = UINT16_MAX;
+    static constexpr uint32_t kMaxDisplacement = 1 << 16;
+    static_assert(N < kEmpty, "too many commands");
+
+    static constexpr uint64_t Hash(std::string_view name) {
+        // FNV-1a.
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (char c : name) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    static constexpr size_t SlotOf(uint64_t hash, uint32_t displacement) {
+        // The murmur3 finalizer, so every displacement gives an unrelated slot.
+        hash ^= displacement * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ull;
+        hash ^= hash >> 33;
+        return hash & (kSlots - 1);
+    }
+
+    constexpr void Place(size_t bucket, const std::array<uint64_t, N> &hashes) {
+        for (uint32_t displacement = 0; displacement < kMaxDisplacement; ++displacement) {
+            bool fits = true;
+            size_t placed = 0;
+            std::array<size_t, N> taken{};
+            for (size_t i = 0; i < N && fits; ++i) {
+                if (hashes[i] % kBuckets != bucket) {
+                    continue;
+                }
+                auto slot = SlotOf(hashes[i], displacement);
+                if (slots_[slot] != kEmpty) {
+                    if (routes_[slots_[slot]].name == routes_[i].name) {
+                        throw std::logic_error("duplicate command");
+                    }
+                    fits = false;
+                    break;
+                }
+                slots_[slot] = static_cast<uint16_t>(i);
+                taken[placed++] = slot;
+            }
+            if (fits) {
+                displacements_[bucket] = displacement;
+                return;
+            }
+            for (size_t i = 0; i < placed; ++i) {
+                slots_[taken[i]] = kEmpty;
+            }
+        }
+        throw std::logic_error("no perfect hash for the command set");
+    }
+
+    std::array<CommandRoute<Handler>, N> routes_{};
+    std::array<uint32_t, kBuckets> displacements_{};
+    std::array<uint16_t, kSlots> slots_{};
+};
+
+// Deduces the number of commands: constexpr auto router = MakeCommandRouter<F>({...});
+template <class Handler, size_t N>
+constexpr CommandRouter<Handler, N> MakeCommandRouter(const CommandRoute<Handler> (&routes)[N]) {
+    return CommandRouter<Handler, N>(routes);
+}
+}  // namespace telegram
@@ -0,0 +1,38 @@
+#include "connection_pool.h"
+#include <stdexcept>
+
+telegram::ConnectionPool::ConnectionPool(Transport *transport, size_t size) : size_(size) {
+    if (size == 0) {
+        throw std::invalid_argument("connection pool size must be positive");
+    }
+    for (size_t i = 0; i < size; ++i) {
+        idle_.push_back(transport->Connect());
+    }
+}
+
+telegram::ConnectionPool::Lease telegram::ConnectionPool::Acquire() {
+    std::unique_lock lock(mutex_);
+    released_.wait(lock, [this] { return !idle_.empty(); });
+
+    auto connection = std::move(idle_.back());
+    idle_.pop_back();
+    return Lease(this, std::move(connection));
+}
+
+void telegram::ConnectionPool::Release(std::unique_ptr<Connection> connection) {
+    {
+        std::lock_guard guard(mutex_);
+        idle_.push_back(std::move(connection));
+    }
+    released_.notify_one();
+}
+
+telegram::ConnectionPool::Lease::Lease(ConnectionPool *pool, std::unique_ptr<Connection> connection)
+    : pool_(pool), connection_(std::move(connection)) {
+}
+
+telegram::ConnectionPool::Lease::~Lease() {
+    if (connection_) {
+        pool_->Release(std::move(connection_));
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "transport.h"
+
+namespace telegram {
+class ConnectionPool {
+public:
+    ConnectionPool(Transport *transport, size_t size);
+
+    class Lease {
+    public:
+        Lease(ConnectionPool *pool, std::unique_ptr<Connection> connection);
+        Lease(Lease &&other) noexcept = default;
+        Lease &operator=(Lease &&other) = delete;
+        ~Lease();
+
+        Connection *operator->() const {
+            return connection_.get();
+        }
+
+        Connection &operator*() const {
+            return *connection_;
+        }
+
+    private:
+        ConnectionPool *pool_;
+        std::unique_ptr<Connection> connection_;
+    };
+
+    // Blocks until one of the connections is free.
+    Lease Acquire();
+
+    size_t Size() const {
+        return size_;
+    }
+
+private:
+    void Release(std::unique_ptr<Connection> connection);
+
+    const size_t size_;
+    std::mutex mutex_;
+    std::condition_variable released_;
+    std::vector<std::unique_ptr<Connection>> idle_;
+};
+}  // namespace telegram
@@ -0,0 +1,241 @@
+#include "dispatcher.h"
+#include "tracing.h"
+#include "flight_recorder.h"
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+size_t ShardOf(int64_t chat_id, size_t shards) {
+    // Fibonacci hashing spreads sequential chat ids over the shards.
+    return (static_cast<uint64_t>(chat_id) * 0x9E3779B97F4A7C15ull >> 32) % shards;
+}
+}  // namespace
+
+telegram::Dispatcher::Dispatcher(size_t shards, Handler handler) : handler_(std::move(handler)) {
+    if (shards == 0) {
+        throw std::invalid_argument("dispatcher needs at least one shard");
+    }
+    for (size_t i = 0; i < shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+    for (size_t i = 0; i < shards; ++i) {
+        auto &worker = *workers_.emplace_back(std::make_unique<Worker>());
+        worker.shard = i;
+        worker.thread = std::thread([this, &worker] { Work(&worker); });
+    }
+}
+
+telegram::Dispatcher::~Dispatcher() {
+    {
+        std::lock_guard guard(idle_mutex_);
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+    {
+        std::lock_guard guard(workers_mutex_);
+        closed_ = true;
+    }
+    // No worker is added from now on.
+    for (auto &worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+void telegram::Dispatcher::Submit(UpdateView update) {
+    {
+        std::lock_guard guard(drained_mutex_);
+        ++outstanding_;
+    }
+
+    auto &shard = *shards_[ShardOf(update.chat_id, shards_.size())];
+    bool became_ready = false;
+    {
+        std::lock_guard guard(shard.mutex);
+        auto &chat = shard.chats[update.chat_id];
+        if (!chat) {
+            chat = std::make_unique<ChatQueue>();
+            chat->home = &shard;
+            chat->chat_id = update.chat_id;
+        }
+        chat->pending.emplace_back(std::move(update), Clock::now());
+        ++shard.queue_depth;
+        if (!chat->scheduled) {
+            chat->scheduled = true;
+            shard.ready.push_back(chat.get());
+            // Counted before the shard lets go, so Take() never counts it off first.
+            std::lock_guard idle_guard(idle_mutex_);
+            ++ready_chats_;
+            became_ready = true;
+        }
+    }
+
+    if (became_ready) {
+        work_available_.notify_one();
+    }
+}
+
+void telegram::Dispatcher::Wait() {
+    std::unique_lock lock(drained_mutex_);
+    drained_.wait(lock, [this] { return outstanding_ == 0; });
+    if (error_) {
+        std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+}
+
+bool telegram::Dispatcher::Reassign(std::thread::id thread) {
+    std::lock_guard guard(workers_mutex_);
+    // The destructor joins the workers without the lock once closed.
+    if (closed_) {
+        return false;
+    }
+    std::erase_if(workers_, [](auto &worker) {
+        if (!worker->done) {
+            return false;
+        }
+        worker->thread.join();
+        return true;
+    });
+
+    auto stuck = std::find_if(workers_.begin(), workers_.end(), [&](const auto &worker) {
+        return worker->thread.get_id() == thread && !worker->retired;
+    });
+    if (stuck == workers_.end() || spare_workers_ == shards_.size()) {
+        return false;
+    }
+    (*stuck)->retired = true;
+    ++spare_workers_;
+    auto shard = (*stuck)->shard;
+
+    auto &worker = *workers_.emplace_back(std::make_unique<Worker>());
+    worker.shard = shard;
+    worker.thread = std::thread([this, &worker] { Work(&worker); });
+    return true;
+}
+
+std::vector<telegram::Dispatcher::ShardStats> telegram::Dispatcher::Stats() const {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    std::vector<ShardStats> result;
+    for (const auto &shard : shards_) {
+        std::lock_guard guard(shard->mutex);
+        auto handled = std::max<uint64_t>(shard->handled, 1);
+        result.push_back({shard->queue_depth, shard->handled, shard->stolen,
+                          duration_cast<microseconds>(shard->total_wait / handled),
+                          duration_cast<microseconds>(shard->total_latency / handled),
+                          duration_cast<microseconds>(shard->max_latency)});
+    }
+    return result;
+}
+
+void telegram::Dispatcher::Work(Worker *worker) {
+    // Handlers run here, so a runaway recursion in one is recorded as well.
+    InstallCrashStack();
+    while (!worker->retired) {
+        {
+            std::unique_lock lock(idle_mutex_);
+            work_available_.wait(lock, [this] { return stopping_ || ready_chats_ > 0; });
+            if (stopping_) {
+                break;
+            }
+        }
+
+        if (auto *chat = Take(worker->shard)) {
+            RunOne(chat);
+        }
+    }
+    std::lock_guard guard(workers_mutex_);
+    // Reassign() counted the worker as stuck when it retired it.
+    if (worker->retired) {
+        --spare_workers_;
+    }
+    worker->done = true;
+}
+
+telegram::Dispatcher::ChatQueue *telegram::Dispatcher::Take(size_t index) {
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        auto &shard = *shards_[(index + i) % shards_.size()];
+        ChatQueue *chat = nullptr;
+        {
+            std::lock_guard guard(shard.mutex);
+            if (shard.ready.empty()) {
+                continue;
+            }
+            // The home worker serves its chats in FIFO order, thieves take the newest one.
+            if (i == 0) {
+                chat = shard.ready.front();
+                shard.ready.pop_front();
+            } else {
+                chat = shard.ready.back();
+                shard.ready.pop_back();
+            }
+        }
+        if (i != 0) {
+            std::lock_guard guard(shards_[index]->mutex);
+            ++shards_[index]->stolen;
+        }
+        std::lock_guard guard(idle_mutex_);
+        --ready_chats_;
+        return chat;
+    }
+    return nullptr;
+}
+
+void telegram::Dispatcher::RunOne(ChatQueue *chat) {
+    auto &shard = *chat->home;
+    auto [update, submitted] = [&] {
+        std::lock_guard guard(shard.mutex);
+        auto front = std::move(chat->pending.front());
+        chat->pending.pop_front();
+        --shard.queue_depth;
+        return front;
+    }();
+
+    auto started = Clock::now();
+    std::exception_ptr error;
+    {
+        TraceScope scope(update.update_id);
+        RecordSpan("queued", submitted);
+        Span span("handle");
+        try {
+            handler_(update);
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    auto latency = Clock::now() - started;
+
+    bool requeued = false;
+    {
+        std::lock_guard guard(shard.mutex);
+        ++shard.handled;
+        shard.total_wait += started - submitted;
+        shard.total_latency += latency;
+        shard.max_latency = std::max(shard.max_latency, latency);
+
+        // One update per turn, so a chatty chat cannot starve the others on its shard.
+        if (chat->pending.empty()) {
+            shard.chats.erase(chat->chat_id);
+        } else {
+            shard.ready.push_back(chat);
+            std::lock_guard idle_guard(idle_mutex_);
+            ++ready_chats_;
+            requeued = true;
+        }
+    }
+    if (requeued) {
+        work_available_.notify_one();
+    }
+
+    // Wait() returning means every batch has been let go.
+    update.batch.reset();
+    {
+        std::lock_guard guard(drained_mutex_);
+        if (error && !error_) {
+            error_ = error;
+        }
+        --outstanding_;
+    }
+    drained_.notify_all();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+#include "update_batch.h"
+
+namespace telegram {
+// Runs updates on a fixed set of worker shards. A chat is hashed to its home shard
+// and its updates are handled one at a time in arrival order; different chats run
+// in parallel. A worker with nothing to do steals a whole chat from another shard.
+class Dispatcher {
+public:
+    using Handler = std::function<void(const UpdateView &)>;
+
+    Dispatcher(size_t shards, Handler handler);
+    ~Dispatcher();
+
+    // The view keeps its batch alive until the update has been handled.
+    void Submit(UpdateView update);
+
+    // Blocks until every submitted update has been handled.
+    // Rethrows the first exception thrown by the handler.
+    void Wait();
+
+    // For a worker stuck in the handler: starts another worker for its shard, so
+    // the other chats keep flowing, and lets the stuck one go once it returns. The
+    // stuck chat stays with it, so its updates keep their order. Up to as many
+    // workers as there are shards may be stuck at a time; returns false beyond
+    // that, or if the thread is not a worker.
+    bool Reassign(std::thread::id worker);
+
+    struct ShardStats {
+        size_t queue_depth;
+        uint64_t handled;
+        uint64_t stolen;
+        std::chrono::microseconds mean_wait;
+        std::chrono::microseconds mean_latency;
+        std::chrono::microseconds max_latency;
+    };
+
+    std::vector<ShardStats> Stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Shard;
+
+    struct ChatQueue {
+        Shard *home;
+        int64_t chat_id;
+        std::deque<std::pair<UpdateView, Clock::time_point>> pending;
+        // The chat sits in a ready list or is being handled by some worker.
+        bool scheduled = false;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<int64_t, std::unique_ptr<ChatQueue>> chats;
+        std::deque<ChatQueue *> ready;
+        size_t queue_depth = 0;
+        uint64_t handled = 0;
+        uint64_t stolen = 0;
+        Clock::duration total_wait{};
+        Clock::duration total_latency{};
+        Clock::duration max_latency{};
+    };
+
+    struct Worker {
+        size_t shard;
+        std::thread thread;
+        // Set when a spare took over the shard; the worker leaves after its update.
+        std::atomic<bool> retired = false;
+        std::atomic<bool> done = false;
+    };
+
+    void Work(Worker *worker);
+    ChatQueue *Take(size_t index);
+    void RunOne(ChatQueue *chat);
+
+    Handler handler_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    std::mutex workers_mutex_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    size_t spare_workers_ = 0;
+    bool closed_ = false;
+
+    // Taken after a shard's mutex, never before.
+    std::mutex idle_mutex_;
+    std::condition_variable work_available_;
+    // Chats in the shards' ready lists; raised while the shard holding the chat is locked.
+    size_t ready_chats_ = 0;
+    bool stopping_ = false;
+
+    std::mutex drained_mutex_;
+    std::condition_variable drained_;
+    size_t outstanding_ = 0;
+    std::exception_ptr error_;
+};
+}  // namespace telegram
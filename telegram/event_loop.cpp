@@ -0,0 +1,275 @@
+#include "event_loop.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <limits>
+#include <system_error>
+
+namespace {
+[[noreturn]] void ThrowErrno(const char *what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+// Owns a spawned task: starts suspended and frees itself when the task is done.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() {
+            return {std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {
+        }
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+Detached RunDetached(telegram::Task<> task, std::function<void(std::exception_ptr)> finished) {
+    std::exception_ptr error;
+    try {
+        co_await task;
+    } catch (...) {
+        error = std::current_exception();
+    }
+    finished(error);
+}
+}  // namespace
+
+uint64_t telegram::CancellationToken::Subscribe(std::function<void()> callback) {
+    if (!state_) {
+        return 0;
+    }
+    auto id = ++state_->next_id;
+    state_->callbacks.emplace(id, std::move(callback));
+    return id;
+}
+
+void telegram::CancellationToken::Unsubscribe(uint64_t id) {
+    if (state_) {
+        state_->callbacks.erase(id);
+    }
+}
+
+void telegram::CancellationSource::Cancel() {
+    if (state_->cancelled) {
+        return;
+    }
+    state_->cancelled = true;
+    auto callbacks = std::move(state_->callbacks);
+    state_->callbacks.clear();
+    for (auto &[id, callback] : callbacks) {
+        callback();
+    }
+}
+
+telegram::EventLoop::EventLoop() {
+    if (::pipe(wake_) != 0) {
+        ThrowErrno("event loop pipe");
+    }
+    for (int fd : wake_) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+}
+
+telegram::EventLoop::~EventLoop() {
+    ::close(wake_[0]);
+    ::close(wake_[1]);
+}
+
+void telegram::EventLoop::Post(std::function<void()> callback) {
+    {
+        std::lock_guard guard(mutex_);
+        queue_.push_back(std::move(callback));
+    }
+    Wake();
+}
+
+void telegram::EventLoop::Wake() {
+    // A full pipe already holds a wakeup.
+    char byte = 0;
+    [[maybe_unused]] auto written = ::write(wake_[1], &byte, 1);
+}
+
+void telegram::EventLoop::Spawn(Task<> task) {
+    {
+        std::lock_guard guard(mutex_);
+        ++live_tasks_;
+    }
+    auto detached =
+        RunDetached(std::move(task), [this](std::exception_ptr error) { Finished(error); });
+    Post([handle = detached.handle] { handle.resume(); });
+}
+
+void telegram::EventLoop::Finished(std::exception_ptr error) {
+    std::lock_guard guard(mutex_);
+    --live_tasks_;
+    if (error && !error_) {
+        error_ = error;
+    }
+}
+
+telegram::EventLoop::TimerId telegram::EventLoop::RunAt(Clock::time_point deadline,
+                                                        std::function<void()> callback) {
+    TimerId id{deadline, ++next_timer_};
+    timers_.emplace(id, std::move(callback));
+    return id;
+}
+
+void telegram::EventLoop::CancelTimer(TimerId timer) {
+    timers_.erase(timer);
+}
+
+telegram::EventLoop::WatchId telegram::EventLoop::Watch(int fd, IoEvent event,
+                                                        std::function<void()> callback) {
+    auto id = ++next_watch_;
+    watches_.emplace(id, Watched{fd, event, std::move(callback)});
+    return id;
+}
+
+void telegram::EventLoop::Unwatch(WatchId watch) {
+    watches_.erase(watch);
+}
+
+void telegram::EventLoop::Stop() {
+    {
+        std::lock_guard guard(mutex_);
+        stopped_ = true;
+    }
+    Wake();
+}
+
+void telegram::EventLoop::Poll(int timeout_ms) {
+    // Reused from call to call; poll_ids_[i] is the watch behind pollfd i + 1.
+    auto &fds = poll_fds_;
+    auto &ids = poll_ids_;
+    fds.clear();
+    ids.clear();
+    fds.push_back({wake_[0], POLLIN, 0});
+    for (const auto &[id, watched] : watches_) {
+        short events = watched.event == IoEvent::kReadable ? POLLIN : POLLOUT;
+        fds.push_back({watched.fd, events, 0});
+        ids.push_back(id);
+    }
+    if (::poll(fds.data(), fds.size(), timeout_ms) < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        ThrowErrno("event loop poll");
+    }
+
+    if (fds[0].revents) {
+        char buffer[64];
+        while (::read(wake_[0], buffer, sizeof buffer) > 0) {
+        }
+    }
+    for (size_t i = 1; i < fds.size(); ++i) {
+        if (!fds[i].revents) {
+            continue;
+        }
+        // An earlier callback may have dropped this watch.
+        auto it = watches_.find(ids[i - 1]);
+        if (it == watches_.end()) {
+            continue;
+        }
+        auto callback = std::move(it->second.callback);
+        watches_.erase(it);
+        callback();
+    }
+}
+
+void telegram::EventLoop::Run() {
+    std::vector<std::function<void()>> ready;
+    while (true) {
+        int timeout_ms = -1;
+        {
+            std::lock_guard lock(mutex_);
+            if (stopped_ || (live_tasks_ == 0 && queue_.empty())) {
+                stopped_ = false;
+                if (error_) {
+                    std::rethrow_exception(std::exchange(error_, nullptr));
+                }
+                return;
+            }
+            if (!queue_.empty()) {
+                timeout_ms = 0;
+            }
+        }
+        if (timeout_ms != 0 && !timers_.empty()) {
+            auto wait = std::chrono::ceil<std::chrono::milliseconds>(timers_.begin()->first.first -
+                                                                     Clock::now());
+            timeout_ms = static_cast<int>(std::clamp<int64_t>(
+                wait.count(), 0, std::numeric_limits<int>::max()));
+        }
+        // Posts after the check above write to the pipe, which ends the wait.
+        Poll(timeout_ms);
+
+        {
+            std::lock_guard lock(mutex_);
+            ready.swap(queue_);
+        }
+
+        for (auto &callback : ready) {
+            callback();
+        }
+        ready.clear();
+
+        auto now = Clock::now();
+        while (!timers_.empty() && timers_.begin()->first.first <= now) {
+            auto callback = std::move(timers_.begin()->second);
+            timers_.erase(timers_.begin());
+            callback();
+        }
+    }
+}
+
+void telegram::EventLoop::SleepAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    timer_ = loop_->RunAt(deadline_, [this, handle] {
+        token_.Unsubscribe(subscription_);
+        handle.resume();
+    });
+    subscription_ = token_.Subscribe([this, handle] {
+        cancelled_ = true;
+        loop_->CancelTimer(timer_);
+        loop_->Post([handle] { handle.resume(); });
+    });
+}
+
+void telegram::EventLoop::SleepAwaiter::await_resume() {
+    if (cancelled_ || token_.IsCancelled()) {
+        throw OperationCancelled();
+    }
+}
+
+void telegram::EventLoop::IoAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    watch_ = loop_->Watch(fd_, event_, [this, handle] {
+        token_.Unsubscribe(subscription_);
+        handle.resume();
+    });
+    subscription_ = token_.Subscribe([this, handle] {
+        cancelled_ = true;
+        loop_->Unwatch(watch_);
+        loop_->Post([handle] { handle.resume(); });
+    });
+}
+
+void telegram::EventLoop::IoAwaiter::await_resume() {
+    if (cancelled_ || token_.IsCancelled()) {
+        throw OperationCancelled();
+    }
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <poll.h>
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <functional>
+#include "task.h"
+
+namespace telegram {
+class OperationCancelled : public std::runtime_error {
+public:
+    OperationCancelled() : std::runtime_error("operation cancelled") {
+    }
+};
+
+// Cancellation is single-threaded: Cancel() must run on the event loop thread
+// (use EventLoop::Post from other threads).
+class CancellationToken {
+public:
+    CancellationToken() = default;
+
+    bool IsCancelled() const {
+        return state_ && state_->cancelled;
+    }
+
+    // The callback runs once, from Cancel(). Returns an id for Unsubscribe().
+    uint64_t Subscribe(std::function<void()> callback);
+    void Unsubscribe(uint64_t id);
+
+private:
+    friend class CancellationSource;
+
+    struct State {
+        bool cancelled = false;
+        uint64_t next_id = 0;
+        std::map<uint64_t, std::function<void()>> callbacks;
+    };
+
+    explicit CancellationToken(std::shared_ptr<State> state) : state_(std::move(state)) {
+    }
+
+    std::shared_ptr<State> state_;
+};
+
+class CancellationSource {
+public:
+    CancellationSource() : state_(std::make_shared<CancellationToken::State>()) {
+    }
+
+    CancellationToken Token() const {
+        return CancellationToken(state_);
+    }
+
+    void Cancel();
+
+private:
+    std::shared_ptr<CancellationToken::State> state_;
+};
+
+enum class IoEvent : uint8_t { kReadable, kWritable };
+
+// Single-threaded scheduler for coroutines. Post() may be called from any thread,
+// everything else belongs to the thread running Run(). While idle it waits in
+// poll(2) on the watched descriptors, so sockets are served without a thread each.
+class EventLoop {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimerId = std::pair<Clock::time_point, uint64_t>;
+    using WatchId = uint64_t;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    void Post(std::function<void()> callback);
+
+    // Starts the task on the loop. Run() returns once every spawned task has finished
+    // and rethrows the first exception that escaped one of them.
+    void Spawn(Task<> task);
+
+    TimerId RunAt(Clock::time_point deadline, std::function<void()> callback);
+    void CancelTimer(TimerId timer);
+
+    // Runs the callback once, when the descriptor is ready for the event or has an
+    // error or hangup to report. The descriptor must stay open until then.
+    WatchId Watch(int fd, IoEvent event, std::function<void()> callback);
+    void Unwatch(WatchId watch);
+
+    void Run();
+    void Stop();
+
+    class SleepAwaiter {
+    public:
+        SleepAwaiter(EventLoop *loop, Clock::time_point deadline, CancellationToken token)
+            : loop_(loop), deadline_(deadline), token_(std::move(token)) {
+        }
+
+        bool await_ready() const {
+            return token_.IsCancelled();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume();
+
+    private:
+        EventLoop *loop_;
+        Clock::time_point deadline_;
+        CancellationToken token_;
+        TimerId timer_;
+        uint64_t subscription_ = 0;
+        bool cancelled_ = false;
+    };
+
+    SleepAwaiter Sleep(Clock::duration duration, CancellationToken token = {}) {
+        return SleepAwaiter(this, Clock::now() + duration, std::move(token));
+    }
+
+    class IoAwaiter {
+    public:
+        IoAwaiter(EventLoop *loop, int fd, IoEvent event, CancellationToken token)
+            : loop_(loop), fd_(fd), event_(event), token_(std::move(token)) {
+        }
+
+        bool await_ready() const {
+            return token_.IsCancelled();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume();
+
+    private:
+        EventLoop *loop_;
+        int fd_;
+        IoEvent event_;
+        CancellationToken token_;
+        WatchId watch_ = 0;
+        uint64_t subscription_ = 0;
+        bool cancelled_ = false;
+    };
+
+    // Resumes once the descriptor is ready; the caller then retries its nonblocking call.
+    IoAwaiter WaitFor(int fd, IoEvent event, CancellationToken token = {}) {
+        return IoAwaiter(this, fd, event, std::move(token));
+    }
+
+private:
+    struct Watched {
+        int fd;
+        IoEvent event;
+        std::function<void()> callback;
+    };
+
+    void Finished(std::exception_ptr error);
+    // Waits in poll(2) for at most timeout_ms (-1: no limit) and runs the ready watches.
+    void Poll(int timeout_ms);
+    void Wake();
+
+    // A byte written to wake_[1] ends the wait in Poll().
+    int wake_[2] = {-1, -1};
+
+    std::mutex mutex_;
+    std::vector<std::function<void()>> queue_;
+    size_t live_tasks_ = 0;
+    bool stopped_ = false;
+    std::exception_ptr error_;
+
+    std::map<TimerId, std::function<void()>> timers_;
+    uint64_t next_timer_ = 0;
+
+    std::map<WatchId, Watched> watches_;
+    WatchId next_watch_ = 0;
+    std::vector<pollfd> poll_fds_;
+    std::vector<WatchId> poll_ids_;
+};
+}  // namespace telegram
@@ -0,0 +1,46 @@
+#include "executor.h"
+#include <stdexcept>
+
+telegram::Executor::Executor(size_t threads) {
+    if (threads == 0) {
+        throw std::invalid_argument("executor needs at least one thread");
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back([this] { Work(); });
+    }
+}
+
+telegram::Executor::~Executor() {
+    {
+        std::lock_guard guard(mutex_);
+        stopping_ = true;
+    }
+    task_posted_.notify_all();
+    for (auto &thread : threads_) {
+        thread.join();
+    }
+}
+
+void telegram::Executor::Post(std::function<void()> task) {
+    {
+        std::lock_guard guard(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    task_posted_.notify_one();
+}
+
+void telegram::Executor::Work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(mutex_);
+            task_posted_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
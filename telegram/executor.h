@@ -0,0 +1,28 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace telegram {
+// Fixed-size thread pool. Tasks still queued at destruction are run before the threads exit.
+class Executor {
+public:
+    explicit Executor(size_t threads);
+    ~Executor();
+
+    void Post(std::function<void()> task);
+
+private:
+    void Work();
+
+    std::mutex mutex_;
+    std::condition_variable task_posted_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+}  // namespace telegram
@@ -0,0 +1,221 @@
+#include "flight_recorder.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+constexpr int kFatalSignals[] = {SIGABRT, SIGSEGV, SIGBUS, SIGFPE, SIGILL};
+
+char crash_path[PATH_MAX];
+std::atomic_flag crashing = ATOMIC_FLAG_INIT;
+
+// Enough for the handler, SignalSafeWriter's buffer included, on an overflowed stack.
+constexpr size_t kCrashStackSize = 64 * 1024;
+
+// The alternate signal stack of a thread, taken down before it is freed at exit.
+class CrashStack {
+public:
+    CrashStack() {
+        // SIGSTKSZ is not a constant in newer glibc.
+        auto size = std::max<size_t>(kCrashStackSize, SIGSTKSZ);
+        memory_ = std::make_unique<char[]>(size);
+        stack_t stack{};
+        stack.ss_sp = memory_.get();
+        stack.ss_size = size;
+        if (::sigaltstack(&stack, nullptr) != 0) {
+            throw std::system_error(errno, std::generic_category(), "sigaltstack");
+        }
+    }
+
+    ~CrashStack() {
+        stack_t stack{};
+        stack.ss_flags = SS_DISABLE;
+        ::sigaltstack(&stack, nullptr);
+    }
+
+    CrashStack(const CrashStack &) = delete;
+    CrashStack &operator=(const CrashStack &) = delete;
+
+private:
+    std::unique_ptr<char[]> memory_;
+};
+
+// Buffers the output on the stack and writes it with write(2), no allocation or
+// locale involved, as a signal handler requires.
+class SignalSafeWriter {
+public:
+    explicit SignalSafeWriter(int fd) : fd_(fd) {
+    }
+
+    ~SignalSafeWriter() {
+        Flush();
+    }
+
+    SignalSafeWriter &operator<<(const char *text) {
+        while (*text) {
+            Put(*text++);
+        }
+        return *this;
+    }
+
+    SignalSafeWriter &operator<<(int64_t value) {
+        char digits[20];
+        size_t size = 0;
+        auto magnitude = static_cast<uint64_t>(value);
+        if (value < 0) {
+            magnitude = 0 - magnitude;
+        }
+        do {
+            digits[size++] = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (value < 0) {
+            Put('-');
+        }
+        while (size > 0) {
+            Put(digits[--size]);
+        }
+        return *this;
+    }
+
+    void Put(char c) {
+        if (size_ == sizeof buffer_) {
+            Flush();
+        }
+        buffer_[size_++] = c;
+    }
+
+    void Flush() {
+        for (size_t done = 0; done < size_;) {
+            auto written = ::write(fd_, buffer_ + done, size_ - done);
+            if (written < 0 && errno != EINTR) {
+                break;
+            }
+            done += written > 0 ? static_cast<size_t>(written) : 0;
+        }
+        size_ = 0;
+    }
+
+private:
+    int fd_;
+    char buffer_[4096];
+    size_t size_ = 0;
+};
+
+void OnFatalSignal(int signal) {
+    if (!crashing.test_and_set()) {
+        const char *names[] = {"SIGABRT", "SIGSEGV", "SIGBUS", "SIGFPE", "SIGILL"};
+        const char *reason = "fatal signal";
+        for (size_t i = 0; i < std::size(kFatalSignals); ++i) {
+            if (kFatalSignals[i] == signal) {
+                reason = names[i];
+            }
+        }
+        telegram::FlightRecorder::Global().Dump(crash_path, reason);
+    } else {
+        // Another thread is writing the record and will end the process.
+        while (true) {
+            ::pause();
+        }
+    }
+    // SA_RESETHAND has restored the default action.
+    ::raise(signal);
+}
+}  // namespace
+
+telegram::FlightRecorder &telegram::FlightRecorder::Global() {
+    static constinit FlightRecorder recorder;
+    return recorder;
+}
+
+uint32_t telegram::FlightRecorder::NextThreadNumber() {
+    static std::atomic<uint32_t> next = 1;
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+int64_t telegram::FlightRecorder::Now() {
+    timespec time;
+#ifdef CLOCK_REALTIME_COARSE
+    // The coarse clock is read from memory, a few ns against a few tens; the order
+    // of the events is in their indices anyway.
+    clock_gettime(CLOCK_REALTIME_COARSE, &time);
+#else
+    clock_gettime(CLOCK_REALTIME, &time);
+#endif
+    return time.tv_sec * 1'000'000'000 + time.tv_nsec;
+}
+
+void telegram::FlightRecorder::Dump(int fd, const char *reason) const {
+    SignalSafeWriter out(fd);
+    auto end = next_.load(std::memory_order_acquire);
+    auto begin = end > kEvents ? end - kEvents : 0;
+    out << "flight recorder: " << reason << ", events " << static_cast<int64_t>(begin) << ".."
+        << static_cast<int64_t>(end) << "\n";
+
+    for (auto index = begin; index < end; ++index) {
+        const auto &slot = slots_[index % kEvents];
+        auto sequence = slot.sequence.load(std::memory_order_acquire);
+        auto time = slot.time.load(std::memory_order_acquire);
+        const auto *what = slot.what.load(std::memory_order_acquire);
+        const auto *detail = slot.detail.load(std::memory_order_acquire);
+        auto a = slot.a.load(std::memory_order_acquire);
+        auto b = slot.b.load(std::memory_order_acquire);
+        int64_t thread = slot.thread.load(std::memory_order_acquire);
+        if (sequence != index + 1 || slot.sequence.load(std::memory_order_acquire) != sequence) {
+            continue;
+        }
+
+        // Seconds since the epoch with microseconds: gmtime_r is not async-signal-safe.
+        auto micros = time / 1000 % 1'000'000;
+        out << time / 1'000'000'000 << ".";
+        for (int64_t digit = 100'000; digit > 0; digit /= 10) {
+            out.Put(static_cast<char>('0' + micros / digit % 10));
+        }
+        out << " thread " << thread << " " << what;
+        if (detail) {
+            out << " " << detail;
+        }
+        out << " " << a << " " << b << "\n";
+    }
+}
+
+bool telegram::FlightRecorder::Dump(const char *path, const char *reason) const {
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    Dump(fd, reason);
+    ::close(fd);
+    return true;
+}
+
+void telegram::InstallCrashHandler(const std::string &path) {
+    if (path.size() >= sizeof crash_path) {
+        throw std::invalid_argument("crash record path is too long");
+    }
+    std::memcpy(crash_path, path.c_str(), path.size() + 1);
+
+    InstallCrashStack();
+
+    struct sigaction action {};
+    action.sa_handler = OnFatalSignal;
+    // On the alternate stack, so a stack overflow is recorded too.
+    action.sa_flags = SA_RESETHAND | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (auto signal : kFatalSignals) {
+        ::sigaction(signal, &action, nullptr);
+    }
+}
+
+void telegram::InstallCrashStack() {
+    thread_local CrashStack stack;
+}
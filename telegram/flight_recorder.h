@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+namespace telegram {
+// Keeps the last kEvents events of the process (updates received, requests sent and
+// their statuses, offsets stored) to be written out when it dies. Recording is an
+// atomic increment and a few stores into a ring shared by all threads; writing the
+// ring out makes only async-signal-safe calls, so a signal handler may do it.
+class FlightRecorder {
+public:
+    static constexpr size_t kEvents = 4096;
+
+    // The recorder of the process, which is always on.
+    static FlightRecorder &Global();
+
+    // what and detail must outlive the recorder, as string literals do; detail may
+    // be nullptr.
+    void Record(const char *what, int64_t a = 0, int64_t b = 0, const char *detail = nullptr) {
+        auto index = next_.fetch_add(1, std::memory_order_relaxed);
+        auto &slot = slots_[index % kEvents];
+        auto time = Now();
+        // As in Tracer::Record, the release stores keep the cleared sequence ahead
+        // of the fields, so a reader that sees a new field sees the slot changing.
+        slot.sequence.store(0, std::memory_order_relaxed);
+        slot.time.store(time, std::memory_order_release);
+        slot.what.store(what, std::memory_order_release);
+        slot.detail.store(detail, std::memory_order_release);
+        slot.a.store(a, std::memory_order_release);
+        slot.b.store(b, std::memory_order_release);
+        slot.thread.store(ThreadNumber(), std::memory_order_release);
+        slot.sequence.store(index + 1, std::memory_order_release);
+    }
+
+    // Writes the events oldest first, one per line, after a line with the reason.
+    // Events being recorded meanwhile are left out.
+    void Dump(int fd, const char *reason) const;
+
+    // Creates or truncates path. Returns false if it cannot be opened.
+    bool Dump(const char *path, const char *reason) const;
+
+private:
+    struct Slot {
+        // The index of the event plus one, 0 while it is being written.
+        std::atomic<uint64_t> sequence = 0;
+        std::atomic<int64_t> time = 0;
+        std::atomic<const char *> what = nullptr;
+        std::atomic<const char *> detail = nullptr;
+        std::atomic<int64_t> a = 0;
+        std::atomic<int64_t> b = 0;
+        std::atomic<uint32_t> thread = 0;
+    };
+
+    static uint32_t ThreadNumber() {
+        thread_local const uint32_t number = NextThreadNumber();
+        return number;
+    }
+
+    static uint32_t NextThreadNumber();
+
+    // Nanoseconds since the epoch.
+    static int64_t Now();
+
+    std::atomic<uint64_t> next_ = 0;
+    std::array<Slot, kEvents> slots_{};
+};
+
+// Writes the global flight recorder to path when the process gets SIGABRT, SIGSEGV,
+// SIGBUS, SIGFPE or SIGILL, then lets the signal take its default action. The handler
+// runs on an alternate stack, given to the calling thread here.
+void InstallCrashHandler(const std::string &path);
+
+// Gives the calling thread an alternate signal stack, so the crash handler runs even
+// when the thread dies of a stack overflow. Threads without one are recorded on any
+// other fatal signal. Does nothing the second time.
+void InstallCrashStack();
+}  // namespace telegram
@@ -0,0 +1,209 @@
+#include "logger.h"
+#include <cerrno>
+#include <charconv>
+#include <ctime>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+std::atomic<uint64_t> next_logger_id = 1;
+
+constexpr const char *kLevelNames[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+
+template <class T>
+void AppendNumber(T value, std::string *out) {
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof buffer, value);
+    out->append(buffer, result.ptr);
+}
+
+// 2024-01-02T03:04:05.678901Z. Records come in bursts, so the date and time are
+// formatted once a second.
+void AppendTime(int64_t nanos, std::string *out) {
+    thread_local time_t cached_seconds = -1;
+    thread_local char cached[32];
+    thread_local size_t cached_size = 0;
+
+    auto seconds = static_cast<time_t>(nanos / 1'000'000'000);
+    if (seconds != cached_seconds) {
+        std::tm tm;
+        gmtime_r(&seconds, &tm);
+        cached_size = std::strftime(cached, sizeof cached, "%Y-%m-%dT%H:%M:%S.", &tm);
+        cached_seconds = seconds;
+    }
+    out->append(cached, cached_size);
+    auto micros = static_cast<int>(nanos / 1000 % 1'000'000);
+    char digits[7] = "000000";
+    for (int i = 5; i >= 0; --i, micros /= 10) {
+        digits[i] = static_cast<char>('0' + micros % 10);
+    }
+    out->append(digits, 6).push_back('Z');
+}
+
+void AppendRecord(const telegram::LogRecord &record, std::string *out) {
+    using telegram::LogRecord;
+
+    AppendTime(record.time, out);
+    out->push_back(' ');
+    out->append(kLevelNames[static_cast<int>(record.level)]);
+    out->push_back(' ');
+
+    size_t arg = 0;
+    for (const char *p = record.format; *p; ++p) {
+        if (p[0] != '{' || p[1] != '}' || arg == record.args) {
+            out->push_back(*p);
+            continue;
+        }
+        auto value = record.values[arg];
+        switch (record.kinds[arg]) {
+            case LogRecord::kInteger:
+                AppendNumber(static_cast<int64_t>(value), out);
+                break;
+            case LogRecord::kUnsigned:
+                AppendNumber(value, out);
+                break;
+            case LogRecord::kDouble:
+                AppendNumber(std::bit_cast<double>(value), out);
+                break;
+            case LogRecord::kString:
+                out->append(record.text.data() + (value >> 8), value & 0xff);
+                break;
+        }
+        ++arg;
+        ++p;
+    }
+    out->push_back('\n');
+}
+
+void WriteAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        auto written = ::write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Nowhere left to report it.
+            return;
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+    }
+}
+}  // namespace
+
+telegram::Logger::Logger(const LoggerConfig &config)
+    : id_(next_logger_id.fetch_add(1)),
+      level_(config.level),
+      fd_(config.fd),
+      capacity_(std::bit_ceil(std::max<size_t>(config.records_per_thread, 1))),
+      flush_interval_(config.flush_interval),
+      burst_(config.burst),
+      sample_every_(std::max<size_t>(config.sample_every, 1)),
+      thread_([this] { Work(); }) {
+}
+
+telegram::Logger::~Logger() {
+    auto *self = this;
+    installed_.compare_exchange_strong(self, nullptr);
+    {
+        std::lock_guard lock(stop_mutex_);
+        stopping_ = true;
+    }
+    stop_changed_.notify_one();
+    thread_.join();
+    Drain();
+}
+
+void telegram::Logger::Install(Logger *logger) {
+    installed_.store(logger, std::memory_order_release);
+}
+
+telegram::Logger::Ring &telegram::Logger::RingOfThisThread() {
+    // One entry is enough: a thread logs into the installed logger only.
+    thread_local uint64_t cached_id = 0;
+    thread_local Ring *cached = nullptr;
+    if (cached_id == id_) {
+        return *cached;
+    }
+
+    std::lock_guard lock(rings_mutex_);
+    auto ring = std::make_unique<Ring>();
+    ring->records = std::make_unique<LogRecord[]>(capacity_);
+    rings_.push_back(std::move(ring));
+    cached_id = id_;
+    cached = rings_.back().get();
+    return *cached;
+}
+
+bool telegram::Logger::Admit(Ring *ring, std::chrono::system_clock::duration now) const {
+    if (now - ring->window >= std::chrono::seconds(1)) {
+        ring->window = now;
+        ring->in_window = 0;
+    }
+    auto n = ring->in_window++;
+    if (n < burst_ || (n - burst_) % sample_every_ == 0) {
+        return true;
+    }
+    ring->sampled_out.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void telegram::Logger::Flush() {
+    Drain();
+}
+
+telegram::Logger::Stats telegram::Logger::GetStats() const {
+    std::lock_guard lock(drain_mutex_);
+    return {written_, dropped_, sampled_out_};
+}
+
+void telegram::Logger::Drain() {
+    std::lock_guard lock(drain_mutex_);
+    batch_.clear();
+    uint64_t dropped = 0;
+    uint64_t sampled_out = 0;
+    {
+        std::lock_guard rings_lock(rings_mutex_);
+        for (auto &ring : rings_) {
+            auto tail = ring->tail.load(std::memory_order_relaxed);
+            auto head = ring->head.load(std::memory_order_acquire);
+            for (auto i = tail; i < head; ++i) {
+                batch_.push_back(ring->records[i & (capacity_ - 1)]);
+            }
+            ring->tail.store(head, std::memory_order_release);
+            dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+            sampled_out += ring->sampled_out.exchange(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Each ring is in order already; merge them by time.
+    std::stable_sort(batch_.begin(), batch_.end(),
+                     [](const LogRecord &a, const LogRecord &b) { return a.time < b.time; });
+    out_.clear();
+    for (const auto &record : batch_) {
+        AppendRecord(record, &out_);
+    }
+    if (dropped != 0 || sampled_out != 0) {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        AppendTime(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(), &out_);
+        out_.append(" WARNING logger: ");
+        AppendNumber(dropped, &out_);
+        out_.append(" records dropped, ");
+        AppendNumber(sampled_out, &out_);
+        out_.append(" sampled out\n");
+    }
+    WriteAll(fd_, out_);
+
+    written_ += batch_.size();
+    dropped_ += dropped;
+    sampled_out_ += sampled_out;
+}
+
+void telegram::Logger::Work() {
+    std::unique_lock lock(stop_mutex_);
+    while (!stopping_) {
+        stop_changed_.wait_for(lock, flush_interval_, [this] { return stopping_; });
+        lock.unlock();
+        Drain();
+        lock.lock();
+    }
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <concepts>
+#include <string_view>
+#include <condition_variable>
+
+namespace telegram {
+enum class LogLevel : uint8_t { kDebug, kInfo, kWarning, kError };
+
+struct LoggerConfig {
+    LogLevel level = LogLevel::kInfo;
+    // Written to with write(2); the logger does not close it.
+    int fd = 1;
+    // Records a thread may have waiting; more are dropped and counted. Rounded up
+    // to a power of two.
+    size_t records_per_thread = 4096;
+    std::chrono::milliseconds flush_interval{50};
+    // A thread logs this many records a second in full, then one in sample_every.
+    size_t burst = 1000;
+    size_t sample_every = 100;
+};
+
+// A fixed-size record: the format and the arguments, copied as they are. Strings
+// are copied into text and cut short if it runs out.
+struct LogRecord {
+    static constexpr size_t kMaxArgs = 4;
+    enum ArgKind : uint8_t { kInteger, kUnsigned, kDouble, kString };
+
+    int64_t time;
+    const char *format;
+    LogLevel level;
+    uint8_t args;
+    uint8_t text_size;
+    std::array<ArgKind, kMaxArgs> kinds;
+    // Integers, doubles as bits, or for strings the offset into text and the size.
+    std::array<uint64_t, kMaxArgs> values;
+    std::array<char, 64> text;
+};
+
+// Producers copy records into a lock-free ring of their own; a background thread
+// takes them every flush_interval, formats them in time order and writes each
+// batch with one write(2). After a thread's first record, logging takes no lock,
+// allocates nothing and makes no system call; a full ring drops the record.
+class Logger {
+public:
+    explicit Logger(const LoggerConfig &config = LoggerConfig{});
+    // Writes what is left. Uninstalls the logger if it is installed.
+    ~Logger();
+
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    // nullptr drops whatever is logged through telegram::Log.
+    static void Install(Logger *logger);
+
+    static Logger *Installed() {
+        return installed_.load(std::memory_order_acquire);
+    }
+
+    bool Enabled(LogLevel level) const {
+        return level >= level_;
+    }
+
+    // format is kept by pointer and must outlive the logger, as literals do. Each
+    // "{}" in it is replaced by the next argument: an integer, a floating-point
+    // number or anything convertible to std::string_view.
+    template <class... Args>
+    void Log(LogLevel level, const char *format, const Args &...args) {
+        static_assert(sizeof...(args) <= LogRecord::kMaxArgs, "too many log arguments");
+        if (!Enabled(level)) {
+            return;
+        }
+        auto &ring = RingOfThisThread();
+        auto time = std::chrono::system_clock::now().time_since_epoch();
+        if (!Admit(&ring, time)) {
+            return;
+        }
+        auto head = ring.head.load(std::memory_order_relaxed);
+        if (head - ring.tail.load(std::memory_order_acquire) == capacity_) {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        auto &record = ring.records[head & (capacity_ - 1)];
+        record.time = std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+        record.format = format;
+        record.level = level;
+        record.args = 0;
+        record.text_size = 0;
+        (Append(&record, args), ...);
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    // Writes every record logged so far before returning.
+    void Flush();
+
+    struct Stats {
+        uint64_t written;
+        uint64_t dropped;
+        uint64_t sampled_out;
+    };
+
+    Stats GetStats() const;
+
+private:
+    struct Ring {
+        std::unique_ptr<LogRecord[]> records;
+        alignas(64) std::atomic<uint64_t> head = 0;
+        alignas(64) std::atomic<uint64_t> tail = 0;
+        std::atomic<uint64_t> dropped = 0;
+        std::atomic<uint64_t> sampled_out = 0;
+        // Used by the producer only.
+        std::chrono::system_clock::duration window{};
+        uint64_t in_window = 0;
+    };
+
+    template <std::integral T>
+    static void Append(LogRecord *record, T value) {
+        if constexpr (std::is_signed_v<T>) {
+            Push(record, LogRecord::kInteger, static_cast<uint64_t>(static_cast<int64_t>(value)));
+        } else {
+            Push(record, LogRecord::kUnsigned, static_cast<uint64_t>(value));
+        }
+    }
+
+    template <std::floating_point T>
+    static void Append(LogRecord *record, T value) {
+        Push(record, LogRecord::kDouble, std::bit_cast<uint64_t>(static_cast<double>(value)));
+    }
+
+    template <class T>
+        requires std::convertible_to<const T &, std::string_view>
+    static void Append(LogRecord *record, const T &value) {
+        std::string_view text = value;
+        auto offset = record->text_size;
+        auto size = std::min(text.size(), record->text.size() - offset);
+        std::memcpy(record->text.data() + offset, text.data(), size);
+        record->text_size = static_cast<uint8_t>(offset + size);
+        Push(record, LogRecord::kString, (uint64_t{offset} << 8) | size);
+    }
+
+    static void Push(LogRecord *record, LogRecord::ArgKind kind, uint64_t value) {
+        record->kinds[record->args] = kind;
+        record->values[record->args] = value;
+        ++record->args;
+    }
+
+    Ring &RingOfThisThread();
+    bool Admit(Ring *ring, std::chrono::system_clock::duration now) const;
+    void Drain();
+    void Work();
+
+    inline static std::atomic<Logger *> installed_ = nullptr;
+
+    const uint64_t id_;
+    const LogLevel level_;
+    const int fd_;
+    const size_t capacity_;
+    const std::chrono::milliseconds flush_interval_;
+    const size_t burst_;
+    const size_t sample_every_;
+
+    std::mutex rings_mutex_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+
+    // Held while taking records, so only one thread consumes at a time.
+    mutable std::mutex drain_mutex_;
+    std::vector<LogRecord> batch_;
+    std::string out_;
+    uint64_t written_ = 0;
+    uint64_t dropped_ = 0;
+    uint64_t sampled_out_ = 0;
+
+    std::mutex stop_mutex_;
+    std::condition_variable stop_changed_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+// Logs to the installed logger, if there is one.
+template <class... Args>
+void Log(LogLevel level, const char *format, const Args &...args) {
+    if (auto *logger = Logger::Installed()) {
+        logger->Log(level, format, args...);
+    }
+}
+}  // namespace telegram
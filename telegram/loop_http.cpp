@@ -0,0 +1,395 @@
+#include "loop_http.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <Poco/URI.h>
+
+namespace {
+constexpr size_t kReadSize = 16 * 1024;
+
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+// SO_NOSIGPIPE is set on the socket instead.
+constexpr int kSendFlags = 0;
+#endif
+
+[[noreturn]] void ThrowErrno(const char *what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+    return std::ranges::equal(a, b, [](char x, char y) {
+        return (x >= 'A' && x <= 'Z' ? x - 'A' + 'a' : x) ==
+               (y >= 'A' && y <= 'Z' ? y - 'A' + 'a' : y);
+    });
+}
+
+std::string_view Trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+template <class T>
+bool ParseNumber(std::string_view text, T *value, int base = 10) {
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), *value, base);
+    return error == std::errc{} && end != text.data();
+}
+}  // namespace
+
+struct telegram::LoopHttp::Connection {
+    ~Connection() {
+        Close();
+    }
+
+    void Close() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        fd = -1;
+    }
+
+    int fd = -1;
+    bool keep_alive = false;
+    // Both reused from request to request.
+    std::string request;
+    std::string in;
+};
+
+// Takes an idle connection, or opens a new one while under the limit, or waits for
+// Release() to hand one over.
+class telegram::LoopHttp::LeaseAwaiter {
+public:
+    explicit LeaseAwaiter(LoopHttp *http) : http_(http) {
+    }
+
+    bool await_ready() {
+        if (!http_->idle_.empty()) {
+            connection_ = http_->idle_.back();
+            http_->idle_.pop_back();
+            return true;
+        }
+        if (http_->connections_.size() < http_->max_connections_) {
+            connection_ = http_->connections_.emplace_back(std::make_unique<Connection>()).get();
+            return true;
+        }
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+        http_->waiting_.push_back(this);
+    }
+
+    Connection *await_resume() const {
+        return connection_;
+    }
+
+private:
+    friend class LoopHttp;
+
+    LoopHttp *http_;
+    Connection *connection_ = nullptr;
+    std::coroutine_handle<> handle_;
+};
+
+class telegram::LoopHttp::Lease {
+public:
+    Lease(LoopHttp *http, Connection *connection) : http_(http), connection_(connection) {
+    }
+
+    ~Lease() {
+        http_->Release(connection_);
+    }
+
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+
+    Connection *Get() const {
+        return connection_;
+    }
+
+private:
+    LoopHttp *http_;
+    Connection *connection_;
+};
+
+telegram::LoopHttp::LoopHttp(EventLoop *loop, const std::string &endpoint, size_t connections)
+    : loop_(loop), max_connections_(std::max<size_t>(connections, 1)) {
+    Poco::URI uri(endpoint);
+    if (uri.getScheme() != "http") {
+        throw std::invalid_argument("not a plain http endpoint: " + endpoint);
+    }
+    auto port = std::to_string(uri.getPort());
+    host_ = uri.getHost() + ":" + port;
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = nullptr;
+    if (auto error = ::getaddrinfo(uri.getHost().c_str(), port.c_str(), &hints, &found)) {
+        throw std::runtime_error("cannot resolve " + uri.getHost() + ": " + ::gai_strerror(error));
+    }
+    for (auto *info = found; info; info = info->ai_next) {
+        auto &[address, size] = addresses_.emplace_back();
+        std::memcpy(&address, info->ai_addr, info->ai_addrlen);
+        size = info->ai_addrlen;
+    }
+    ::freeaddrinfo(found);
+}
+
+telegram::LoopHttp::~LoopHttp() = default;
+
+telegram::Task<telegram::LoopHttp::Reply> telegram::LoopHttp::RoundTrip(
+    const std::string &method, const std::string &path, const std::string &body) {
+    Lease lease(this, co_await LeaseAwaiter(this));
+    auto *connection = lease.Get();
+    auto &request = connection->request;
+    request.clear();
+    request.append(method).append(" ").append(path).append(" HTTP/1.1\r\nHost: ").append(host_);
+    request.append("\r\nContent-Type: application/json\r\nContent-Length: ");
+    request.append(std::to_string(body.size())).append("\r\n\r\n").append(body);
+
+    // Only a connection that served earlier requests may have been closed under us.
+    for (auto reused = connection->fd >= 0;; reused = false) {
+        std::optional<Reply> reply;
+        try {
+            if (connection->fd < 0) {
+                co_await Connect(connection);
+            }
+            co_await Send(connection);
+            reply = co_await ReadReply(connection);
+        } catch (const std::system_error &) {
+            connection->Close();
+            if (!reused) {
+                throw;
+            }
+        } catch (...) {
+            connection->Close();
+            throw;
+        }
+        if (reply) {
+            if (!connection->keep_alive) {
+                connection->Close();
+            }
+            co_return std::move(*reply);
+        }
+        connection->Close();
+        if (!reused) {
+            throw std::runtime_error("connection closed before the reply");
+        }
+    }
+}
+
+void telegram::LoopHttp::Release(Connection *connection) {
+    if (waiting_.empty()) {
+        idle_.push_back(connection);
+        return;
+    }
+    auto *next = waiting_.front();
+    waiting_.pop_front();
+    next->connection_ = connection;
+    loop_->Post([handle = next->handle_] { handle.resume(); });
+}
+
+telegram::Task<> telegram::LoopHttp::Connect(Connection *connection) {
+    std::exception_ptr error;
+    for (const auto &[address, size] : addresses_) {
+        try {
+            co_await Connect(connection, address, size);
+            co_return;
+        } catch (const std::system_error &) {
+            connection->Close();
+            error = std::current_exception();
+        }
+    }
+    std::rethrow_exception(error);
+}
+
+telegram::Task<> telegram::LoopHttp::Connect(Connection *connection,
+                                             const sockaddr_storage &address, socklen_t size) {
+    connection->fd = ::socket(address.ss_family, SOCK_STREAM, 0);
+    if (connection->fd < 0) {
+        ThrowErrno("socket");
+    }
+    auto fd = connection->fd;
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+#ifdef SO_NOSIGPIPE
+    ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof one);
+#endif
+
+    if (::connect(fd, reinterpret_cast<const sockaddr *>(&address), size) == 0) {
+        co_return;
+    }
+    if (errno != EINPROGRESS) {
+        ThrowErrno("connect");
+    }
+    co_await loop_->WaitFor(fd, IoEvent::kWritable);
+    int error = 0;
+    socklen_t error_size = sizeof error;
+    ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_size);
+    if (error != 0) {
+        throw std::system_error(error, std::generic_category(), "connect");
+    }
+}
+
+telegram::Task<> telegram::LoopHttp::Send(Connection *connection) {
+    std::string_view data = connection->request;
+    while (!data.empty()) {
+        auto sent = ::send(connection->fd, data.data(), data.size(), kSendFlags);
+        if (sent >= 0) {
+            data.remove_prefix(static_cast<size_t>(sent));
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            co_await loop_->WaitFor(connection->fd, IoEvent::kWritable);
+        } else if (errno != EINTR) {
+            ThrowErrno("send");
+        }
+    }
+}
+
+telegram::Task<bool> telegram::LoopHttp::Receive(Connection *connection) {
+    auto &in = connection->in;
+    while (true) {
+        auto size = in.size();
+        in.resize(size + kReadSize);
+        auto received = ::recv(connection->fd, in.data() + size, kReadSize, 0);
+        in.resize(size + static_cast<size_t>(std::max<ssize_t>(received, 0)));
+        if (received >= 0) {
+            co_return received > 0;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            co_await loop_->WaitFor(connection->fd, IoEvent::kReadable);
+        } else if (errno != EINTR) {
+            ThrowErrno("recv");
+        }
+    }
+}
+
+telegram::Task<> telegram::LoopHttp::ReceiveAtLeast(Connection *connection, size_t size) {
+    while (connection->in.size() < size) {
+        // Named rather than tested as `if (!co_await ...)`, which GCC 12 miscompiles.
+        auto more = co_await Receive(connection);
+        if (!more) {
+            throw std::runtime_error("connection closed in the reply body");
+        }
+    }
+}
+
+telegram::Task<std::optional<telegram::LoopHttp::Reply>> telegram::LoopHttp::ReadReply(
+    Connection *connection) {
+    auto &in = connection->in;
+    in.clear();
+    size_t header_end;
+    while ((header_end = in.find("\r\n\r\n")) == std::string::npos) {
+        auto more = co_await Receive(connection);
+        if (!more) {
+            if (in.empty()) {
+                co_return std::nullopt;
+            }
+            throw std::runtime_error("connection closed in the reply headers");
+        }
+    }
+
+    // The view is dropped before the next read moves the buffer.
+    std::string_view head(in.data(), header_end);
+    auto line_end = head.find("\r\n");
+    auto status_line = head.substr(0, line_end);
+    Reply reply{0, {}};
+    if (!status_line.starts_with("HTTP/1.") || status_line.size() < 12 ||
+        !ParseNumber(status_line.substr(9, 3), &reply.status)) {
+        throw std::runtime_error("bad HTTP status line");
+    }
+    auto keep_alive = status_line[7] != '0';
+    std::optional<size_t> length;
+    auto chunked = false;
+    while (line_end != std::string_view::npos) {
+        auto start = line_end + 2;
+        line_end = head.find("\r\n", start);
+        auto line = head.substr(start, line_end == std::string_view::npos ? line_end
+                                                                          : line_end - start);
+        auto colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            continue;
+        }
+        auto name = line.substr(0, colon);
+        auto value = Trim(line.substr(colon + 1));
+        if (EqualsIgnoreCase(name, "Content-Length")) {
+            size_t size;
+            if (!ParseNumber(value, &size)) {
+                throw std::runtime_error("bad Content-Length");
+            }
+            length = size;
+        } else if (EqualsIgnoreCase(name, "Transfer-Encoding")) {
+            chunked = EqualsIgnoreCase(value, "chunked");
+        } else if (EqualsIgnoreCase(name, "Connection")) {
+            keep_alive = !EqualsIgnoreCase(value, "close");
+        }
+    }
+
+    auto at = header_end + 4;
+    if (reply.status / 100 == 1 || reply.status == 204 || reply.status == 304) {
+        // No body.
+    } else if (chunked) {
+        while (true) {
+            size_t size_end;
+            while ((size_end = in.find("\r\n", at)) == std::string::npos) {
+                co_await ReceiveAtLeast(connection, in.size() + 1);
+            }
+            std::string_view size_line(in.data() + at, size_end - at);
+            size_t size;
+            if (!ParseNumber(size_line.substr(0, size_line.find(';')), &size, 16)) {
+                throw std::runtime_error("bad chunk size");
+            }
+            at = size_end + 2;
+            if (size == 0) {
+                break;
+            }
+            co_await ReceiveAtLeast(connection, at + size + 2);
+            reply.body.append(in, at, size);
+            at += size + 2;
+        }
+        // Trailers, up to an empty line.
+        while (true) {
+            size_t trailer_end;
+            while ((trailer_end = in.find("\r\n", at)) == std::string::npos) {
+                co_await ReceiveAtLeast(connection, in.size() + 1);
+            }
+            auto empty = trailer_end == at;
+            at = trailer_end + 2;
+            if (empty) {
+                break;
+            }
+        }
+    } else if (length) {
+        co_await ReceiveAtLeast(connection, at + *length);
+        reply.body.assign(in, at, *length);
+    } else {
+        // The body runs to the end of the stream.
+        for (auto more = true; more;) {
+            more = co_await Receive(connection);
+        }
+        reply.body.assign(in, at);
+        keep_alive = false;
+    }
+    connection->keep_alive = keep_alive;
+    co_return reply;
+}
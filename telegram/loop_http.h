@@ -0,0 +1,66 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <optional>
+#include "event_loop.h"
+
+namespace telegram {
+// HTTP/1.1 over nonblocking sockets served by an EventLoop: a request waiting on the
+// network holds its coroutine and nothing else. Plain http only, as spoken by a local
+// Bot API server or a TLS-terminating proxy in front of api.telegram.org. Requests
+// beyond `connections` wait for a keep-alive connection to come free. Everything,
+// the destructor included, belongs to the loop thread.
+class LoopHttp {
+public:
+    // Resolves the host of http://host[:port]/ once, here; the path is ignored. New
+    // connections try the addresses in the resolver's order.
+    // Throws std::invalid_argument for any other scheme.
+    LoopHttp(EventLoop *loop, const std::string &endpoint, size_t connections);
+    ~LoopHttp();
+
+    LoopHttp(const LoopHttp &) = delete;
+    LoopHttp &operator=(const LoopHttp &) = delete;
+
+    struct Reply {
+        int status;
+        std::string body;
+    };
+
+    // Sends a request with a JSON body and reads the whole reply. A keep-alive
+    // connection that the server closed while idle is replaced once. Throws
+    // std::system_error on socket errors and std::runtime_error on a reply it cannot read.
+    Task<Reply> RoundTrip(const std::string &method, const std::string &path,
+                          const std::string &body);
+
+private:
+    struct Connection;
+    class LeaseAwaiter;
+    class Lease;
+
+    Task<> Connect(Connection *connection);
+    // Throws std::system_error if the address does not take the connection.
+    Task<> Connect(Connection *connection, const sockaddr_storage &address, socklen_t size);
+    Task<> Send(Connection *connection);
+    // Appends what the socket has to connection->in; false at the end of the stream.
+    Task<bool> Receive(Connection *connection);
+    // Receives until connection->in holds size bytes; throws at the end of the stream.
+    Task<> ReceiveAtLeast(Connection *connection, size_t size);
+    // Nothing if the connection closed before a byte of the reply came.
+    Task<std::optional<Reply>> ReadReply(Connection *connection);
+    void Release(Connection *connection);
+
+    EventLoop *loop_;
+    std::string host_;
+    std::vector<std::pair<sockaddr_storage, socklen_t>> addresses_;
+    const size_t max_connections_;
+    std::vector<std::unique_ptr<Connection>> connections_;
+    std::vector<Connection *> idle_;
+    std::deque<LeaseAwaiter *> waiting_;
+};
+}  // namespace telegram
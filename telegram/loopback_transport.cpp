@@ -0,0 +1,79 @@
+#include "loopback_transport.h"
+#include <streambuf>
+
+namespace {
+// Reads from a string without copying it.
+class ViewBuf : public std::streambuf {
+public:
+    void Reset(const std::string &data) {
+        auto *begin = const_cast<char *>(data.data());
+        setg(begin, begin, begin + data.size());
+    }
+};
+
+// Appends everything written to a string that keeps its capacity between exchanges.
+class AppendBuf : public std::streambuf {
+public:
+    explicit AppendBuf(std::string *target) : target_(target) {
+    }
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            target_->push_back(traits_type::to_char_type(ch));
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char *data, std::streamsize count) override {
+        target_->append(data, static_cast<size_t>(count));
+        return count;
+    }
+
+private:
+    std::string *target_;
+};
+
+class LoopbackConnection : public telegram::Connection {
+public:
+    explicit LoopbackConnection(telegram::LoopbackHandler *handler)
+        : handler_(handler), response_buf_(&response_), request_(&request_buf_),
+          response_out_(&response_buf_), response_in_(&response_in_buf_) {
+    }
+
+    Reply RoundTrip(const std::string &http_method, const std::string &accept_encoding) override {
+        static const std::string kContentType = "application/json";
+
+        request_buf_.Reset(body);
+        request_.clear();
+        response_.clear();
+        response_out_.clear();
+        telegram::LoopbackHandler::Response response{response_out_, 200, {}};
+        handler_->Handle({http_method, path, kContentType, accept_encoding, request_}, &response);
+        content_encoding_ = std::move(response.content_encoding);
+
+        response_in_buf_.Reset(response_);
+        response_in_.clear();
+        return {response.status, content_encoding_, response_in_};
+    }
+
+    void Reset() override {
+        response_.clear();
+    }
+
+private:
+    telegram::LoopbackHandler *handler_;
+    std::string response_;
+    std::string content_encoding_;
+    ViewBuf request_buf_;
+    AppendBuf response_buf_;
+    ViewBuf response_in_buf_;
+    std::istream request_;
+    std::ostream response_out_;
+    std::istream response_in_;
+};
+}  // namespace
+
+std::unique_ptr<telegram::Connection> telegram::LoopbackTransport::Connect() {
+    return std::make_unique<LoopbackConnection>(handler_.get());
+}
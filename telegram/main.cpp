@@ -1,73 +1,531 @@
 #include <Poco/JSON/Object.h>
 
 #include "client.h"
-#include <fstream>
+#include "async_client.h"
+#include "poller.h"
+#include "dispatcher.h"
+#include "command_router.h"
+#include "offset_store.h"
+#include "update_journal.h"
+#include "webhook_server.h"
+#include "send_queue.h"
+#include "metrics_server.h"
+#include "tracing.h"
+#include "logger.h"
+#include "flight_recorder.h"
+#include "watchdog.h"
 #include <stdlib.h>
+#include <deque>
 #include <random>
+#include <future>
+#include <fstream>
+#include <string_view>
+#include <unordered_map>
+
+struct CommandContext {
+    const telegram::UpdateView &update;
+    std::string_view args;
+    telegram::ReplyChannel *replies;
+    telegram::UpdateJournal *journal;
+};
+
+// Returns true when the bot has to stop.
+using CommandHandler = bool (*)(const CommandContext &);
+
+const telegram::PreparedText kStopped("Бот остановлен");
+const telegram::PreparedText kWeather("Winter Is Coming");
+const telegram::PreparedText kAbort("abort");
+const telegram::PreparedText kJokes[] = {
+    telegram::PreparedText("Здесь могла была шутка про code review.\n"
+                           "Но мне кажется не стоит шутить на такие интимные темы."),
+    telegram::PreparedText("Шутка не про code review, но все равно смешная\n"
+                           "Если долго есть виноград, то можно начать есть изюм.")};
+const telegram::PreparedText kHelp(
+    "Запрос /random. Бот посылает случайное число ответом на это сообщение.\n"
+    "Запрос /weather. Бот отвечает в чат Winter Is Coming.\n"
+    "Запрос /styleguide. Бот отвечает в чат смешной шуткой на тему code review (почти).\n"
+    "Запрос /sticker. Бот отправляет стикер.\n"
+    "Запрос /gif. Бот отправляет картинку.\n"
+    "Запрос /stop. Процесс бота завершается штатно.\n"
+    "Запрос /crash. Процесс бота завершается аварийно.\n");
+const telegram::PreparedText kUnknown(
+    "Я тебе не ChatGPT, я таких команд не знаю. Напиши /help, если не знаешь, что я умею.");
+
+std::mt19937_64 &Random() {
+    thread_local std::mt19937_64 random{std::random_device{}()};
+    return random;
+}
+
+void Reply(const CommandContext &context, const telegram::PreparedText &text) {
+    context.replies->SendMessage(text, context.update.chat_id, context.update.message_id);
+}
+
+bool OnRandom(const CommandContext &context) {
+    context.replies->SendMessage(std::to_string(static_cast<uint32_t>(Random()())),
+                                 context.update.chat_id, context.update.message_id);
+    return false;
+}
 
-int64_t Load(const std::string &lock_file) {
-    int64_t offset = 0;
-
-    std::ifstream input(lock_file, std::ios::binary);
-
-    if (!input.read(reinterpret_cast<char *>(&offset), sizeof offset)) {
-        offset = 0;
-    }
-
-    return offset;
-}
-
-void Store(const std::string &lock_file, int64_t offset) {
-    std::ofstream output(lock_file, std::ios::binary | std::ios::trunc);
-    output.write(reinterpret_cast<const char *>(&offset), sizeof offset);
-}
-
-bool HandleUpdate(const telegram::Client::Update &update, telegram::Client *client) {
-    std::random_device rd{};
-    const std::vector<std::string> jokes = {
-        "Здесь могла была шутка про code review.\n"
-        "Но мне кажется не стоит шутить на такие интимные темы.",
-        "Шутка не про code review, но все равно смешная\n"
-        "Если долго есть виноград, то можно начать есть изюм."};
-
-    if (update.message == "/random") {
-        std::cout << "/random" << std::endl;
-        client->SendMessage(std::to_string(rd()), update.chat_id, update.message_id);
-    } else if (update.message == "/stop") {
-        std::cout << "/stop" << std::endl;
-        client->SendMessage("Бот остановлен", update.chat_id, update.message_id);
-        return true;
-    } else if (update.message == "/weather") {
-        std::cout << "/weather" << std::endl;
-        client->SendMessage("Winter Is Coming", update.chat_id, update.message_id);
-    } else if (update.message == "/crash") {
-        std::cout << "/crash" << std::endl;
-        client->SendMessage("abort", update.chat_id, update.message_id);
-        std::abort();
-    } else if (update.message == "/styleguide") {
-        std::cout << "/styleguide" << std::endl;
-        client->SendMessage(jokes[rd() % jokes.size()], update.chat_id, update.message_id);
-    } else if (update.message == "/help") {
-        std::string tooltip =
-            "Запрос /random. Бот посылает случайное число ответом на это сообщение.\n"
-            "Запрос /weather. Бот отвечает в чат Winter Is Coming.\n"
-            "Запрос /styleguide. Бот отвечает в чат смешной шуткой на тему code review (почти).\n"
-            "Запрос /sticker. Бот отправляет стикер.\n"
-            "Запрос /gif. Бот отправляет картинку.\n"
-            "Запрос /stop. Процесс бота завершается штатно.\n"
-            "Запрос /crash. Процесс бота завершается аварийно.\n";
-        std::cout << "/help" << std::endl;
-        client->SendMessage(tooltip, update.chat_id, update.message_id);
-    } else {
-        client->SendMessage(
-            "Я тебе не ChatGPT, я таких команд не знаю. Напиши /help, если не знаешь, что я умею.",
-            update.chat_id, update.message_id);
+bool OnStop(const CommandContext &context) {
+    Reply(context, kStopped);
+    return true;
+}
+
+bool OnWeather(const CommandContext &context) {
+    Reply(context, kWeather);
+    return false;
+}
+
+bool OnCrash(const CommandContext &context) {
+    Reply(context, kAbort);
+    context.replies->Flush();
+    // Or the restarted bot would crash on it again.
+    context.journal->Handled(context.update.update_id);
+    if (auto *logger = telegram::Logger::Installed()) {
+        logger->Flush();
     }
+    std::abort();
+}
+
+bool OnStyleguide(const CommandContext &context) {
+    Reply(context, kJokes[Random()() % std::size(kJokes)]);
+    return false;
+}
+
+bool OnHelp(const CommandContext &context) {
+    Reply(context, kHelp);
     return false;
 }
 
-int main() {
+// The replies are queued, not sent, so a handler has no business taking long; the
+// ones that flush wait for the Bot API.
+constexpr auto kCommands = telegram::MakeCommandRouter<CommandHandler>({
+    {"random", OnRandom, std::chrono::milliseconds(50)},
+    {"stop", OnStop, std::chrono::milliseconds(50)},
+    {"weather", OnWeather, std::chrono::milliseconds(50)},
+    {"crash", OnCrash, std::chrono::seconds(5)},
+    {"styleguide", OnStyleguide, std::chrono::milliseconds(50)},
+    {"help", OnHelp, std::chrono::milliseconds(50)},
+});
+
+// The same commands as coroutines, for --event-loop: a handler waits for its replies
+// without holding a thread.
+struct AsyncCommandContext {
+    const telegram::Client::Update &update;
+    std::string_view args;
+    telegram::AsyncClient *client;
+};
+
+using AsyncCommandHandler = telegram::Task<bool> (*)(const AsyncCommandContext &);
+
+telegram::AsyncClient::Awaiter<void> Reply(const AsyncCommandContext &context, std::string text) {
+    return context.client->SendMessage(std::move(text), context.update.chat_id,
+                                       context.update.message_id);
+}
+
+telegram::Task<bool> OnRandomAsync(const AsyncCommandContext &context) {
+    co_await Reply(context, std::to_string(static_cast<uint32_t>(Random()())));
+    co_return false;
+}
+
+telegram::Task<bool> OnStopAsync(const AsyncCommandContext &context) {
+    co_await Reply(context, kStopped.Text());
+    co_return true;
+}
+
+telegram::Task<bool> OnWeatherAsync(const AsyncCommandContext &context) {
+    co_await Reply(context, kWeather.Text());
+    co_return false;
+}
+
+// Updates are confirmed on receipt in this mode, so a restarted bot does not see
+// the /crash again.
+telegram::Task<bool> OnCrashAsync(const AsyncCommandContext &context) {
+    co_await Reply(context, kAbort.Text());
+    if (auto *logger = telegram::Logger::Installed()) {
+        logger->Flush();
+    }
+    std::abort();
+}
+
+telegram::Task<bool> OnStyleguideAsync(const AsyncCommandContext &context) {
+    co_await Reply(context, kJokes[Random()() % std::size(kJokes)].Text());
+    co_return false;
+}
+
+telegram::Task<bool> OnHelpAsync(const AsyncCommandContext &context) {
+    co_await Reply(context, kHelp.Text());
+    co_return false;
+}
+
+// In the order of kCommands, so the two share CommandLatency().
+constexpr auto kAsyncCommands = telegram::MakeCommandRouter<AsyncCommandHandler>({
+    {"random", OnRandomAsync},
+    {"stop", OnStopAsync},
+    {"weather", OnWeatherAsync},
+    {"crash", OnCrashAsync},
+    {"styleguide", OnStyleguideAsync},
+    {"help", OnHelpAsync},
+});
+
+static_assert([] {
+    for (size_t i = 0; i < kCommands.Size(); ++i) {
+        if (kCommands.Route(i).name != kAsyncCommands.Route(i).name) {
+            return false;
+        }
+    }
+    return kCommands.Size() == kAsyncCommands.Size();
+}());
+
+const telegram::WatchdogConfig kWatchdog{.capture_stacks = true};
+
+telegram::MetricsRegistry &Metrics() {
+    static telegram::MetricsRegistry metrics;
+    return metrics;
+}
+
+// Indexed like the routes of kCommands; the last one is for unknown commands.
+const std::array<telegram::Histogram *, kCommands.Size() + 1> &CommandLatency() {
+    static const auto latency = [] {
+        std::array<telegram::Histogram *, kCommands.Size() + 1> latency{};
+        auto get = [](std::string_view command) {
+            return &Metrics().GetHistogram("telegram_command_seconds",
+                                           "Time spent in command handlers",
+                                           {{"command", std::string(command)}});
+        };
+        for (size_t i = 0; i < kCommands.Size(); ++i) {
+            latency[i] = get(kCommands.Route(i).name);
+        }
+        latency.back() = get("unknown");
+        return latency;
+    }();
+    return latency;
+}
+
+// From the date of the message to its replies sent.
+void RecordLag(const telegram::UpdateView &update) {
+    static auto &lag = Metrics().GetHistogram(
+        "telegram_update_lag_seconds", "Time from a message being sent to the bot's reply");
+    if (update.date != 0) {
+        auto sent = std::chrono::system_clock::from_time_t(update.date);
+        lag.Record(std::chrono::duration_cast<telegram::Histogram::Clock::duration>(
+            std::chrono::system_clock::now() - sent));
+    }
+}
+
+// Set by --trace: an update handled slower than this is written out as a Chrome trace.
+std::chrono::milliseconds slow_update{0};
+
+void TraceIfSlow(const telegram::UpdateView &update, telegram::Tracer::Clock::time_point start) {
+    auto *tracer = telegram::Tracer::Installed();
+    if (!tracer || telegram::Tracer::Clock::now() - start < slow_update) {
+        return;
+    }
+    std::string trace;
+    tracer->WriteChromeTrace(&trace, update.update_id);
+    std::ofstream("trace_" + std::to_string(update.update_id) + ".json") << trace;
+}
+
+bool HandleUpdate(const telegram::UpdateView &update, telegram::ReplyChannel *replies,
+                  telegram::UpdateJournal *journal, std::string_view bot_username) {
+    telegram::FlightRecorder::Global().Record("update", update.update_id, update.chat_id);
+    auto command = telegram::ParseBotCommand(update.Text());
+    if (command && !command->bot.empty() && command->bot != bot_username) {
+        // Addressed to another bot in the same group.
+        return false;
+    }
+
+    auto start = telegram::Histogram::Clock::now();
+    auto index = command ? kCommands.IndexOf(command->name) : std::nullopt;
+    if (!index) {
+        telegram::Span span("unknown");
+        replies->SendMessage(kUnknown, update.chat_id, update.message_id);
+        CommandLatency().back()->RecordSince(start);
+        return false;
+    }
+    telegram::Log(telegram::LogLevel::kInfo, "/{}", command->name);
+    const auto &route = kCommands.Route(*index);
+    // The route names are literals, so they outlive the span and the watchdog.
+    telegram::Span span(route.name.data());
+    telegram::Watched watched(route.name.data(), update.chat_id, update.update_id, route.budget);
+    auto stop = route.handler({update, command->args, replies, journal});
+    CommandLatency()[*index]->RecordSince(start);
+    return stop;
+}
+
+// Spans and the watchdog follow threads, not coroutines, so they are left out here.
+telegram::Task<bool> HandleUpdateAsync(const telegram::Client::Update &update,
+                                       telegram::AsyncClient *client,
+                                       std::string_view bot_username) {
+    telegram::FlightRecorder::Global().Record("update", update.update_id, update.chat_id);
+    auto command = telegram::ParseBotCommand(update.message);
+    if (command && !command->bot.empty() && command->bot != bot_username) {
+        co_return false;
+    }
+
+    auto start = telegram::Histogram::Clock::now();
+    auto index = command ? kAsyncCommands.IndexOf(command->name) : std::nullopt;
+    if (!index) {
+        co_await client->SendMessage(kUnknown.Text(), update.chat_id, update.message_id);
+        CommandLatency().back()->RecordSince(start);
+        co_return false;
+    }
+    telegram::Log(telegram::LogLevel::kInfo, "/{}", command->name);
+    auto stop = co_await kAsyncCommands.Route(*index).handler({update, command->args, client});
+    CommandLatency()[*index]->RecordSince(start);
+    co_return stop;
+}
+
+void PrintStats(const telegram::SendQueue &queue) {
+    const char *names[] = {"interactive", "notification", "bulk"};
+    auto stats = queue.Stats();
+    for (size_t i = 0; i < stats.size(); ++i) {
+        std::cout << names[i] << ": sent " << stats[i].sent << ", failed " << stats[i].failed
+                  << ", queued " << stats[i].queued << ", delay "
+                  << stats[i].mean_delay.count() << "us (max " << stats[i].max_delay.count()
+                  << "us)" << std::endl;
+    }
+}
+
+// The stack of the handler, if taken, goes to overrun_<update id>.txt.
+void ReportOverrun(const telegram::Overrun &overrun) {
+    telegram::Log(telegram::LogLevel::kWarning, "/{} in chat {} over budget: {} ms",
+                  overrun.command, overrun.chat_id, overrun.elapsed.count());
+    telegram::FlightRecorder::Global().Record("overrun", overrun.chat_id,
+                                              overrun.elapsed.count(), overrun.command);
+    if (!overrun.stack.empty()) {
+        std::ofstream("overrun_" + std::to_string(overrun.update_id) + ".txt") << overrun.stack;
+    }
+}
+
+void PrintStats(const telegram::Dispatcher &dispatcher) {
+    auto stats = dispatcher.Stats();
+    for (size_t i = 0; i < stats.size(); ++i) {
+        std::cout << "shard " << i << ": depth " << stats[i].queue_depth << ", handled "
+                  << stats[i].handled << ", stolen " << stats[i].stolen << ", wait "
+                  << stats[i].mean_wait.count() << "us, latency "
+                  << stats[i].mean_latency.count() << "us (max "
+                  << stats[i].max_latency.count() << "us)" << std::endl;
+    }
+}
+
+void RunPolling(telegram::Client *client, telegram::SendQueue *queue,
+                std::string_view bot_username, size_t workers) {
+    std::cout << "Введите offset файл (в формате filename.txt): ";
+    // file.txt
+    std::string offset_file;
+    std::getline(std::cin, offset_file);
+
+    std::cout << "Введите параметр timeout: ";
+    // 20
+    std::string timeout_text;
+    std::getline(std::cin, timeout_text);
+    int64_t timeout = std::stod(timeout_text);
+
+    // The offset is committed only past handled updates; the journal keeps the
+    // updates received after it and tells which of them were handled before a crash.
+    telegram::OffsetStore offsets(offset_file, {.commit_every = 1});
+    telegram::UpdateJournal journal(offset_file + ".journal", offsets.Load());
+
+    telegram::Poller poller(client, {.timeout = timeout}, journal.PollOffset());
+    // Nothing is confirmed to the server before it is journaled.
+    poller.SetOnReceived([&journal](const telegram::UpdateBatch &batch) {
+        journal.Received(batch);
+    });
+    telegram::Dispatcher dispatcher(workers, [&](const telegram::UpdateView &update) {
+        try {
+            auto start = telegram::Tracer::Clock::now();
+            telegram::ReplyChannel replies(client, false, queue);
+            auto stop = HandleUpdate(update, &replies, &journal, bot_username);
+            // Handled only once the replies are out.
+            replies.Wait();
+            RecordLag(update);
+            TraceIfSlow(update, start);
+            journal.Handled(update.update_id);
+            if (stop) {
+                poller.Stop();
+            }
+        } catch (...) {
+            poller.Stop();
+            throw;
+        }
+    });
+    // Declared after the dispatcher, so it stops first.
+    telegram::Watchdog watchdog(kWatchdog, [&](const telegram::Overrun &overrun) {
+        ReportOverrun(overrun);
+        // The other chats of the stuck worker's shard go on with a spare worker.
+        dispatcher.Reassign(overrun.thread);
+    });
+    telegram::Watchdog::Install(&watchdog);
+    poller.Start();
+
+    auto shards = dispatcher.Stats().size();
+    for (size_t i = 0; i < shards; ++i) {
+        Metrics().AddGauge("telegram_dispatcher_queue_depth", "Updates waiting for a worker",
+                           {{"shard", std::to_string(i)}},
+                           [&dispatcher, i] { return dispatcher.Stats()[i].queue_depth; });
+    }
+
+    auto commit = [&] {
+        offsets.Store(journal.Watermark());
+        journal.Checkpoint(offsets.Load());
+    };
+    // Updates left unhandled by a crash go before the new ones of their chats.
+    const auto unhandled = journal.Unhandled();
+    for (size_t i = 0; i < unhandled->Size(); ++i) {
+        dispatcher.Submit({unhandled, i});
+    }
+    while (const auto batch = poller.Next()) {
+        telegram::Span span("dispatch");
+        span.SetUpdates((*batch)[0].update_id, (*batch)[batch->Size() - 1].update_id);
+        for (size_t i = 0; i < batch->Size(); ++i) {
+            if (!journal.Recovered((*batch)[i].update_id)) {
+                dispatcher.Submit({batch, i});
+            }
+        }
+        commit();
+    }
+    dispatcher.Wait();
+    commit();
+    for (size_t i = 0; i < shards; ++i) {
+        Metrics().RemoveGauge("telegram_dispatcher_queue_depth", {{"shard", std::to_string(i)}});
+    }
+    PrintStats(dispatcher);
+}
+
+// The webhook itself is registered with setWebhook beforehand; getUpdates does not
+// work while it is set.
+void RunWebhook(telegram::Client *client, telegram::SendQueue *queue,
+                std::string_view bot_username, uint16_t port) {
+    // The Bot API delivers an update again until it is answered, so only updates
+    // that kill the bot are journaled.
+    telegram::UpdateJournal journal("webhook.journal", 0);
+    std::promise<void> stopped;
+    std::once_flag stop_once;
+    // The server handles each connection on a thread of its own, so a stuck
+    // handler holds up its connection only.
+    telegram::Watchdog watchdog(kWatchdog, ReportOverrun);
+    telegram::Watchdog::Install(&watchdog);
+
+    telegram::WebhookServer server(
+        client, {.port = port},
+        [&](const telegram::UpdateView &update, telegram::ReplyChannel *replies) {
+            if (journal.Recovered(update.update_id)) {
+                return;
+            }
+            auto start = telegram::Tracer::Clock::now();
+            telegram::TraceScope scope(update.update_id);
+            auto stop = HandleUpdate(update, replies, &journal, bot_username);
+            // A reply sent in the response is still to go, a moment later.
+            RecordLag(update);
+            TraceIfSlow(update, start);
+            if (stop) {
+                std::call_once(stop_once, [&] { stopped.set_value(); });
+            }
+        },
+        queue);
+    server.Start();
+    telegram::Log(telegram::LogLevel::kInfo, "webhook on port {}", server.Port());
+    stopped.get_future().wait();
+    // Answers the /stop request before the server goes down.
+    server.Stop();
+}
+
+// Chats with updates in hand, each served by one ServeChat coroutine.
+struct LoopBot {
+    telegram::AsyncClient *client;
+    std::string_view bot_username;
+    std::unordered_map<int64_t, std::deque<telegram::Client::Update>> chats;
+    bool stopping = false;
+};
+
+// Handles a chat's updates in order, while other chats go on.
+telegram::Task<> ServeChat(LoopBot *bot, int64_t chat_id) {
+    auto &updates = bot->chats.at(chat_id);
+    try {
+        while (!updates.empty()) {
+            auto update = std::move(updates.front());
+            updates.pop_front();
+            auto stop = co_await HandleUpdateAsync(update, bot->client, bot->bot_username);
+            bot->stopping = bot->stopping || stop;
+        }
+    } catch (...) {
+        bot->stopping = true;
+        throw;
+    }
+    bot->chats.erase(chat_id);
+}
+
+telegram::Task<> PollOnLoop(LoopBot *bot, int64_t timeout) {
+    auto *loop = bot->client->Loop();
+    std::optional<int64_t> offset;
+    while (!bot->stopping) {
+        auto updates = co_await bot->client->FetchUpdates(timeout, offset);
+        for (auto &update : updates) {
+            offset = update.update_id + 1;
+            auto chat_id = update.chat_id;
+            auto [chat, idle] = bot->chats.try_emplace(chat_id);
+            chat->second.push_back(std::move(update));
+            if (idle) {
+                loop->Spawn(ServeChat(bot, chat_id));
+            }
+        }
+    }
+    if (offset) {
+        // Confirms the last updates, the /stop among them.
+        co_await bot->client->FetchUpdates(0, offset);
+    }
+}
+
+// Every chat is a coroutine on one thread, and so is every request: the client talks
+// to the endpoint (http:// only) from the loop. Updates are confirmed to the server
+// as they arrive, with no journal, so those in hand during a crash are lost.
+void RunEventLoop(telegram::Client *client, const std::string &endpoint,
+                  std::string_view bot_username, size_t connections) {
+    std::cout << "Введите параметр timeout: ";
+    // 20
+    std::string timeout_text;
+    std::getline(std::cin, timeout_text);
+    int64_t timeout = std::stod(timeout_text);
+
+    telegram::EventLoop loop;
+    telegram::AsyncClient async_client(client, &loop,
+                                       {.endpoint = endpoint, .connections = connections});
+    LoopBot bot{&async_client, bot_username, {}};
+    loop.Spawn(PollOnLoop(&bot, timeout));
+    loop.Run();
+}
+
+// bot-run [--webhook <port>] [--event-loop <connections>] [--metrics <port>]
+//         [--trace <slow update ms>]
+int main(int argc, char **argv) {
+    constexpr size_t kWorkers = 8;
+    constexpr const char *kFlightRecord = "flight_record.txt";
+
+    telegram::Logger logger;
+    telegram::Logger::Install(&logger);
     try {
+        telegram::InstallCrashHandler(kFlightRecord);
+        std::optional<uint16_t> webhook_port;
+        std::optional<size_t> event_loop_connections;
+        std::optional<uint16_t> metrics_port;
+        std::unique_ptr<telegram::Tracer> tracer;
+        for (int i = 1; i + 1 < argc; i += 2) {
+            std::string_view flag = argv[i];
+            auto value = std::stoi(argv[i + 1]);
+            if (flag == "--webhook") {
+                webhook_port = static_cast<uint16_t>(value);
+            } else if (flag == "--event-loop") {
+                event_loop_connections = static_cast<size_t>(value);
+            } else if (flag == "--metrics") {
+                metrics_port = static_cast<uint16_t>(value);
+            } else if (flag == "--trace") {
+                slow_update = std::chrono::milliseconds(value);
+                tracer = std::make_unique<telegram::Tracer>();
+                telegram::Tracer::Install(tracer.get());
+            }
+        }
+
         std::cout << "Введите ключ для бота: ";
         // bot5798755386:AAHgrX2eWdxJ-zRtJX1zE9D548LfxHUMk7k
         std::string api_key;
@@ -78,36 +536,37 @@ int main() {
         std::string endpoint;
         std::getline(std::cin, endpoint);
 
-        std::cout << "Введите offset файл (в формате filename.txt): ";
-        // file.txt
-        std::string offset_file;
-        std::getline(std::cin, offset_file);
-
-        std::cout << "Введите параметр timeout: ";
-        // 20
-        std::string timeout_text;
-        std::getline(std::cin, timeout_text);
-        int64_t timeout = std::stod(timeout_text);
+        telegram::Client client(endpoint, api_key,
+                                {.pool_size = kWorkers, .metrics = &Metrics()});
+        const auto bot_username = client.GetMe().username;
+        telegram::SendQueue queue(&client, {.senders = kWorkers});
 
-        telegram::Client client(endpoint, api_key);
-        auto offset = Load(offset_file);
-
-        while (true) {
-            const auto updates = client.FetchUpdates(timeout, offset);
-            if (updates.empty()) {
-                continue;
-            }
-
-            offset = updates.back().update_id + 1;
-            Store(offset_file, offset);
-
-            for (const auto &update : updates) {
-                if (HandleUpdate(update, &client)) {
-                    return 0;
-                }
-            }
+        const char *priorities[] = {"interactive", "notification", "bulk"};
+        for (size_t i = 0; i < std::size(priorities); ++i) {
+            Metrics().AddGauge("telegram_send_queue_depth", "Messages waiting to be sent",
+                               {{"priority", priorities[i]}},
+                               [&queue, i] { return queue.Stats()[i].queued; });
+        }
+        // Declared after the queue, so it stops before the gauges' queue goes away.
+        telegram::MetricsServer metrics_server(
+            &Metrics(), {.port = metrics_port.value_or(0), .tracer = tracer.get()});
+        if (metrics_port) {
+            metrics_server.Start();
+        }
+        if (webhook_port) {
+            RunWebhook(&client, &queue, bot_username, *webhook_port);
+        } else if (event_loop_connections) {
+            RunEventLoop(&client, endpoint, bot_username, *event_loop_connections);
+        } else {
+            RunPolling(&client, &queue, bot_username, kWorkers);
         }
+        queue.Flush();
+        logger.Flush();
+        PrintStats(queue);
+        return 0;
     } catch (const std::exception &e) {
+        telegram::Log(telegram::LogLevel::kError, "{}", e.what());
+        telegram::FlightRecorder::Global().Dump(kFlightRecord, e.what());
         return 1;
     }
 }
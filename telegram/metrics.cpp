@@ -0,0 +1,246 @@
+#include "metrics.h"
+#include <charconv>
+#include <cmath>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+// Histograms are exported with le = 2^kFirstLe .. 2^kLastLe nanoseconds.
+constexpr size_t kFirstLe = 10;
+constexpr size_t kLastLe = 36;
+
+void AppendNumber(double value, std::string *out) {
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof buffer, value);
+    out->append(buffer, result.ptr);
+}
+
+void AppendLabelValue(std::string_view value, std::string *out) {
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            out->push_back('\\');
+            out->push_back(c);
+        } else if (c == '\n') {
+            out->append("\\n");
+        } else {
+            out->push_back(c);
+        }
+    }
+}
+
+// name{labels,extra} value
+void AppendSample(std::string_view name, std::string_view labels, std::string_view extra,
+                  double value, std::string *out) {
+    out->append(name);
+    if (!labels.empty() || !extra.empty()) {
+        out->push_back('{');
+        out->append(labels);
+        if (!labels.empty() && !extra.empty()) {
+            out->push_back(',');
+        }
+        out->append(extra);
+        out->push_back('}');
+    }
+    out->push_back(' ');
+    AppendNumber(value, out);
+    out->push_back('\n');
+}
+}  // namespace
+
+size_t telegram::metrics_detail::NextShard() {
+    static std::atomic<size_t> next = 0;
+    return next.fetch_add(1, std::memory_order_relaxed) % kShards;
+}
+
+uint64_t telegram::Counter::Value() const {
+    uint64_t value = 0;
+    for (const auto &shard : shards_) {
+        value += shard.value.load(std::memory_order_relaxed);
+    }
+    return value;
+}
+
+telegram::Histogram::~Histogram() {
+    for (auto &slot : shards_) {
+        delete slot.load();
+    }
+}
+
+telegram::Histogram::Shard &telegram::Histogram::Allocate(std::atomic<Shard *> *slot) {
+    auto *shard = new Shard;
+    Shard *expected = nullptr;
+    if (!slot->compare_exchange_strong(expected, shard, std::memory_order_acq_rel)) {
+        // Another thread of the same shard got there first.
+        delete shard;
+        return *expected;
+    }
+    return *shard;
+}
+
+telegram::Histogram::Snapshot telegram::Histogram::Read() const {
+    Snapshot snapshot;
+    for (const auto &slot : shards_) {
+        const auto *shard = slot.load(std::memory_order_acquire);
+        if (!shard) {
+            continue;
+        }
+        for (size_t i = 0; i < kBuckets; ++i) {
+            auto count = shard->buckets[i].load(std::memory_order_relaxed);
+            snapshot.buckets[i] += count;
+            snapshot.count += count;
+        }
+        snapshot.sum += std::chrono::nanoseconds(shard->sum.load(std::memory_order_relaxed));
+    }
+    return snapshot;
+}
+
+std::chrono::nanoseconds telegram::Histogram::Snapshot::Quantile(double q) const {
+    if (count == 0) {
+        return std::chrono::nanoseconds{0};
+    }
+    auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::chrono::nanoseconds(LowerBoundOf(i + 1));
+        }
+    }
+    return std::chrono::nanoseconds(LowerBoundOf(kBuckets));
+}
+
+struct telegram::MetricsRegistry::Series {
+    // Rendered as name="value" pairs without the braces.
+    std::string labels;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Histogram> histogram;
+    std::function<double()> gauge;
+};
+
+struct telegram::MetricsRegistry::Family {
+    std::string name;
+    std::string help;
+    Type type;
+    std::vector<std::unique_ptr<Series>> series;
+};
+
+telegram::MetricsRegistry::MetricsRegistry() = default;
+
+telegram::MetricsRegistry::~MetricsRegistry() = default;
+
+telegram::Counter &telegram::MetricsRegistry::GetCounter(std::string_view name,
+                                                         std::string_view help,
+                                                         const MetricLabels &labels) {
+    std::lock_guard lock(mutex_);
+    auto &series = Find(name, help, Type::kCounter, labels);
+    if (!series.counter) {
+        series.counter = std::make_unique<Counter>();
+    }
+    return *series.counter;
+}
+
+telegram::Histogram &telegram::MetricsRegistry::GetHistogram(std::string_view name,
+                                                             std::string_view help,
+                                                             const MetricLabels &labels) {
+    std::lock_guard lock(mutex_);
+    auto &series = Find(name, help, Type::kHistogram, labels);
+    if (!series.histogram) {
+        series.histogram = std::make_unique<Histogram>();
+    }
+    return *series.histogram;
+}
+
+void telegram::MetricsRegistry::AddGauge(std::string_view name, std::string_view help,
+                                         const MetricLabels &labels,
+                                         std::function<double()> read) {
+    std::lock_guard lock(mutex_);
+    Find(name, help, Type::kGauge, labels).gauge = std::move(read);
+}
+
+void telegram::MetricsRegistry::RemoveGauge(std::string_view name, const MetricLabels &labels) {
+    std::lock_guard lock(mutex_);
+    Find(name, {}, Type::kGauge, labels).gauge = nullptr;
+}
+
+telegram::MetricsRegistry::Series &telegram::MetricsRegistry::Find(std::string_view name,
+                                                                   std::string_view help,
+                                                                   Type type,
+                                                                   const MetricLabels &labels) {
+    std::string rendered;
+    for (const auto &[key, value] : labels) {
+        if (!rendered.empty()) {
+            rendered.push_back(',');
+        }
+        rendered.append(key);
+        rendered.append("=\"");
+        AppendLabelValue(value, &rendered);
+        rendered.push_back('"');
+    }
+
+    auto family = std::find_if(families_.begin(), families_.end(),
+                               [&](const auto &existing) { return existing->name == name; });
+    if (family == families_.end()) {
+        families_.push_back(
+            std::make_unique<Family>(Family{std::string(name), std::string(help), type, {}}));
+        family = std::prev(families_.end());
+    } else if ((*family)->type != type) {
+        throw std::invalid_argument("metric " + std::string(name) +
+                                    " is registered with another type");
+    }
+
+    auto &series = (*family)->series;
+    for (auto &existing : series) {
+        if (existing->labels == rendered) {
+            return *existing;
+        }
+    }
+    series.push_back(std::make_unique<Series>());
+    series.back()->labels = std::move(rendered);
+    return *series.back();
+}
+
+void telegram::MetricsRegistry::WritePrometheus(std::string *out) const {
+    static constexpr const char *kTypeNames[] = {"counter", "gauge", "histogram"};
+
+    out->clear();
+    std::lock_guard lock(mutex_);
+    for (const auto &family : families_) {
+        const auto &name = family->name;
+        out->append("# HELP ").append(name).append(" ").append(family->help).append("\n");
+        out->append("# TYPE ").append(name).append(" ");
+        out->append(kTypeNames[static_cast<int>(family->type)]).append("\n");
+
+        for (const auto &series : family->series) {
+            if (series->counter) {
+                AppendSample(name, series->labels, {},
+                             static_cast<double>(series->counter->Value()), out);
+            } else if (series->gauge) {
+                AppendSample(name, series->labels, {}, series->gauge(), out);
+            } else if (series->histogram) {
+                auto snapshot = series->histogram->Read();
+                auto bucket_name = name + "_bucket";
+                std::string le;
+                uint64_t cumulative = 0;
+                size_t next = 0;
+                for (auto exponent = kFirstLe; exponent <= kLastLe; ++exponent) {
+                    // Counts the values below 2^exponent ns.
+                    auto end = (exponent - Histogram::kSubBits + 1) << Histogram::kSubBits;
+                    for (; next < end; ++next) {
+                        cumulative += snapshot.buckets[next];
+                    }
+                    le.assign("le=\"");
+                    AppendNumber(std::ldexp(1e-9, static_cast<int>(exponent)), &le);
+                    le.push_back('"');
+                    AppendSample(bucket_name, series->labels, le,
+                                 static_cast<double>(cumulative), out);
+                }
+                AppendSample(bucket_name, series->labels, "le=\"+Inf\"",
+                             static_cast<double>(snapshot.count), out);
+                AppendSample(name + "_sum", series->labels, {},
+                             std::chrono::duration<double>(snapshot.sum).count(), out);
+                AppendSample(name + "_count", series->labels, {},
+                             static_cast<double>(snapshot.count), out);
+            }
+        }
+    }
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <functional>
+#include <string_view>
+
+namespace telegram {
+namespace metrics_detail {
+constexpr size_t kShards = 16;
+
+size_t NextShard();
+
+// Threads are spread over the shards round robin, so up to kShards threads never
+// write to the same cache line.
+inline size_t ShardOfThisThread() {
+    thread_local const size_t shard = NextShard();
+    return shard;
+}
+}  // namespace metrics_detail
+
+// A monotonic counter. Add() is one relaxed atomic add on a cache line of the
+// calling thread's shard; Value() sums the shards.
+class Counter {
+public:
+    void Add(uint64_t value = 1) {
+        shards_[metrics_detail::ShardOfThisThread()].value.fetch_add(value,
+                                                                     std::memory_order_relaxed);
+    }
+
+    uint64_t Value() const;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value = 0;
+    };
+
+    std::array<Shard, metrics_detail::kShards> shards_;
+};
+
+// A latency histogram with log-linear buckets in the manner of HdrHistogram:
+// every power of two of nanoseconds is split into 8 buckets, so a recorded value
+// is off by at most 12.5%. Values from 2^40 ns (about 18 minutes) on share the
+// last bucket. Recording is two relaxed atomic adds in the thread's shard.
+class Histogram {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t kSubBits = 3;
+    static constexpr size_t kMaxExponent = 40;
+    static constexpr size_t kBuckets = (kMaxExponent - kSubBits + 1) << kSubBits;
+
+    void Record(Clock::duration value) {
+        auto nanos = static_cast<uint64_t>(std::max<Clock::rep>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(value).count(), 0));
+        auto &slot = shards_[metrics_detail::ShardOfThisThread()];
+        auto *shard_ptr = slot.load(std::memory_order_acquire);
+        auto &shard = shard_ptr ? *shard_ptr : Allocate(&slot);
+        shard.buckets[BucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(nanos, std::memory_order_relaxed);
+    }
+
+    // Records the time since start.
+    void RecordSince(Clock::time_point start) {
+        Record(Clock::now() - start);
+    }
+
+    struct Snapshot {
+        std::array<uint64_t, kBuckets> buckets{};
+        uint64_t count = 0;
+        std::chrono::nanoseconds sum{0};
+
+        // The upper bound of the bucket holding the q-th quantile, 0 <= q <= 1.
+        std::chrono::nanoseconds Quantile(double q) const;
+    };
+
+    Histogram() = default;
+    ~Histogram();
+
+    Histogram(const Histogram &) = delete;
+    Histogram &operator=(const Histogram &) = delete;
+
+    // Concurrent records may or may not be included.
+    Snapshot Read() const;
+
+    static constexpr size_t BucketOf(uint64_t nanos) {
+        if (nanos < (1u << kSubBits)) {
+            return nanos;
+        }
+        size_t exponent = std::bit_width(nanos) - 1;
+        if (exponent >= kMaxExponent) {
+            return kBuckets - 1;
+        }
+        auto sub = (nanos >> (exponent - kSubBits)) & ((1u << kSubBits) - 1);
+        return ((exponent - kSubBits + 1) << kSubBits) + sub;
+    }
+
+    // The smallest value of the bucket; the bucket ends where the next one starts.
+    static constexpr uint64_t LowerBoundOf(size_t bucket) {
+        if (bucket < (1u << kSubBits)) {
+            return bucket;
+        }
+        auto exponent = (bucket >> kSubBits) + kSubBits - 1;
+        auto sub = bucket & ((1u << kSubBits) - 1);
+        return (uint64_t{1} << exponent) + (uint64_t{sub} << (exponent - kSubBits));
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, kBuckets> buckets{};
+        std::atomic<uint64_t> sum = 0;
+    };
+
+    static Shard &Allocate(std::atomic<Shard *> *slot);
+
+    // Allocated by the first thread that records into them, so a histogram
+    // costs memory only for the shards in use.
+    std::array<std::atomic<Shard *>, metrics_detail::kShards> shards_{};
+};
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// Owns the metrics of a process and renders them in the Prometheus text format.
+// Get*() registers a series on first use and returns the same object for the
+// same name and labels afterwards; the objects live as long as the registry, so
+// hot paths look them up once and keep the reference.
+class MetricsRegistry {
+public:
+    MetricsRegistry();
+    ~MetricsRegistry();
+
+    Counter &GetCounter(std::string_view name, std::string_view help,
+                        const MetricLabels &labels = {});
+
+    Histogram &GetHistogram(std::string_view name, std::string_view help,
+                            const MetricLabels &labels = {});
+
+    // A value read when the metrics are rendered, such as a queue depth.
+    void AddGauge(std::string_view name, std::string_view help, const MetricLabels &labels,
+                  std::function<double()> read);
+
+    // For gauges that read objects about to go away.
+    void RemoveGauge(std::string_view name, const MetricLabels &labels);
+
+    // Histograms are exported in seconds, with a bucket per power of two from
+    // about 1 us to about 1 minute.
+    void WritePrometheus(std::string *out) const;
+
+private:
+    enum class Type { kCounter, kGauge, kHistogram };
+    struct Series;
+    struct Family;
+
+    Series &Find(std::string_view name, std::string_view help, Type type,
+                 const MetricLabels &labels);
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Family>> families_;
+};
+}  // namespace telegram
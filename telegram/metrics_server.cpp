@@ -0,0 +1,104 @@
+#include "metrics_server.h"
+
+#include <charconv>
+#include <Poco/Net/HTTPServer.h>
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/HTTPRequestHandlerFactory.h>
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/SocketAddress.h>
+#include <Poco/URI.h>
+
+class telegram::MetricsServer::RequestHandler : public Poco::Net::HTTPRequestHandler {
+public:
+    explicit RequestHandler(const MetricsServer *server) : server_(server) {
+    }
+
+    void handleRequest(Poco::Net::HTTPServerRequest &request,
+                       Poco::Net::HTTPServerResponse &response) override {
+        using Poco::Net::HTTPResponse;
+        const auto &config = server_->config_;
+        Poco::URI uri(request.getURI());
+        auto get = request.getMethod() == Poco::Net::HTTPRequest::HTTP_GET;
+        std::string body;
+        if (get && uri.getPath() == config.path) {
+            server_->registry_->WritePrometheus(&body);
+            response.setContentType("text/plain; version=0.0.4");
+        } else if (get && uri.getPath() == "/trace" && config.tracer) {
+            std::optional<int64_t> update_id;
+            for (const auto &[key, value] : uri.getQueryParameters()) {
+                if (key != "update_id") {
+                    continue;
+                }
+                int64_t id = 0;
+                auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), id);
+                if (error != std::errc() || end != value.data() + value.size()) {
+                    Finish(HTTPResponse::HTTP_BAD_REQUEST, &response);
+                    return;
+                }
+                update_id = id;
+            }
+            config.tracer->WriteChromeTrace(&body, update_id);
+            response.setContentType("application/json");
+        } else {
+            Finish(HTTPResponse::HTTP_NOT_FOUND, &response);
+            return;
+        }
+
+        response.setStatus(HTTPResponse::HTTP_OK);
+        response.setContentLength(static_cast<std::streamsize>(body.size()));
+        response.send().write(body.data(), static_cast<std::streamsize>(body.size()));
+    }
+
+private:
+    static void Finish(Poco::Net::HTTPResponse::HTTPStatus status,
+                       Poco::Net::HTTPServerResponse *response) {
+        response->setStatus(status);
+        response->setContentLength(0);
+        response->send();
+    }
+
+    const MetricsServer *server_;
+};
+
+class telegram::MetricsServer::HandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
+public:
+    explicit HandlerFactory(const MetricsServer *server) : server_(server) {
+    }
+
+    Poco::Net::HTTPRequestHandler *createRequestHandler(
+        const Poco::Net::HTTPServerRequest &) override {
+        return new RequestHandler(server_);
+    }
+
+private:
+    const MetricsServer *server_;
+};
+
+telegram::MetricsServer::MetricsServer(const MetricsRegistry *registry,
+                                       const MetricsServerConfig &config)
+    : registry_(registry), config_(config) {
+}
+
+telegram::MetricsServer::~MetricsServer() {
+    Stop();
+}
+
+void telegram::MetricsServer::Start() {
+    Poco::Net::ServerSocket socket(Poco::Net::SocketAddress(config_.host, config_.port));
+    port_ = socket.address().port();
+
+    auto *params = new Poco::Net::HTTPServerParams;
+    params->setMaxThreads(1);
+    server_ = std::make_unique<Poco::Net::HTTPServer>(new HandlerFactory(this), socket, params);
+    server_->start();
+}
+
+void telegram::MetricsServer::Stop() {
+    if (server_) {
+        server_->stop();
+        server_.reset();
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstdint>
+#include "metrics.h"
+#include "tracing.h"
+
+namespace Poco::Net {
+class HTTPServer;
+}  // namespace Poco::Net
+
+namespace telegram {
+struct MetricsServerConfig {
+    // Loopback only by default: the metrics are not meant for the outside world.
+    std::string host = "127.0.0.1";
+    // 0 picks a free port; see Port().
+    uint16_t port = 9464;
+    std::string path = "/metrics";
+    // When set, /trace serves its spans as a Chrome trace, and /trace?update_id=<id>
+    // those of one update.
+    const Tracer *tracer = nullptr;
+};
+
+// Serves the registry in the Prometheus text format to GET requests on one thread.
+class MetricsServer {
+public:
+    MetricsServer(const MetricsRegistry *registry, const MetricsServerConfig &config);
+    ~MetricsServer();
+
+    void Start();
+    void Stop();
+
+    uint16_t Port() const {
+        return port_;
+    }
+
+private:
+    class RequestHandler;
+    class HandlerFactory;
+
+    const MetricsRegistry *registry_;
+    const MetricsServerConfig config_;
+    uint16_t port_ = 0;
+    std::unique_ptr<Poco::Net::HTTPServer> server_;
+};
+}  // namespace telegram
@@ -0,0 +1,190 @@
+#include "offset_store.h"
+#include "flight_recorder.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+namespace {
+constexpr size_t kFileSize = 4096;
+// Each slot gets a disk sector of its own, so one torn sector spoils one slot.
+constexpr size_t kSlotStride = 512;
+constexpr uint32_t kMagic = 0x4f464654;  // "OFFT"
+
+[[noreturn]] void ThrowErrno(const std::string &what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+int Open(const std::string &path, int flags) {
+    int fd = ::open(path.c_str(), flags | O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ThrowErrno("open " + path);
+    }
+    return fd;
+}
+
+void WriteAt(int fd, const void *data, size_t size, off_t offset) {
+    if (::pwrite(fd, data, size, offset) != static_cast<ssize_t>(size)) {
+        ThrowErrno("offset store write");
+    }
+}
+}  // namespace
+
+uint32_t telegram::Crc32c(const void *data, size_t size, uint32_t previous) {
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    uint32_t crc = ~previous;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+telegram::OffsetStore::OffsetStore(const std::string &path, const OffsetStoreConfig &config)
+    : config_(config), last_commit_(std::chrono::steady_clock::now()) {
+    const int flags = config_.durability == Durability::kDsync ? O_DSYNC : 0;
+    fd_ = Open(path, flags);
+
+    struct stat st {};
+    if (::fstat(fd_, &st) != 0) {
+        ::close(fd_);
+        ThrowErrno("stat " + path);
+    }
+    if (st.st_size == sizeof(int64_t)) {
+        try {
+            Migrate(path, fd_);
+        } catch (...) {
+            ::close(fd_);
+            throw;
+        }
+        ::close(fd_);
+        fd_ = Open(path, flags);
+    } else if (static_cast<size_t>(st.st_size) < kFileSize &&
+               ::ftruncate(fd_, kFileSize) != 0) {
+        ::close(fd_);
+        ThrowErrno("truncate " + path);
+    }
+
+    void *map = ::mmap(nullptr, kFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (map == MAP_FAILED) {
+        ::close(fd_);
+        ThrowErrno("mmap " + path);
+    }
+    map_ = static_cast<char *>(map);
+
+    for (size_t i = 0; i < 2; ++i) {
+        Slot slot;
+        std::memcpy(&slot, map_ + i * kSlotStride, sizeof slot);
+        if (Valid(slot) && slot.sequence > sequence_) {
+            sequence_ = slot.sequence;
+            offset_ = slot.offset;
+        }
+    }
+}
+
+telegram::OffsetStore::~OffsetStore() {
+    try {
+        Flush();
+    } catch (...) {
+        // The updates since the last commit come again on the next start.
+    }
+    ::munmap(map_, kFileSize);
+    ::close(fd_);
+}
+
+int64_t telegram::OffsetStore::Load() const {
+    return offset_;
+}
+
+void telegram::OffsetStore::Store(int64_t offset) {
+    offset_ = offset;
+    ++pending_;
+    if (pending_ >= config_.commit_every ||
+        (config_.commit_interval.count() > 0 &&
+         std::chrono::steady_clock::now() - last_commit_ >= config_.commit_interval)) {
+        Commit();
+    }
+}
+
+void telegram::OffsetStore::Flush() {
+    if (pending_ > 0) {
+        Commit();
+    }
+}
+
+void telegram::OffsetStore::Commit() {
+    Slot slot{sequence_ + 1, offset_, kMagic, 0};
+    slot.crc = Checksum(slot);
+    // Odd sequences go to the first slot and even ones to the second, so the
+    // previous commit is never overwritten.
+    const size_t at = (slot.sequence % 2) * kSlotStride;
+
+    if (config_.durability == Durability::kDsync) {
+        // O_DSYNC applies to write(), not to stores into the mapping; the page
+        // cache is shared, so the mapping still sees the slot.
+        WriteAt(fd_, &slot, sizeof slot, at);
+    } else {
+        std::memcpy(map_ + at, &slot, sizeof slot);
+        if (config_.durability == Durability::kFdatasync && ::fdatasync(fd_) != 0) {
+            ThrowErrno("offset store fdatasync");
+        }
+    }
+
+    sequence_ = slot.sequence;
+    pending_ = 0;
+    FlightRecorder::Global().Record("offset stored", offset_, static_cast<int64_t>(sequence_));
+    last_commit_ = std::chrono::steady_clock::now();
+}
+
+uint32_t telegram::OffsetStore::Checksum(const Slot &slot) {
+    return Crc32c(&slot, offsetof(Slot, crc));
+}
+
+bool telegram::OffsetStore::Valid(const Slot &slot) {
+    return slot.magic == kMagic && slot.crc == Checksum(slot);
+}
+
+void telegram::OffsetStore::Migrate(const std::string &path, int fd) {
+    int64_t offset = 0;
+    if (::pread(fd, &offset, sizeof offset, 0) != sizeof offset) {
+        ThrowErrno("read " + path);
+    }
+
+    // The converted file is written beside the old one and renamed over it, so a
+    // crash leaves one or the other.
+    std::string temp = path + ".tmp";
+    int out = Open(temp, O_TRUNC);
+    try {
+        std::string page(kFileSize, '\0');
+        Slot slot{1, offset, kMagic, 0};
+        slot.crc = Checksum(slot);
+        std::memcpy(page.data() + kSlotStride, &slot, sizeof slot);
+        WriteAt(out, page.data(), page.size(), 0);
+        if (::fsync(out) != 0) {
+            ThrowErrno("fsync " + temp);
+        }
+        if (::rename(temp.c_str(), path.c_str()) != 0) {
+            ThrowErrno("rename " + temp);
+        }
+    } catch (...) {
+        ::close(out);
+        throw;
+    }
+    ::close(out);
+
+    auto directory = std::filesystem::absolute(path).parent_path();
+    int dir = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir >= 0) {
+        ::fsync(dir);
+        ::close(dir);
+    }
+}
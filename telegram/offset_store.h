@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+namespace telegram {
+enum class Durability {
+    // Stores go to the page cache: they survive a crash of the bot, not of the machine.
+    kNone,
+    // fdatasync() after every commit.
+    kFdatasync,
+    // Slots are written with pwrite() through an O_DSYNC descriptor.
+    kDsync,
+};
+
+struct OffsetStoreConfig {
+    Durability durability = Durability::kFdatasync;
+    // A commit happens once this many offsets are stored or the interval has
+    // passed since the last one, whichever comes first. A zero interval is ignored.
+    size_t commit_every = 1;
+    std::chrono::milliseconds commit_interval{0};
+};
+
+// CRC-32C, for records on disk. Pass the CRC of the bytes before data to go on from it.
+uint32_t Crc32c(const void *data, size_t size, uint32_t previous = 0);
+
+// The getUpdates offset in a memory-mapped file with two checksummed slots that
+// are written in turn, so a torn write spoils at most the slot being written and
+// Load() falls back to the previous commit. Offsets stored since the last commit
+// are lost in a crash and those updates come again. A file in the old format (the
+// raw 8-byte offset) is converted on open.
+class OffsetStore {
+public:
+    explicit OffsetStore(const std::string &path, const OffsetStoreConfig &config = {});
+    ~OffsetStore();
+
+    OffsetStore(const OffsetStore &) = delete;
+    OffsetStore &operator=(const OffsetStore &) = delete;
+
+    // The last stored offset, 0 for a new file.
+    int64_t Load() const;
+
+    void Store(int64_t offset);
+
+    // Commits the last stored offset if it is not committed yet.
+    void Flush();
+
+private:
+    struct Slot {
+        uint64_t sequence;
+        int64_t offset;
+        uint32_t magic;
+        uint32_t crc;
+    };
+
+    static uint32_t Checksum(const Slot &slot);
+    static bool Valid(const Slot &slot);
+    static void Migrate(const std::string &path, int fd);
+
+    void Commit();
+
+    const OffsetStoreConfig config_;
+    int fd_ = -1;
+    char *map_ = nullptr;
+    uint64_t sequence_ = 0;
+    int64_t offset_ = 0;
+    size_t pending_ = 0;
+    std::chrono::steady_clock::time_point last_commit_;
+};
+}  // namespace telegram
@@ -0,0 +1,65 @@
+#include "poco_transport.h"
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPSClientSession.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
+
+namespace {
+class PocoConnection : public telegram::Connection {
+public:
+    explicit PocoConnection(std::unique_ptr<Poco::Net::HTTPClientSession> session)
+        : session_(std::move(session)) {
+        request_.setVersion(Poco::Net::HTTPMessage::HTTP_1_1);
+        request_.set("Content-Type", "application/json");
+    }
+
+    Reply RoundTrip(const std::string &http_method, const std::string &accept_encoding) override {
+        static const std::string kIdentity;
+
+        request_.setMethod(http_method);
+        request_.setURI(path);
+        request_.setContentLength(static_cast<std::streamsize>(body.size()));
+        if (accept_encoding.empty()) {
+            request_.erase("Accept-Encoding");
+        } else {
+            request_.set("Accept-Encoding", accept_encoding);
+        }
+
+        session_->sendRequest(request_).write(body.data(),
+                                              static_cast<std::streamsize>(body.size()));
+        std::istream &is = session_->receiveResponse(response_);
+        return {static_cast<int>(response_.getStatus()),
+                response_.get("Content-Encoding", kIdentity), is};
+    }
+
+    void Reset() override {
+        session_->reset();
+    }
+
+private:
+    std::unique_ptr<Poco::Net::HTTPClientSession> session_;
+    Poco::Net::HTTPRequest request_;
+    Poco::Net::HTTPResponse response_;
+};
+}  // namespace
+
+telegram::PocoTransport::PocoTransport(const std::string &api_endpoint,
+                                       std::chrono::seconds keep_alive_timeout)
+    : endpoint_(api_endpoint),
+      secure_(api_endpoint.starts_with("https")),
+      keep_alive_timeout_(keep_alive_timeout) {
+}
+
+std::unique_ptr<telegram::Connection> telegram::PocoTransport::Connect() {
+    std::unique_ptr<Poco::Net::HTTPClientSession> session;
+    if (secure_) {
+        session = std::make_unique<Poco::Net::HTTPSClientSession>(endpoint_.getHost(),
+                                                                  endpoint_.getPort());
+    } else {
+        session =
+            std::make_unique<Poco::Net::HTTPClientSession>(endpoint_.getHost(), endpoint_.getPort());
+    }
+    session->setKeepAlive(true);
+    session->setKeepAliveTimeout(Poco::Timespan(keep_alive_timeout_.count(), 0));
+    return std::make_unique<PocoConnection>(std::move(session));
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <chrono>
+#include <Poco/URI.h>
+#include "transport.h"
+
+namespace telegram {
+// HTTP(S) keep-alive connections through Poco::Net::HTTPClientSession.
+class PocoTransport : public Transport {
+public:
+    PocoTransport(const std::string &api_endpoint, std::chrono::seconds keep_alive_timeout);
+
+    std::unique_ptr<Connection> Connect() override;
+
+private:
+    const Poco::URI endpoint_;
+    const bool secure_;
+    const std::chrono::seconds keep_alive_timeout_;
+};
+}  // namespace telegram
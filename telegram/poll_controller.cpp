@@ -0,0 +1,33 @@
+#include "poll_controller.h"
+#include <algorithm>
+#include <stdexcept>
+
+telegram::PollController::PollController(const PollConfig &config)
+    : config_(config), limit_(config.min_limit) {
+    if (config.min_limit < 1 || config.min_limit > config.max_limit || config.max_limit > 100) {
+        throw std::invalid_argument("limits must satisfy 1 <= min_limit <= max_limit <= 100");
+    }
+}
+
+telegram::PollController::Poll telegram::PollController::Next() const {
+    return {config_.timeout, limit_, backoff_};
+}
+
+void telegram::PollController::Received(size_t updates, Clock::duration took) {
+    auto count = static_cast<int64_t>(updates);
+    if (count >= limit_) {
+        limit_ = std::min(limit_ * 2, config_.max_limit);
+    } else if (count < limit_ / 4) {
+        limit_ = std::max(limit_ / 2, config_.min_limit);
+    }
+
+    // A long poll that ran out its timeout has already waited long enough.
+    auto waited = config_.timeout > 0 && took >= std::chrono::seconds(config_.timeout) / 2;
+    if (updates > 0 || waited) {
+        backoff_ = std::chrono::milliseconds{0};
+    } else if (backoff_.count() == 0) {
+        backoff_ = config_.min_backoff;
+    } else {
+        backoff_ = std::min(backoff_ * 2, config_.max_backoff);
+    }
+}
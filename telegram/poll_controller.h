@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+namespace telegram {
+struct PollConfig {
+    // Long-poll timeout in seconds. With 0 the server answers at once and the idle
+    // backoff below paces the polls instead.
+    int64_t timeout = 20;
+    // Bounds for getUpdates' limit; the Bot API accepts 1 to 100.
+    int64_t min_limit = 10;
+    int64_t max_limit = 100;
+    // Update types to receive, as a JSON array. The parser keeps only messages, so
+    // the server need not send anything else.
+    std::string allowed_updates = R"(["message"])";
+    // Pause after an empty reply that did not wait on the server, doubled on every
+    // further one up to max_backoff.
+    std::chrono::milliseconds min_backoff{50};
+    std::chrono::milliseconds max_backoff{5000};
+};
+
+// Picks the parameters of the next getUpdates from what the previous replies held.
+// A full batch means more updates are waiting, so the limit doubles to take them in
+// larger batches; a batch under a quarter of the limit halves it again. Empty replies
+// that came back early back off exponentially, so an idle bot does not spin.
+class PollController {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Poll {
+        int64_t timeout;
+        int64_t limit;
+        // How long to wait before sending the request.
+        std::chrono::milliseconds delay;
+    };
+
+    explicit PollController(const PollConfig &config = PollConfig{});
+
+    Poll Next() const;
+
+    // Records the number of updates a reply held and how long the request took.
+    void Received(size_t updates, Clock::duration took);
+
+    const std::string &AllowedUpdates() const {
+        return config_.allowed_updates;
+    }
+
+private:
+    const PollConfig config_;
+    int64_t limit_;
+    std::chrono::milliseconds backoff_{0};
+};
+}  // namespace telegram
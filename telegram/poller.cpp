@@ -0,0 +1,86 @@
+#include "poller.h"
+
+telegram::Poller::Poller(Client *client, const PollConfig &config, std::optional<int64_t> offset,
+                         size_t queue_capacity)
+    : client_(client), controller_(config), offset_(offset), batches_(queue_capacity) {
+}
+
+telegram::Poller::Poller(Client *client, std::optional<int64_t> timeout,
+                         std::optional<int64_t> offset, size_t queue_capacity)
+    : Poller(client, PollConfig{.timeout = timeout.value_or(0)}, offset, queue_capacity) {
+}
+
+telegram::Poller::~Poller() {
+    Stop();
+    // An in-flight long poll is not interrupted, so this waits at most one timeout.
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void telegram::Poller::SetOnReceived(std::function<void(const UpdateBatch &)> on_received) {
+    on_received_ = std::move(on_received);
+}
+
+void telegram::Poller::Start() {
+    thread_ = std::thread([this] { Run(); });
+}
+
+void telegram::Poller::Stop() {
+    {
+        std::lock_guard lock(mutex_);
+        stopped_ = true;
+    }
+    wake_.notify_all();
+    batches_.Close();
+}
+
+std::shared_ptr<const telegram::UpdateBatch> telegram::Poller::Next() {
+    auto batch = batches_.Pop();
+    if (stopped_) {
+        return nullptr;
+    }
+    // error_ is written before the queue is closed, so it is visible once Pop() gives up.
+    if (!batch && error_) {
+        std::rethrow_exception(error_);
+    }
+    return batch.value_or(nullptr);
+}
+
+void telegram::Poller::Run() {
+    try {
+        while (!stopped_) {
+            auto poll = controller_.Next();
+            if (poll.delay.count() > 0 && !Sleep(poll.delay)) {
+                break;
+            }
+            auto start = PollController::Clock::now();
+            auto batch = client_->FetchUpdateBatch({
+                .timeout = poll.timeout,
+                .offset = offset_,
+                .limit = poll.limit,
+                .allowed_updates = controller_.AllowedUpdates(),
+            });
+            controller_.Received(batch->Size(), PollController::Clock::now() - start);
+            if (batch->Empty()) {
+                continue;
+            }
+
+            if (on_received_) {
+                on_received_(*batch);
+            }
+            offset_ = (*batch)[batch->Size() - 1].update_id + 1;
+            if (!batches_.Push(std::move(batch))) {
+                break;
+            }
+        }
+    } catch (...) {
+        error_ = std::current_exception();
+    }
+    batches_.Close();
+}
+
+bool telegram::Poller::Sleep(std::chrono::milliseconds delay) {
+    std::unique_lock lock(mutex_);
+    return !wake_.wait_for(lock, delay, [this] { return stopped_.load(); });
+}
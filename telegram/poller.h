@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+#include "client.h"
+#include "bounded_queue.h"
+#include "poll_controller.h"
+
+namespace telegram {
+// Keeps the next getUpdates in flight on a background thread while the caller
+// handles the previous batch. Batches are handed over through a bounded queue,
+// so the poller never runs more than queue_capacity batches ahead. A PollController
+// sets the timeout, limit and idle backoff of every request.
+class Poller {
+public:
+    Poller(Client *client, const PollConfig &config, std::optional<int64_t> offset,
+           size_t queue_capacity = 2);
+    // Polls with the given timeout, 0 if unset, and the defaults of PollConfig.
+    Poller(Client *client, std::optional<int64_t> timeout, std::optional<int64_t> offset,
+           size_t queue_capacity = 2);
+    ~Poller();
+
+    // getUpdates confirms every update below the offset it is sent, and the server
+    // forgets them. on_received gets every non-empty batch on the poller thread
+    // before the next request confirms it, so it can keep the batch, as
+    // UpdateJournal::Received does, for a restart to handle. Call before Start().
+    void SetOnReceived(std::function<void(const UpdateBatch &)> on_received);
+
+    void Start();
+    // Safe to call from any thread, including from a handler of a received batch.
+    void Stop();
+
+    // Blocks until the next non-empty batch arrives. Returns nullptr after Stop().
+    // Rethrows the error that stopped the poller.
+    std::shared_ptr<const UpdateBatch> Next();
+
+private:
+    void Run();
+    // Returns false if stopped while waiting.
+    bool Sleep(std::chrono::milliseconds delay);
+
+    Client *client_;
+    PollController controller_;
+    // Past the last update received.
+    std::optional<int64_t> offset_;
+    std::function<void(const UpdateBatch &)> on_received_;
+    BoundedQueue<std::shared_ptr<const UpdateBatch>> batches_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::atomic<bool> stopped_ = false;
+    std::exception_ptr error_;
+    std::thread thread_;
+};
+}  // namespace telegram
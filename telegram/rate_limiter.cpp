@@ -0,0 +1,152 @@
+#include "rate_limiter.h"
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+constexpr size_t kInitialSlots = 1024;
+
+int64_t Ticks(telegram::RateLimiter::Clock::time_point time) {
+    // Offset by one so that no real time point collides with the empty-slot marker.
+    return time.time_since_epoch().count() + 1;
+}
+
+size_t SlotOf(int64_t chat_id, size_t slots) {
+    return (static_cast<uint64_t>(chat_id) * 0x9E3779B97F4A7C15ull >> 17) & (slots - 1);
+}
+}  // namespace
+
+telegram::RateLimiter::Bucket telegram::RateLimiter::MakeBucket(const RateLimit &limit) {
+    if (limit.per_second <= 0 || limit.burst == 0) {
+        throw std::invalid_argument("rate limit must be positive");
+    }
+    std::chrono::duration<double> interval(1 / limit.per_second);
+    // Rounded up: a shorter interval would fit one send too many into a second.
+    auto ticks = std::chrono::ceil<Clock::duration>(interval).count();
+    return {ticks, ticks * (limit.burst - 1)};
+}
+
+telegram::RateLimiter::RateLimiter(const RateLimiterConfig &config)
+    : enabled_(config.enabled),
+      global_(MakeBucket(config.global)),
+      per_chat_(MakeBucket(config.per_chat)),
+      slots_(kInitialSlots, Slot{0, 0}) {
+}
+
+telegram::RateLimiter::Clock::time_point telegram::RateLimiter::Reserve(int64_t chat_id,
+                                                                       Clock::time_point now) {
+    if (!enabled_) {
+        return now;
+    }
+
+    std::lock_guard guard(mutex_);
+    auto ticks = Ticks(now);
+    auto &slot = Find(chat_id, ticks);
+
+    // The earliest moment both buckets have a token left. The global token is charged
+    // at that moment, when the send really goes out: charged earlier, it would leave
+    // room for other sends next to this one and overrun the global limit then.
+    auto send = std::max({ticks, global_tat_ - global_.tolerance, slot.tat - per_chat_.tolerance});
+    global_tat_ = std::max(global_tat_, send) + global_.interval;
+    slot.tat = std::max(slot.tat, send) + per_chat_.interval;
+
+    return now + Clock::duration(send - ticks);
+}
+
+telegram::RateLimiter::Clock::time_point telegram::RateLimiter::TryReserve(int64_t chat_id,
+                                                                          Clock::time_point now) {
+    if (!enabled_) {
+        return now;
+    }
+
+    std::lock_guard guard(mutex_);
+    auto ticks = Ticks(now);
+    auto &slot = Find(chat_id, ticks);
+
+    auto send = std::max({ticks, global_tat_ - global_.tolerance, slot.tat - per_chat_.tolerance});
+    if (send > ticks) {
+        // A tat of now is a full bucket, as for a chat never seen, but keeps the slot
+        // Find() took from reading as empty.
+        slot.tat = std::max(slot.tat, ticks);
+        return now + Clock::duration(send - ticks);
+    }
+    global_tat_ = std::max(global_tat_, ticks) + global_.interval;
+    slot.tat = std::max(slot.tat, ticks) + per_chat_.interval;
+    return now;
+}
+
+void telegram::RateLimiter::Acquire(int64_t chat_id) {
+    // A reservation ahead of time would push the global bucket past it for every
+    // chat; a chat waiting out its own limit holds nobody else back this way.
+    for (auto now = Clock::now();; now = Clock::now()) {
+        auto due = TryReserve(chat_id, now);
+        if (due <= now) {
+            return;
+        }
+        std::this_thread::sleep_until(due);
+    }
+}
+
+void telegram::RateLimiter::Pause(int64_t chat_id, Clock::duration retry_after,
+                                  Clock::time_point now) {
+    if (!enabled_) {
+        return;
+    }
+
+    std::lock_guard guard(mutex_);
+    auto ticks = Ticks(now);
+    auto &slot = Find(chat_id, ticks);
+    // With tat this far ahead even a full burst waits until the pause is over.
+    slot.tat = std::max(slot.tat, ticks + retry_after.count() + per_chat_.tolerance);
+}
+
+size_t telegram::RateLimiter::TrackedChats() const {
+    std::lock_guard guard(mutex_);
+    return used_;
+}
+
+telegram::RateLimiter::Slot &telegram::RateLimiter::Find(int64_t chat_id, int64_t now) {
+    // Keep the table at most half full, counting stale slots until a rebuild drops them.
+    if (2 * (used_ + 1) > slots_.size()) {
+        Rebuild(now);
+    }
+
+    auto mask = slots_.size() - 1;
+    for (auto i = SlotOf(chat_id, slots_.size());; i = (i + 1) & mask) {
+        auto &slot = slots_[i];
+        if (slot.tat == 0) {
+            ++used_;
+            slot.chat_id = chat_id;
+            return slot;
+        }
+        if (slot.chat_id == chat_id) {
+            return slot;
+        }
+    }
+}
+
+void telegram::RateLimiter::Rebuild(int64_t now) {
+    std::vector<Slot> live;
+    for (const auto &slot : slots_) {
+        // A chat whose bucket is full again behaves exactly like one never seen.
+        if (slot.tat != 0 && slot.tat > now) {
+            live.push_back(slot);
+        }
+    }
+
+    auto size = std::max(kInitialSlots, slots_.size());
+    while (4 * (live.size() + 1) > size) {
+        size *= 2;
+    }
+    slots_.assign(size, Slot{0, 0});
+    used_ = live.size();
+
+    auto mask = size - 1;
+    for (const auto &slot : live) {
+        auto i = SlotOf(slot.chat_id, size);
+        while (slots_[i].tat != 0) {
+            i = (i + 1) & mask;
+        }
+        slots_[i] = slot;
+    }
+}
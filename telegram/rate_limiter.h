@@ -0,0 +1,76 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+namespace telegram {
+struct RateLimit {
+    double per_second;
+    // Sends allowed back to back after an idle period.
+    uint32_t burst;
+};
+
+// Telegram allows about 30 messages a second overall and one a second per chat. Any
+// one second holds at most burst - 1 + per_second sends of a bucket, so the defaults
+// keep bursts to one; the global rate stays one short of the limit, leaving room for
+// the send that starts the next second.
+struct RateLimiterConfig {
+    bool enabled = true;
+    RateLimit global{29, 1};
+    RateLimit per_chat{1, 1};
+};
+
+// Token buckets for the whole bot and for every chat, kept as GCRA theoretical
+// arrival times: one 16-byte slot per recently active chat in an open-addressing
+// table. Chats whose bucket has refilled are dropped when the table is rebuilt.
+class RateLimiter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit RateLimiter(const RateLimiterConfig &config);
+
+    // Reserves a send and returns when it may go out (never earlier than now). Until
+    // then the global bucket counts the send as the latest one, so reservations of
+    // other chats come after it.
+    Clock::time_point Reserve(int64_t chat_id, Clock::time_point now = Clock::now());
+
+    // Reserves a send only if it may go out at now, and returns now then. Otherwise
+    // reserves nothing and returns when to try again.
+    Clock::time_point TryReserve(int64_t chat_id, Clock::time_point now = Clock::now());
+
+    // Sleeps until TryReserve() takes a slot.
+    void Acquire(int64_t chat_id);
+
+    // Honours a 429 reply: nothing more goes to the chat until now + retry_after.
+    void Pause(int64_t chat_id, Clock::duration retry_after, Clock::time_point now = Clock::now());
+
+    size_t TrackedChats() const;
+
+private:
+    struct Slot {
+        int64_t chat_id;
+        // Theoretical arrival time in clock ticks; 0 marks an empty slot.
+        int64_t tat;
+    };
+
+    struct Bucket {
+        int64_t interval;
+        int64_t tolerance;
+    };
+
+    static Bucket MakeBucket(const RateLimit &limit);
+    Slot &Find(int64_t chat_id, int64_t now);
+    void Rebuild(int64_t now);
+
+    const bool enabled_;
+    const Bucket global_;
+    const Bucket per_chat_;
+
+    mutable std::mutex mutex_;
+    int64_t global_tat_ = 0;
+    std::vector<Slot> slots_;
+    size_t used_ = 0;
+};
+}  // namespace telegram
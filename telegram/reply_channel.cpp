@@ -0,0 +1,99 @@
+#include "reply_channel.h"
+
+#include <utility>
+
+telegram::ReplyChannel::~ReplyChannel() {
+    std::unique_lock lock(mutex_);
+    done_.wait(lock, [this] { return outstanding_ == 0; });
+}
+
+void telegram::ReplyChannel::SendMessage(const std::string &message, int64_t chat_id,
+                                         std::optional<int64_t> reply_to_message_id) {
+    if (hold_first_ && !sent_) {
+        sent_ = true;
+        held_ = Held{message, nullptr, chat_id, reply_to_message_id};
+        return;
+    }
+    Release();
+    Deliver(message, chat_id, reply_to_message_id);
+}
+
+void telegram::ReplyChannel::SendMessage(const PreparedText &message, int64_t chat_id,
+                                         std::optional<int64_t> reply_to_message_id) {
+    if (hold_first_ && !sent_) {
+        sent_ = true;
+        held_ = Held{{}, &message, chat_id, reply_to_message_id};
+        return;
+    }
+    Release();
+    Deliver(message, chat_id, reply_to_message_id);
+}
+
+void telegram::ReplyChannel::Wait() {
+    std::unique_lock lock(mutex_);
+    done_.wait(lock, [this] { return outstanding_ == 0; });
+    if (error_) {
+        std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+}
+
+void telegram::ReplyChannel::Flush() {
+    Release();
+    Wait();
+}
+
+bool telegram::ReplyChannel::TakeResponse(std::string *body) {
+    if (!held_) {
+        return false;
+    }
+    // The response counts against the same limits as a sendMessage request.
+    client_->AcquireSendSlot(held_->chat_id);
+    if (held_->prepared) {
+        RequestBuilder::BuildSendMessageBody(*held_->prepared, held_->chat_id,
+                                             held_->reply_to_message_id, body);
+    } else {
+        RequestBuilder::BuildSendMessageBody(held_->message, held_->chat_id,
+                                             held_->reply_to_message_id, body);
+    }
+    body->insert(1, "\"method\":\"sendMessage\",");
+    held_.reset();
+    return true;
+}
+
+template <class Text>
+void telegram::ReplyChannel::Deliver(const Text &message, int64_t chat_id,
+                                     std::optional<int64_t> reply_to_message_id) {
+    if (!queue_) {
+        client_->SendMessage(message, chat_id, reply_to_message_id);
+        return;
+    }
+    queue_->Send(SendPriority::kInteractive, message, chat_id, reply_to_message_id, Track());
+}
+
+telegram::SendQueue::Callback telegram::ReplyChannel::Track() {
+    std::lock_guard lock(mutex_);
+    ++outstanding_;
+    return [this](std::exception_ptr error) {
+        // Notified under the lock: the channel may be gone as soon as it is released.
+        std::lock_guard lock(mutex_);
+        if (error && !error_) {
+            error_ = error;
+        }
+        --outstanding_;
+        done_.notify_all();
+    };
+}
+
+void telegram::ReplyChannel::Release() {
+    // A second message: the first one goes out ahead of it, in order.
+    if (!held_) {
+        return;
+    }
+    auto held = std::move(*held_);
+    held_.reset();
+    if (held.prepared) {
+        Deliver(*held.prepared, held.chat_id, held.reply_to_message_id);
+    } else {
+        Deliver(held.message, held.chat_id, held.reply_to_message_id);
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <optional>
+#include <exception>
+#include <condition_variable>
+#include "client.h"
+#include "send_queue.h"
+
+namespace telegram {
+// Where a handler's messages go. They are sent through the client, or queued as
+// interactive messages when there is a send queue. With hold_first the first
+// message is held back: if the handler sends no other, it leaves as the method
+// call in the webhook response and saves a request. Used by one handler call at
+// a time.
+class ReplyChannel {
+public:
+    explicit ReplyChannel(Client *client, bool hold_first = false, SendQueue *queue = nullptr)
+        : client_(client), queue_(queue), hold_first_(hold_first) {
+    }
+
+    // Waits for the queued messages.
+    ~ReplyChannel();
+
+    void SendMessage(const std::string &message, int64_t chat_id,
+                     std::optional<int64_t> reply_to_message_id = std::nullopt);
+
+    // The text must outlive the channel.
+    void SendMessage(const PreparedText &message, int64_t chat_id,
+                     std::optional<int64_t> reply_to_message_id = std::nullopt);
+
+    // Blocks until the queued messages are sent; rethrows the first failure.
+    void Wait();
+
+    // Sends the held message too, and waits.
+    void Flush();
+
+    // Call once the handler is done: writes the held message as a webhook
+    // response body and returns true, or returns false if nothing is held.
+    bool TakeResponse(std::string *body);
+
+private:
+    struct Held {
+        std::string message;
+        const PreparedText *prepared;
+        int64_t chat_id;
+        std::optional<int64_t> reply_to_message_id;
+    };
+
+    template <class Text>
+    void Deliver(const Text &message, int64_t chat_id, std::optional<int64_t> reply_to_message_id);
+    SendQueue::Callback Track();
+    void Release();
+
+    Client *client_;
+    SendQueue *queue_;
+    const bool hold_first_;
+    bool sent_ = false;
+    std::optional<Held> held_;
+
+    std::mutex mutex_;
+    std::condition_variable done_;
+    size_t outstanding_ = 0;
+    std::exception_ptr error_;
+};
+}  // namespace telegram
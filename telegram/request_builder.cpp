@@ -0,0 +1,146 @@
+#include "request_builder.h"
+#include <charconv>
+#include <Poco/Net/HTTPRequest.h>
+
+namespace {
+constexpr std::array<std::string_view, 3> kMethodNames = {"getMe", "getUpdates", "sendMessage"};
+}  // namespace
+
+const std::string &telegram::HttpMethodOf(ApiMethod method) {
+    return method == ApiMethod::kSendMessage ? Poco::Net::HTTPRequest::HTTP_POST
+                                             : Poco::Net::HTTPRequest::HTTP_GET;
+}
+
+std::string_view telegram::NameOf(ApiMethod method) {
+    return kMethodNames[static_cast<size_t>(method)];
+}
+
+telegram::RequestBuilder::RequestBuilder(const std::string &api_key) {
+    for (size_t i = 0; i < paths_.size(); ++i) {
+        paths_[i] = "/" + api_key + "/" + std::string(kMethodNames[i]);
+    }
+}
+
+void telegram::RequestBuilder::BuildPath(ApiMethod method, std::string *path) const {
+    path->assign(paths_[static_cast<size_t>(method)]);
+}
+
+void telegram::RequestBuilder::BuildGetUpdatesPath(std::optional<int64_t> timeout,
+                                                   std::optional<int64_t> offset,
+                                                   std::string *path) const {
+    BuildGetUpdatesPath({.timeout = timeout, .offset = offset}, path);
+}
+
+void telegram::RequestBuilder::BuildGetUpdatesPath(const GetUpdatesQuery &query,
+                                                   std::string *path) const {
+    BuildPath(ApiMethod::kGetUpdates, path);
+    auto separator = '?';
+    auto append = [&](std::string_view name, std::optional<int64_t> value) {
+        if (value.has_value()) {
+            path->push_back(separator);
+            path->append(name);
+            AppendInteger(*value, path);
+            separator = '&';
+        }
+    };
+    append("timeout=", query.timeout);
+    append("offset=", query.offset);
+    append("limit=", query.limit);
+    if (!query.allowed_updates.empty()) {
+        path->push_back(separator);
+        path->append("allowed_updates=");
+        AppendUrlEncoded(query.allowed_updates, path);
+    }
+}
+
+telegram::PreparedText::PreparedText(std::string_view text) : text_(text) {
+    AppendJsonString(text, &json_);
+}
+
+void telegram::RequestBuilder::BuildSendMessageBody(std::string_view text, int64_t chat_id,
+                                                    std::optional<int64_t> reply_to_message_id,
+                                                    std::string *body) {
+    BeginSendMessageBody(chat_id, body);
+    AppendJsonString(text, body);
+    EndSendMessageBody(reply_to_message_id, body);
+}
+
+void telegram::RequestBuilder::BuildSendMessageBody(const PreparedText &text, int64_t chat_id,
+                                                    std::optional<int64_t> reply_to_message_id,
+                                                    std::string *body) {
+    BeginSendMessageBody(chat_id, body);
+    body->append(text.Json());
+    EndSendMessageBody(reply_to_message_id, body);
+}
+
+void telegram::RequestBuilder::BeginSendMessageBody(int64_t chat_id, std::string *body) {
+    body->assign("{\"chat_id\":");
+    AppendInteger(chat_id, body);
+    body->append(",\"text\":");
+}
+
+void telegram::RequestBuilder::EndSendMessageBody(std::optional<int64_t> reply_to_message_id,
+                                                  std::string *body) {
+    if (reply_to_message_id.has_value()) {
+        body->append(",\"reply_to_message_id\":");
+        AppendInteger(*reply_to_message_id, body);
+    }
+    body->push_back('}');
+}
+
+void telegram::AppendJsonString(std::string_view value, std::string *out) {
+    static constexpr char kHex[] = "0123456789abcdef";
+
+    out->push_back('"');
+    for (char c : value) {
+        switch (c) {
+            case '"':
+                out->append("\\\"");
+                break;
+            case '\\':
+                out->append("\\\\");
+                break;
+            case '\n':
+                out->append("\\n");
+                break;
+            case '\r':
+                out->append("\\r");
+                break;
+            case '\t':
+                out->append("\\t");
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out->append("\\u00");
+                    out->push_back(kHex[c >> 4]);
+                    out->push_back(kHex[c & 0xf]);
+                } else {
+                    out->push_back(c);
+                }
+        }
+    }
+    out->push_back('"');
+}
+
+void telegram::AppendInteger(int64_t value, std::string *out) {
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof buffer, value);
+    out->append(buffer, result.ptr);
+}
+
+void telegram::AppendUrlEncoded(std::string_view value, std::string *out) {
+    static constexpr char kHex[] = "0123456789ABCDEF";
+
+    for (char c : value) {
+        auto byte = static_cast<unsigned char>(c);
+        bool unreserved = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                          (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' || c == '~';
+        if (unreserved) {
+            out->push_back(c);
+        } else {
+            out->push_back('%');
+            out->push_back(kHex[byte >> 4]);
+            out->push_back(kHex[byte & 0xf]);
+        }
+    }
+}
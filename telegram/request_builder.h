@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace telegram {
+enum class ApiMethod { kGetMe, kGetUpdates, kSendMessage };
+
+const std::string &HttpMethodOf(ApiMethod method);
+// The Bot API name of the method, such as "sendMessage".
+std::string_view NameOf(ApiMethod method);
+
+// A message text serialized once as a JSON string literal, for replies that are
+// sent over and over.
+class PreparedText {
+public:
+    explicit PreparedText(std::string_view text);
+
+    const std::string &Text() const {
+        return text_;
+    }
+
+    const std::string &Json() const {
+        return json_;
+    }
+
+private:
+    std::string text_;
+    std::string json_;
+};
+
+// getUpdates parameters; unset ones are left to the server's defaults.
+struct GetUpdatesQuery {
+    std::optional<int64_t> timeout{};
+    std::optional<int64_t> offset{};
+    std::optional<int64_t> limit{};
+    // A JSON array of update types such as ["message"]; empty sends none.
+    std::string_view allowed_updates{};
+};
+
+// Serializes requests into caller-owned buffers. The "/<key>/<method>" prefixes are
+// built once, so once the buffers have grown to size no call allocates.
+class RequestBuilder {
+public:
+    explicit RequestBuilder(const std::string &api_key);
+
+    void BuildPath(ApiMethod method, std::string *path) const;
+
+    void BuildGetUpdatesPath(std::optional<int64_t> timeout, std::optional<int64_t> offset,
+                             std::string *path) const;
+
+    void BuildGetUpdatesPath(const GetUpdatesQuery &query, std::string *path) const;
+
+    static void BuildSendMessageBody(std::string_view text, int64_t chat_id,
+                                     std::optional<int64_t> reply_to_message_id,
+                                     std::string *body);
+
+    static void BuildSendMessageBody(const PreparedText &text, int64_t chat_id,
+                                     std::optional<int64_t> reply_to_message_id,
+                                     std::string *body);
+
+private:
+    static void BeginSendMessageBody(int64_t chat_id, std::string *body);
+    static void EndSendMessageBody(std::optional<int64_t> reply_to_message_id, std::string *body);
+
+    std::array<std::string, 3> paths_;
+};
+
+// Appends the value as a quoted JSON string literal.
+void AppendJsonString(std::string_view value, std::string *out);
+void AppendInteger(int64_t value, std::string *out);
+// Appends the value percent-encoded for a URL query.
+void AppendUrlEncoded(std::string_view value, std::string *out);
+}  // namespace telegram
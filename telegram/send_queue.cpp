@@ -0,0 +1,298 @@
+#include "send_queue.h"
+#include "tracing.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+size_t Cost(const std::string &text, const telegram::PreparedText *prepared) {
+    // Never zero, so an empty message still uses up its turn.
+    return (prepared ? prepared->Json().size() : text.size()) + 1;
+}
+
+size_t CodePoints(const std::string &text) {
+    // Every byte but UTF-8 continuation bytes starts a code point.
+    return static_cast<size_t>(std::count_if(text.begin(), text.end(), [](char c) {
+        return (static_cast<unsigned char>(c) & 0xc0) != 0x80;
+    }));
+}
+}  // namespace
+
+telegram::SendQueue::SendQueue(Client *client, const SendQueueConfig &config)
+    : client_(client),
+      quantum_(std::max<size_t>(config.quantum, 1)),
+      coalesce_window_(config.coalesce_window),
+      max_text_length_(config.max_text_length) {
+    if (config.senders == 0) {
+        throw std::invalid_argument("send queue needs at least one sender");
+    }
+    for (size_t i = 0; i < config.senders; ++i) {
+        senders_.emplace_back([this] { Work(); });
+    }
+}
+
+telegram::SendQueue::~SendQueue() {
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+    for (auto &sender : senders_) {
+        sender.join();
+    }
+}
+
+void telegram::SendQueue::Send(SendPriority priority, std::string message, int64_t chat_id,
+                               std::optional<int64_t> reply_to_message_id, Callback done) {
+    Push(priority, {std::move(message), nullptr, chat_id, reply_to_message_id, std::move(done),
+                    Clock::now(), TraceScope::Current()});
+}
+
+void telegram::SendQueue::Send(SendPriority priority, const PreparedText &message,
+                               int64_t chat_id, std::optional<int64_t> reply_to_message_id,
+                               Callback done) {
+    Push(priority, {{}, &message, chat_id, reply_to_message_id, std::move(done), Clock::now(),
+                    TraceScope::Current()});
+}
+
+void telegram::SendQueue::Flush() {
+    std::unique_lock lock(mutex_);
+    changed_.wait(lock, [this] {
+        if (in_flight_ > 0) {
+            return false;
+        }
+        for (const auto &c : classes_) {
+            if (c.queued > 0) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+std::array<telegram::SendQueue::ClassStats, 3> telegram::SendQueue::Stats() const {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    std::lock_guard lock(mutex_);
+    std::array<ClassStats, 3> stats;
+    for (size_t i = 0; i < classes_.size(); ++i) {
+        const auto &c = classes_[i];
+        auto started = static_cast<Clock::rep>(std::max<uint64_t>(c.started, 1));
+        stats[i] = {c.queued, c.sent, c.failed, c.coalesced,
+                    duration_cast<microseconds>(c.total_delay / started),
+                    duration_cast<microseconds>(c.max_delay)};
+    }
+    return stats;
+}
+
+void telegram::SendQueue::Push(SendPriority priority, Message message) {
+    {
+        std::lock_guard lock(mutex_);
+        auto &c = classes_[static_cast<size_t>(priority)];
+        auto chat_id = message.chat_id;
+        auto &flow = c.flows[chat_id];
+        if (flow.messages.empty()) {
+            c.active.push_back(chat_id);
+        }
+        flow.messages.push_back(std::move(message));
+        ++c.queued;
+    }
+    changed_.notify_one();
+}
+
+void telegram::SendQueue::Retry(size_t index, Message message, Clock::time_point paused_until) {
+    auto &c = classes_[index];
+    auto chat_id = message.chat_id;
+    auto &flow = c.flows[chat_id];
+    if (flow.messages.empty()) {
+        c.active.push_back(chat_id);
+    }
+    flow.paused_until = paused_until;
+    c.queued += message.parts;
+    flow.messages.push_front(std::move(message));
+}
+
+std::optional<telegram::SendQueue::Taken> telegram::SendQueue::Take(Clock::time_point now,
+                                                                   Clock::time_point *wake) {
+    for (size_t index = 0; index < classes_.size(); ++index) {
+        auto &c = classes_[index];
+        // Every pass tops up the deficit of the chats it visits, so a chat that is
+        // not busy is served within a few passes even if its message is large.
+        bool ready = true;
+        while (ready) {
+            ready = false;
+            for (auto turns = c.active.size(); turns > 0; --turns) {
+                auto chat_id = c.active.front();
+                c.active.pop_front();
+                auto flow = c.flows.find(chat_id);
+                auto &front = flow->second.messages.front();
+                auto busy = busy_.contains(chat_id);
+                auto hold_until =
+                    std::max(front.queued_at + coalesce_window_, flow->second.paused_until);
+                if (busy || hold_until > now) {
+                    if (!busy) {
+                        *wake = std::min(*wake, hold_until);
+                    }
+                    c.active.push_back(chat_id);
+                    continue;
+                }
+
+                auto cost = Cost(front.text, front.prepared);
+                if (flow->second.deficit < cost) {
+                    flow->second.deficit += quantum_;
+                }
+                if (flow->second.deficit < cost) {
+                    ready = true;
+                    c.active.push_back(chat_id);
+                    continue;
+                }
+                // Asked last, so a slot is taken only for a message that goes out now.
+                auto due = client_->TryAcquireSendSlot(chat_id, now);
+                if (due > now) {
+                    *wake = std::min(*wake, due);
+                    c.active.push_back(chat_id);
+                    continue;
+                }
+
+                flow->second.deficit -= cost;
+                Taken taken{index, std::move(front)};
+                flow->second.messages.pop_front();
+                auto delay = now - taken.message.queued_at;
+                c.total_delay += delay;
+                c.max_delay = std::max(c.max_delay, delay);
+                if (coalesce_window_ > Clock::duration::zero()) {
+                    // A merged message pays for its part of the text like any other,
+                    // so coalescing never buys a chat more than its share.
+                    size_t merged = 0;
+                    for (auto &next : flow->second.messages) {
+                        auto next_cost = Cost(next.text, next.prepared);
+                        if (flow->second.deficit < next_cost ||
+                            !Coalesce(&taken.message, next)) {
+                            break;
+                        }
+                        flow->second.deficit -= next_cost;
+                        c.total_delay += now - next.queued_at;
+                        c.coalesced += next.parts;
+                        ++merged;
+                    }
+                    flow->second.messages.erase(
+                        flow->second.messages.begin(),
+                        flow->second.messages.begin() + static_cast<ptrdiff_t>(merged));
+                }
+
+                if (flow->second.messages.empty()) {
+                    c.flows.erase(flow);
+                } else {
+                    c.active.push_back(chat_id);
+                }
+                busy_.insert(chat_id);
+                c.queued -= taken.message.parts;
+                c.started += taken.message.parts;
+                return taken;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+bool telegram::SendQueue::Coalesce(Message *message, Message &next) const {
+    if (next.reply_to_message_id != message->reply_to_message_id) {
+        return false;
+    }
+    const auto &head = message->prepared ? message->prepared->Text() : message->text;
+    const auto &tail = next.prepared ? next.prepared->Text() : next.text;
+    if (CodePoints(head) + 1 + CodePoints(tail) > max_text_length_) {
+        return false;
+    }
+
+    auto text = head + '\n' + tail;
+    message->text = std::move(text);
+    message->prepared = nullptr;
+    message->parts += next.parts;
+    if (next.done) {
+        if (message->done) {
+            message->done = [first = std::move(message->done),
+                             second = std::move(next.done)](std::exception_ptr error) {
+                first(error);
+                second(error);
+            };
+        } else {
+            message->done = std::move(next.done);
+        }
+    }
+    return true;
+}
+
+void telegram::SendQueue::Work() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+        std::optional<Taken> next;
+        auto wake = Clock::time_point::max();
+        auto finished = [&] {
+            wake = Clock::time_point::max();
+            next = Take(Clock::now(), &wake);
+            if (next || !stopping_) {
+                return next.has_value();
+            }
+            for (const auto &c : classes_) {
+                if (c.queued > 0) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        // A held message has to be picked up when its window ends, even if nothing
+        // else happens by then.
+        while (!finished()) {
+            if (wake == Clock::time_point::max()) {
+                changed_.wait(lock);
+            } else {
+                changed_.wait_until(lock, wake);
+            }
+        }
+        if (!next) {
+            return;
+        }
+
+        auto &[index, message] = *next;
+        ++in_flight_;
+        lock.unlock();
+        std::exception_ptr error;
+        std::optional<Clock::duration> retry_after;
+        TraceScope scope(message.update_id);
+        RecordSpan("send queue", message.queued_at);
+        try {
+            // Take() has taken the rate limit slot already.
+            if (message.prepared) {
+                client_->SendMessageInSlot(*message.prepared, message.chat_id,
+                                           message.reply_to_message_id);
+            } else {
+                client_->SendMessageInSlot(message.text, message.chat_id,
+                                           message.reply_to_message_id);
+            }
+        } catch (const TooManyRequests &too_many) {
+            if (message.retries < client_->MaxSendRetries()) {
+                retry_after = too_many.RetryAfter();
+            } else {
+                error = std::current_exception();
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        if (!retry_after && message.done) {
+            message.done(error);
+        }
+        lock.lock();
+
+        busy_.erase(message.chat_id);
+        --in_flight_;
+        if (retry_after) {
+            ++message.retries;
+            Retry(index, std::move(message), Clock::now() + *retry_after);
+        } else {
+            (error ? classes_[index].failed : classes_[index].sent) += message.parts;
+        }
+        changed_.notify_all();
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+#include "client.h"
+
+namespace telegram {
+enum class SendPriority : uint8_t { kInteractive, kNotification, kBulk };
+
+struct SendQueueConfig {
+    // Sends in flight at once, each to a different chat.
+    size_t senders = 4;
+    // Bytes of text a chat may send per round within its priority class.
+    size_t quantum = 4096;
+    // Opt-in: a chat's message waits this long for more messages to the same chat
+    // in its class. Consecutive ones that reply to the same message (or to none) go
+    // out as one message, their texts joined by newlines, up to max_text_length.
+    std::chrono::milliseconds coalesce_window{0};
+    // Characters (code points) in one message; the Bot API limit.
+    size_t max_text_length = 4096;
+};
+
+// Outbound messages in front of Client::SendMessage. A class is served only while
+// no higher class has a message ready. Within a class chats take turns by deficit
+// round robin, so a chatty chat gets no more than its share. Messages of a chat go
+// out one at a time, in order within their class; different chats are sent in
+// parallel. A chat the client's rate limits hold back, or one paused by a 429, is
+// passed over until it is due, so senders never wait in the limiter.
+class SendQueue {
+public:
+    // Called with nullptr once the message is sent, or with the error.
+    using Callback = std::function<void(std::exception_ptr)>;
+
+    explicit SendQueue(Client *client, const SendQueueConfig &config = {});
+    // Sends what is queued, then stops.
+    ~SendQueue();
+
+    void Send(SendPriority priority, std::string message, int64_t chat_id,
+              std::optional<int64_t> reply_to_message_id = std::nullopt, Callback done = {});
+
+    // The text must stay alive until the message is sent.
+    void Send(SendPriority priority, const PreparedText &message, int64_t chat_id,
+              std::optional<int64_t> reply_to_message_id = std::nullopt, Callback done = {});
+
+    // Blocks until nothing is queued or in flight.
+    void Flush();
+
+    struct ClassStats {
+        size_t queued;
+        uint64_t sent;
+        uint64_t failed;
+        // Messages sent as part of another one.
+        uint64_t coalesced;
+        // From Send() to the start of the request.
+        std::chrono::microseconds mean_delay;
+        std::chrono::microseconds max_delay;
+    };
+
+    std::array<ClassStats, 3> Stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Message {
+        std::string text;
+        const PreparedText *prepared;
+        int64_t chat_id;
+        std::optional<int64_t> reply_to_message_id;
+        Callback done;
+        Clock::time_point queued_at;
+        // The update the message answers, for tracing; see TraceScope.
+        int64_t update_id;
+        // How many queued messages it stands for.
+        size_t parts = 1;
+        // Replies of 429 so far.
+        size_t retries = 0;
+    };
+
+    struct Flow {
+        std::deque<Message> messages;
+        size_t deficit = 0;
+        // Set by a 429: nothing goes to the chat before then.
+        Clock::time_point paused_until{};
+    };
+
+    struct Class {
+        std::unordered_map<int64_t, Flow> flows;
+        // Chats with messages, in round-robin order.
+        std::deque<int64_t> active;
+        size_t queued = 0;
+        uint64_t started = 0;
+        uint64_t sent = 0;
+        uint64_t failed = 0;
+        uint64_t coalesced = 0;
+        Clock::duration total_delay{};
+        Clock::duration max_delay{};
+    };
+
+    struct Taken {
+        size_t index;
+        Message message;
+    };
+
+    void Push(SendPriority priority, Message message);
+    // Puts a message back at the head of its chat after a 429.
+    void Retry(size_t index, Message message, Clock::time_point paused_until);
+    std::optional<Taken> Take(Clock::time_point now, Clock::time_point *wake);
+    // Appends next to the message if they can go out as one.
+    bool Coalesce(Message *message, Message &next) const;
+    void Work();
+
+    Client *client_;
+    const size_t quantum_;
+    const Clock::duration coalesce_window_;
+    const size_t max_text_length_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    std::array<Class, 3> classes_;
+    // Chats with a message in flight.
+    std::unordered_set<int64_t> busy_;
+    size_t in_flight_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> senders_;
+};
+}  // namespace telegram
@@ -0,0 +1,248 @@
+#include "structural_index.h"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TELEGRAM_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+constexpr size_t kBlock = 64;
+constexpr uint64_t kEvenBits = 0x5555555555555555ull;
+
+// One bit per byte of a 64-byte block.
+struct BlockMasks {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;
+};
+
+uint64_t PrefixXor(uint64_t bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+// Turns character masks into structural positions, carrying string and escape
+// state from block to block. Branch-free except for the backslash-free shortcut.
+class Scanner {
+public:
+    void Scan(const BlockMasks &masks, uint32_t base, std::vector<uint32_t> *index) {
+        auto quote = masks.quote & ~Escaped(masks.backslash);
+        // Inclusive: opening quotes and string contents are set, closing quotes are not.
+        auto in_string = PrefixXor(quote) ^ prev_in_string_;
+        prev_in_string_ = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+
+        for (auto bits = (masks.op & ~in_string) | (quote & in_string); bits != 0;
+             bits &= bits - 1) {
+            index->push_back(base + static_cast<uint32_t>(__builtin_ctzll(bits)));
+        }
+    }
+
+    bool InString() const {
+        return prev_in_string_ != 0;
+    }
+
+private:
+    // Characters preceded by an odd run of backslashes.
+    uint64_t Escaped(uint64_t backslash) {
+        if (backslash == 0) {
+            auto escaped = prev_escaped_;
+            prev_escaped_ = 0;
+            return escaped;
+        }
+        backslash &= ~prev_escaped_;
+        auto follows_escape = backslash << 1 | prev_escaped_;
+        // Adding the odd-position run starts carries through each run; what is left
+        // marks the runs that started on even positions.
+        auto odd_starts = backslash & ~kEvenBits & ~follows_escape;
+        uint64_t even_runs;
+        prev_escaped_ = __builtin_add_overflow(odd_starts, backslash, &even_runs);
+        return (kEvenBits ^ (even_runs << 1)) & follows_escape;
+    }
+
+    uint64_t prev_in_string_ = 0;
+    uint64_t prev_escaped_ = 0;
+};
+
+enum CharClass : uint8_t { kOther, kQuote, kBackslash, kOp };
+
+constexpr std::array<uint8_t, 256> MakeCharClasses() {
+    std::array<uint8_t, 256> classes{};
+    classes['"'] = kQuote;
+    classes['\\'] = kBackslash;
+    for (unsigned char op : {'{', '}', '[', ']', ':', ','}) {
+        classes[op] = kOp;
+    }
+    return classes;
+}
+
+constexpr auto kCharClasses = MakeCharClasses();
+
+BlockMasks ClassifyScalar(const char *block) {
+    BlockMasks masks{0, 0, 0};
+    for (size_t i = 0; i < kBlock; ++i) {
+        auto bit = uint64_t{1} << i;
+        switch (kCharClasses[static_cast<unsigned char>(block[i])]) {
+            case kQuote:
+                masks.quote |= bit;
+                break;
+            case kBackslash:
+                masks.backslash |= bit;
+                break;
+            case kOp:
+                masks.op |= bit;
+                break;
+        }
+    }
+    return masks;
+}
+
+#ifdef TELEGRAM_X86
+__attribute__((target("sse4.2"))) inline BlockMasks ClassifySse42(const char *block) {
+    // PCMPESTRM matches every byte against the whole operator set at once.
+    const auto ops = _mm_setr_epi8('{', '}', '[', ']', ':', ',', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const auto quote = _mm_set1_epi8('"');
+    const auto backslash = _mm_set1_epi8('\\');
+
+    BlockMasks masks{0, 0, 0};
+    for (size_t i = 0; i < kBlock; i += 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i));
+        auto op = _mm_cmpestrm(ops, 6, chunk, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+        masks.op |= static_cast<uint64_t>(_mm_cvtsi128_si32(op) & 0xFFFF) << i;
+        masks.quote |= static_cast<uint64_t>(
+                           static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote))))
+                       << i;
+        masks.backslash |= static_cast<uint64_t>(static_cast<uint16_t>(
+                               _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, backslash))))
+                           << i;
+    }
+    return masks;
+}
+
+__attribute__((target("avx2"))) inline BlockMasks ClassifyAvx2(const char *block) {
+    const auto quote = _mm256_set1_epi8('"');
+    const auto backslash = _mm256_set1_epi8('\\');
+    // '[' and ']' differ from '{' and '}' only in bit 0x20.
+    const auto case_bit = _mm256_set1_epi8(0x20);
+    const auto open = _mm256_set1_epi8('{');
+    const auto close = _mm256_set1_epi8('}');
+    const auto colon = _mm256_set1_epi8(':');
+    const auto comma = _mm256_set1_epi8(',');
+
+    BlockMasks masks{0, 0, 0};
+    for (size_t i = 0; i < kBlock; i += 32) {
+        auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + i));
+        auto folded = _mm256_or_si256(chunk, case_bit);
+        auto op = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(folded, open), _mm256_cmpeq_epi8(folded, close)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, colon), _mm256_cmpeq_epi8(chunk, comma)));
+        masks.op |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(op))) << i;
+        masks.quote |= static_cast<uint64_t>(static_cast<uint32_t>(
+                           _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, quote))))
+                       << i;
+        masks.backslash |= static_cast<uint64_t>(static_cast<uint32_t>(
+                               _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, backslash))))
+                           << i;
+    }
+    return masks;
+}
+#endif
+
+template <class Classify>
+__attribute__((always_inline)) inline void IndexBlocks(std::string_view json,
+                                                       std::vector<uint32_t> *index,
+                                                       Classify &&classify) {
+    Scanner scanner;
+    size_t offset = 0;
+    for (; offset + kBlock <= json.size(); offset += kBlock) {
+        scanner.Scan(classify(json.data() + offset), static_cast<uint32_t>(offset), index);
+    }
+    if (offset < json.size()) {
+        // Spaces are neither structural nor special, so padding the tail is harmless.
+        char tail[kBlock];
+        std::memset(tail, ' ', kBlock);
+        std::memcpy(tail, json.data() + offset, json.size() - offset);
+        scanner.Scan(classify(tail), static_cast<uint32_t>(offset), index);
+    }
+    if (scanner.InString()) {
+        throw telegram::ParseError("malformed JSON: unterminated string");
+    }
+}
+
+void IndexScalar(std::string_view json, std::vector<uint32_t> *index) {
+    IndexBlocks(json, index, ClassifyScalar);
+}
+
+#ifdef TELEGRAM_X86
+__attribute__((target("sse4.2"))) void IndexSse42(std::string_view json,
+                                                  std::vector<uint32_t> *index) {
+    IndexBlocks(json, index, ClassifySse42);
+}
+
+__attribute__((target("avx2"))) void IndexAvx2(std::string_view json,
+                                               std::vector<uint32_t> *index) {
+    IndexBlocks(json, index, ClassifyAvx2);
+}
+#endif
+}  // namespace
+
+telegram::SimdLevel telegram::DetectSimdLevel() {
+#ifdef TELEGRAM_X86
+    static const auto kLevel = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return SimdLevel::kAvx2;
+        }
+        if (__builtin_cpu_supports("sse4.2")) {
+            return SimdLevel::kSse42;
+        }
+        return SimdLevel::kScalar;
+    }();
+    return kLevel;
+#else
+    return SimdLevel::kScalar;
+#endif
+}
+
+const char *telegram::SimdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::kAvx2:
+            return "avx2";
+        case SimdLevel::kSse42:
+            return "sse4.2";
+        default:
+            return "scalar";
+    }
+}
+
+void telegram::BuildStructuralIndex(std::string_view json, std::vector<uint32_t> *index,
+                                    SimdLevel level) {
+    if (json.size() > UINT32_MAX) {
+        throw ParseError("JSON text too large to index");
+    }
+    index->clear();
+#ifdef TELEGRAM_X86
+    // Never run code the CPU cannot execute, whatever the caller asked for.
+    if (level > DetectSimdLevel()) {
+        level = DetectSimdLevel();
+    }
+    switch (level) {
+        case SimdLevel::kAvx2:
+            IndexAvx2(json, index);
+            return;
+        case SimdLevel::kSse42:
+            IndexSse42(json, index);
+            return;
+        default:
+            break;
+    }
+#endif
+    IndexScalar(json, index);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace telegram {
+class ParseError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+enum class SimdLevel { kScalar, kSse42, kAvx2 };
+
+// The widest level both the build and the running CPU support.
+SimdLevel DetectSimdLevel();
+
+const char *SimdLevelName(SimdLevel level);
+
+// Fills index with the offsets of the structural characters of a JSON text: { } [ ] : ,
+// outside strings, and the opening quote of every string. Scalars (numbers, true,
+// false, null) have no entry; they sit between two structural characters.
+// Every level gives the same index. Throws ParseError on an unterminated string.
+void BuildStructuralIndex(std::string_view json, std::vector<uint32_t> *index,
+                          SimdLevel level = DetectSimdLevel());
+}  // namespace telegram
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <utility>
+#include <optional>
+#include <exception>
+#include <coroutine>
+
+namespace telegram {
+template <class T = void>
+class Task;
+
+namespace detail {
+struct FinalAwaiter {
+    bool await_ready() noexcept {
+        return false;
+    }
+
+    template <class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+        if (auto continuation = handle.promise().continuation) {
+            return continuation;
+        }
+        return std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {
+    }
+};
+
+struct PromiseBase {
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() {
+        error = std::current_exception();
+    }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+};
+
+template <class T>
+struct Promise : PromiseBase {
+    Task<T> get_return_object();
+
+    void return_value(T result) {
+        value = std::move(result);
+    }
+
+    T Result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+
+    std::optional<T> value;
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+
+    void return_void() {
+    }
+
+    void Result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+}  // namespace detail
+
+// Lazily started coroutine. Runs when awaited and resumes the awaiter when done.
+template <class T>
+class [[nodiscard]] Task {
+public:
+    using promise_type = detail::Promise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {
+    }
+
+    Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {
+    }
+
+    Task &operator=(Task &&other) = delete;
+
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+
+    T await_resume() {
+        return handle_.promise().Result();
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template <class T>
+Task<T> detail::Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> detail::Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+}  // namespace telegram
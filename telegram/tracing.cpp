@@ -0,0 +1,164 @@
+#include "tracing.h"
+#include "request_builder.h"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <iterator>
+
+namespace {
+std::atomic<uint64_t> next_tracer_id = 1;
+
+struct Copied {
+    const char *name;
+    int64_t start;
+    int64_t end;
+    int64_t first_update;
+    int64_t last_update;
+    size_t thread;
+};
+
+void AppendMicros(int64_t nanos, std::string *out) {
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof buffer, static_cast<double>(nanos) / 1e3);
+    out->append(buffer, result.ptr);
+}
+}  // namespace
+
+telegram::Tracer::Tracer(const TracerConfig &config)
+    : id_(next_tracer_id.fetch_add(1)),
+      capacity_(std::bit_ceil(std::max<size_t>(config.events_per_thread, 1))),
+      sample_every_(std::max<uint64_t>(config.sample_every, 1)),
+      epoch_(Clock::now()) {
+}
+
+telegram::Tracer::~Tracer() {
+    auto *self = this;
+    installed_.compare_exchange_strong(self, nullptr);
+}
+
+void telegram::Tracer::Install(Tracer *tracer) {
+    installed_.store(tracer, std::memory_order_release);
+}
+
+telegram::Tracer::Buffer &telegram::Tracer::BufferOfThisThread() {
+    // One entry is enough: a thread records into the installed tracer only.
+    thread_local uint64_t cached_id = 0;
+    thread_local Buffer *cached = nullptr;
+    if (cached_id == id_) {
+        return *cached;
+    }
+
+    std::lock_guard lock(mutex_);
+    auto buffer = std::make_unique<Buffer>();
+    buffer->events = std::make_unique<Event[]>(capacity_);
+    buffer->thread = buffers_.size() + 1;
+    buffers_.push_back(std::move(buffer));
+    cached_id = id_;
+    cached = buffers_.back().get();
+    return *cached;
+}
+
+void telegram::Tracer::Record(const char *name, Clock::time_point start, Clock::time_point end,
+                              int64_t first_update, int64_t last_update) {
+    auto &buffer = BufferOfThisThread();
+    auto head = buffer.head.load(std::memory_order_relaxed);
+    auto &event = buffer.events[head & (capacity_ - 1)];
+    // Release stores keep the head of the previous event ahead of this one's fields,
+    // so a reader that sees a field of it also sees the head moved past its slot.
+    event.name.store(name, std::memory_order_release);
+    event.start.store((start - epoch_).count(), std::memory_order_release);
+    event.end.store((end - epoch_).count(), std::memory_order_release);
+    event.first_update.store(first_update, std::memory_order_release);
+    event.last_update.store(last_update, std::memory_order_release);
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void telegram::Tracer::WriteChromeTrace(std::string *out, std::optional<int64_t> update_id) const {
+    static_assert(std::is_same_v<Clock::duration, std::chrono::nanoseconds>);
+
+    std::vector<Copied> events;
+    size_t threads = 0;
+    {
+        std::lock_guard lock(mutex_);
+        threads = buffers_.size();
+        for (const auto &buffer : buffers_) {
+            auto head = buffer->head.load(std::memory_order_acquire);
+            auto begin = head > capacity_ ? head - capacity_ : 0;
+            auto copied = events.size();
+            for (auto i = begin; i < head; ++i) {
+                const auto &event = buffer->events[i & (capacity_ - 1)];
+                events.push_back({event.name.load(std::memory_order_acquire),
+                                  event.start.load(std::memory_order_acquire),
+                                  event.end.load(std::memory_order_acquire),
+                                  event.first_update.load(std::memory_order_acquire),
+                                  event.last_update.load(std::memory_order_acquire),
+                                  buffer->thread});
+            }
+            // Events the thread has overwritten, or may be overwriting, while they
+            // were copied are torn.
+            auto now = buffer->head.load(std::memory_order_acquire) + 1;
+            auto overwritten = now > capacity_ ? now - capacity_ : 0;
+            if (overwritten > begin) {
+                auto torn = static_cast<ptrdiff_t>(std::min(overwritten, head) - begin);
+                events.erase(events.begin() + static_cast<ptrdiff_t>(copied),
+                             events.begin() + static_cast<ptrdiff_t>(copied) + torn);
+            }
+        }
+    }
+
+    if (update_id) {
+        auto belongs = [id = *update_id](const Copied &e) {
+            return e.first_update != 0 && e.first_update <= id && id <= e.last_update;
+        };
+        std::vector<Copied> owned;
+        std::copy_if(events.begin(), events.end(), std::back_inserter(owned), belongs);
+        std::erase_if(events, [&](const Copied &e) {
+            if (belongs(e)) {
+                return false;
+            }
+            if (e.first_update != 0) {
+                return true;
+            }
+            return std::none_of(owned.begin(), owned.end(), [&](const Copied &o) {
+                return o.thread == e.thread && o.start <= e.start && e.end <= o.end;
+            });
+        });
+    }
+
+    out->assign(R"({"displayTimeUnit":"ms","traceEvents":[)");
+    bool first = true;
+    auto separate = [&] {
+        if (!first) {
+            out->push_back(',');
+        }
+        first = false;
+    };
+    for (size_t thread = 1; thread <= threads; ++thread) {
+        separate();
+        out->append(R"({"ph":"M","name":"thread_name","pid":1,"tid":)");
+        AppendInteger(static_cast<int64_t>(thread), out);
+        out->append(R"(,"args":{"name":"thread )");
+        AppendInteger(static_cast<int64_t>(thread), out);
+        out->append(R"("}})");
+    }
+    for (const auto &event : events) {
+        separate();
+        out->append(R"({"ph":"X","cat":"bot","pid":1,"name":)");
+        AppendJsonString(event.name, out);
+        out->append(R"(,"tid":)");
+        AppendInteger(static_cast<int64_t>(event.thread), out);
+        out->append(R"(,"ts":)");
+        AppendMicros(event.start, out);
+        out->append(R"(,"dur":)");
+        AppendMicros(event.end - event.start, out);
+        if (event.first_update != 0) {
+            out->append(R"(,"args":{"first_update_id":)");
+            AppendInteger(event.first_update, out);
+            out->append(R"(,"last_update_id":)");
+            AppendInteger(event.last_update, out);
+            out->push_back('}');
+        }
+        out->push_back('}');
+    }
+    out->append("]}");
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+
+namespace telegram {
+struct TracerConfig {
+    // Spans kept per thread; older ones are overwritten. Rounded up to a power of two.
+    size_t events_per_thread = 4096;
+    // Records the spans of one update in this many; spans outside any update, such
+    // as a long poll, are always recorded.
+    uint64_t sample_every = 1;
+};
+
+// Collects spans into a ring buffer per thread, written without locks, and exports
+// them in the Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+// Spans go to the installed tracer, so instrumented code needs no tracer at hand.
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Tracer(const TracerConfig &config = TracerConfig{});
+    // Uninstalls the tracer if it is installed. Threads still recording into it
+    // must be done by then.
+    ~Tracer();
+
+    Tracer(const Tracer &) = delete;
+    Tracer &operator=(const Tracer &) = delete;
+
+    // nullptr turns tracing off.
+    static void Install(Tracer *tracer);
+
+    static Tracer *Installed() {
+        return installed_.load(std::memory_order_acquire);
+    }
+
+    bool Sampled(int64_t update_id) const {
+        return static_cast<uint64_t>(update_id) % sample_every_ == 0;
+    }
+
+    // name must outlive the tracer, as string literals do. The span belongs to the
+    // updates first..last, or to none if first is 0.
+    void Record(const char *name, Clock::time_point start, Clock::time_point end,
+                int64_t first_update, int64_t last_update);
+
+    // The spans still in the buffers. For one update: its spans and the spans of
+    // no update nested in them on the same thread, which is where it spent its time.
+    void WriteChromeTrace(std::string *out, std::optional<int64_t> update_id = std::nullopt) const;
+
+private:
+    struct Event {
+        std::atomic<const char *> name;
+        std::atomic<int64_t> start;
+        std::atomic<int64_t> end;
+        std::atomic<int64_t> first_update;
+        std::atomic<int64_t> last_update;
+    };
+
+    // Written by its thread only; readers check head again after copying to drop
+    // events overwritten meanwhile.
+    struct Buffer {
+        std::unique_ptr<Event[]> events;
+        std::atomic<uint64_t> head = 0;
+        size_t thread;
+    };
+
+    Buffer &BufferOfThisThread();
+
+    inline static std::atomic<Tracer *> installed_ = nullptr;
+
+    const uint64_t id_;
+    const size_t capacity_;
+    const uint64_t sample_every_;
+    const Clock::time_point epoch_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+// Marks the spans of this thread as belonging to an update while it lives.
+// Work handed to other threads carries the update along (see Current()).
+class TraceScope {
+public:
+    explicit TraceScope(int64_t update_id) : previous_(current_) {
+        current_ = update_id;
+    }
+
+    ~TraceScope() {
+        current_ = previous_;
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+    // The update this thread works on, 0 if none.
+    static int64_t Current() {
+        return current_;
+    }
+
+private:
+    inline static thread_local int64_t current_ = 0;
+
+    int64_t previous_;
+};
+
+// Times a scope into the installed tracer. A no-op costing one atomic load when
+// tracing is off or the update is not sampled.
+class Span {
+public:
+    explicit Span(const char *name) : Span(name, TraceScope::Current()) {
+    }
+
+    Span(const char *name, int64_t update_id)
+        : tracer_(Tracer::Installed()), name_(name), first_(update_id), last_(update_id) {
+        if (tracer_ && !tracer_->Sampled(update_id)) {
+            tracer_ = nullptr;
+        }
+        if (tracer_) {
+            start_ = Tracer::Clock::now();
+        }
+    }
+
+    ~Span() {
+        if (tracer_) {
+            tracer_->Record(name_, start_, Tracer::Clock::now(), first_, last_);
+        }
+    }
+
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+    // For spans that learn their updates on the way, such as a getUpdates.
+    void SetUpdates(int64_t first, int64_t last) {
+        first_ = first;
+        last_ = last;
+    }
+
+private:
+    Tracer *tracer_;
+    const char *name_;
+    int64_t first_;
+    int64_t last_;
+    Tracer::Clock::time_point start_;
+};
+
+// Records a span that began before anything could time it, such as a wait in a queue.
+inline void RecordSpan(const char *name, Tracer::Clock::time_point start,
+                       int64_t update_id = TraceScope::Current()) {
+    auto *tracer = Tracer::Installed();
+    if (tracer && tracer->Sampled(update_id)) {
+        tracer->Record(name, start, Tracer::Clock::now(), update_id, update_id);
+    }
+}
+}  // namespace telegram
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <istream>
+
+namespace telegram {
+// One request/response channel. Connections are used by one thread at a time and
+// keep their buffers between exchanges.
+class Connection {
+public:
+    virtual ~Connection() = default;
+
+    struct Reply {
+        int status;
+        // Empty when the body is not compressed. Both are valid until the next call.
+        const std::string &content_encoding;
+        std::istream &body;
+    };
+
+    // Sends `path` and `body` with the given HTTP method and waits for the response headers.
+    // A non-empty accept_encoding is sent as the Accept-Encoding header.
+    virtual Reply RoundTrip(const std::string &http_method, const std::string &accept_encoding) = 0;
+
+    // Drops whatever state a failed exchange left behind.
+    virtual void Reset() = 0;
+
+    std::string path;
+    std::string body;
+};
+
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    virtual std::unique_ptr<Connection> Connect() = 0;
+};
+}  // namespace telegram
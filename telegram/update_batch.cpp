@@ -0,0 +1,36 @@
+#include "update_batch.h"
+#include "update_parser.h"
+#include <atomic>
+#include <thread>
+#include <stdexcept>
+
+std::string_view telegram::UpdateBatch::Text(size_t index) const {
+    auto &entry = entries_[index];
+    std::atomic_ref<uint8_t> state(entry.state);
+    auto current = state.load(std::memory_order_acquire);
+    while (current != kPlain) {
+        if (current == kEscaped &&
+            state.compare_exchange_weak(current, kDecoding, std::memory_order_acquire)) {
+            // The decoded text is never longer than the escaped one, so it fits in place.
+            entry.text_size = static_cast<uint32_t>(
+                UnescapeJsonString(arena_.data() + entry.text_offset, entry.text_size));
+            state.store(kPlain, std::memory_order_release);
+            break;
+        }
+        if (current == kDecoding) {
+            std::this_thread::yield();
+            current = state.load(std::memory_order_acquire);
+        }
+    }
+    return {arena_.data() + entry.text_offset, entry.text_size};
+}
+
+void telegram::UpdateBatch::Append(int64_t update_id, int64_t chat_id, int64_t message_id,
+                                   std::string_view text, int64_t date) {
+    if (arena_.size() + text.size() > UINT32_MAX) {
+        throw std::length_error("update batch arena is full");
+    }
+    entries_.push_back({update_id, chat_id, message_id, date, static_cast<uint32_t>(arena_.size()),
+                        static_cast<uint32_t>(text.size()), kPlain});
+    arena_.append(text);
+}
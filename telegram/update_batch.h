@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace telegram {
+// The updates of one getUpdates reply, sorted by update_id. The reply bytes stay in
+// one arena and every text is a view into it; a text with escapes is decoded in
+// place the first time it is read. Memory is allocated per batch, not per update.
+class UpdateBatch {
+public:
+    enum State : uint8_t { kPlain, kEscaped, kDecoding };
+
+    struct Entry {
+        int64_t update_id;
+        int64_t chat_id;
+        int64_t message_id;
+        // Unix time the message was sent, 0 if not known.
+        int64_t date;
+        // The text, or while still escaped the quoted JSON string, in the arena.
+        uint32_t text_offset;
+        uint32_t text_size;
+        // Accessed through std::atomic_ref once the batch is shared.
+        uint8_t state;
+    };
+
+    size_t Size() const {
+        return entries_.size();
+    }
+
+    bool Empty() const {
+        return entries_.empty();
+    }
+
+    const Entry &operator[](size_t index) const {
+        return entries_[index];
+    }
+
+    // Safe to call from several threads, also for the same update.
+    std::string_view Text(size_t index) const;
+
+    // Adds an update whose text is copied into the arena, for batches built by hand.
+    void Append(int64_t update_id, int64_t chat_id, int64_t message_id, std::string_view text,
+                int64_t date = 0);
+
+private:
+    friend class IndexedUpdateParser;
+
+    // Text() decodes escaped strings in place, so the arena changes under a const batch.
+    mutable std::string arena_;
+    mutable std::vector<Entry> entries_;
+};
+
+// One update of a shared batch: the ids by value, and a reference that keeps the
+// batch alive for Text(). The batch is freed with the last view of it.
+struct UpdateView {
+    UpdateView(std::shared_ptr<const UpdateBatch> from, size_t at)
+        : update_id((*from)[at].update_id),
+          chat_id((*from)[at].chat_id),
+          message_id((*from)[at].message_id),
+          date((*from)[at].date),
+          batch(std::move(from)),
+          index(at) {
+    }
+
+    std::string_view Text() const {
+        return batch->Text(index);
+    }
+
+    int64_t update_id;
+    int64_t chat_id;
+    int64_t message_id;
+    int64_t date;
+    std::shared_ptr<const UpdateBatch> batch;
+    size_t index;
+};
+}  // namespace telegram
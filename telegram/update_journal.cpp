@@ -0,0 +1,459 @@
+#include "update_journal.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <system_error>
+
+namespace {
+constexpr uint32_t kHandledMagic = 0x4a524e4c;   // "JRNL"
+constexpr uint32_t kReceivedMagic = 0x4a524356;  // "JRCV"
+// Every update received below update_id was handled.
+constexpr uint32_t kMarkMagic = 0x4a4d524b;  // "JMRK"
+constexpr size_t kInitialWindow = 256;
+
+// A received update: this header, then text_size bytes of text.
+struct ReceivedHeader {
+    int64_t update_id;
+    uint32_t magic;
+    uint32_t crc;
+    int64_t chat_id;
+    int64_t message_id;
+    int64_t date;
+    uint32_t text_size;
+    uint32_t reserved;
+};
+
+// A handled record or a mark: the update_id, the magic and their crc.
+constexpr size_t kShortRecord = offsetof(ReceivedHeader, chat_id);
+
+// The crc of a received record covers everything but itself.
+uint32_t ReceivedCrc(std::string_view record) {
+    auto crc = telegram::Crc32c(record.data(), offsetof(ReceivedHeader, crc));
+    return telegram::Crc32c(record.data() + offsetof(ReceivedHeader, chat_id),
+                            record.size() - offsetof(ReceivedHeader, chat_id), crc);
+}
+
+void AppendReceived(std::string *records, const telegram::UpdateBatch &batch, size_t index) {
+    const auto &entry = batch[index];
+    auto text = batch.Text(index);
+    ReceivedHeader header{entry.update_id, kReceivedMagic, 0, entry.chat_id, entry.message_id,
+                          entry.date, static_cast<uint32_t>(text.size()), 0};
+    auto at = records->size();
+    records->append(reinterpret_cast<const char *>(&header), sizeof header);
+    records->append(text);
+    header.crc = ReceivedCrc(std::string_view(*records).substr(at));
+    std::memcpy(records->data() + at + offsetof(ReceivedHeader, crc), &header.crc,
+                sizeof header.crc);
+}
+
+// Calls visit(magic, update_id, record) for every record of data, up to the first torn
+// or spoiled one, and returns the size of the records visited.
+template <class Visit>
+size_t Scan(std::string_view data, Visit visit) {
+    size_t at = 0;
+    while (data.size() - at >= kShortRecord) {
+        ReceivedHeader header{};
+        std::memcpy(&header, data.data() + at, kShortRecord);
+        size_t size = kShortRecord;
+        if (header.magic == kReceivedMagic) {
+            if (data.size() - at < sizeof header) {
+                break;
+            }
+            std::memcpy(&header, data.data() + at, sizeof header);
+            size = sizeof header + header.text_size;
+            if (data.size() - at < size || header.crc != ReceivedCrc(data.substr(at, size))) {
+                break;
+            }
+        } else if ((header.magic != kHandledMagic && header.magic != kMarkMagic) ||
+                   header.crc != telegram::Crc32c(&header, offsetof(ReceivedHeader, crc))) {
+            break;
+        }
+        visit(header.magic, header.update_id, data.substr(at, size));
+        at += size;
+    }
+    return at;
+}
+
+[[noreturn]] void ThrowErrno(const std::string &what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+int OpenJournal(const std::string &path, telegram::Durability durability, int flags) {
+    if (durability == telegram::Durability::kDsync) {
+        flags |= O_DSYNC;
+    }
+    int fd = ::open(path.c_str(), flags | O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ThrowErrno("open " + path);
+    }
+    return fd;
+}
+
+void WriteAll(int fd, const void *data, size_t size) {
+    const auto *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        auto written = ::write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ThrowErrno("journal write");
+        }
+        bytes += written;
+        size -= written;
+    }
+}
+}  // namespace
+
+telegram::UpdateJournal::UpdateJournal(const std::string &path, int64_t committed_offset,
+                                       const UpdateJournalConfig &config)
+    : config_(config),
+      path_(path),
+      unhandled_(std::make_shared<UpdateBatch>()),
+      poll_offset_(committed_offset),
+      ids_(kInitialWindow),
+      done_(kInitialWindow / 64),
+      next_offset_(committed_offset) {
+    fd_ = OpenJournal(path_, config_.durability, 0);
+    try {
+        Recover(committed_offset);
+    } catch (...) {
+        ::close(fd_);
+        throw;
+    }
+}
+
+telegram::UpdateJournal::~UpdateJournal() {
+    ::close(fd_);
+}
+
+bool telegram::UpdateJournal::Recovered(int64_t update_id) const {
+    std::lock_guard lock(mutex_);
+    return RecoveredLocked(update_id);
+}
+
+std::shared_ptr<const telegram::UpdateBatch> telegram::UpdateJournal::Unhandled() const {
+    return unhandled_;
+}
+
+int64_t telegram::UpdateJournal::PollOffset() const {
+    return poll_offset_;
+}
+
+bool telegram::UpdateJournal::Received(int64_t update_id) {
+    std::lock_guard lock(mutex_);
+    if (RecoveredLocked(update_id)) {
+        // Handled already, so the watermark may pass it once the ring drains.
+        next_offset_ = update_id + 1;
+        return false;
+    }
+    Register(update_id);
+    return true;
+}
+
+void telegram::UpdateJournal::Received(const UpdateBatch &batch) {
+    std::string records;
+    for (size_t i = 0; i < batch.Size(); ++i) {
+        AppendReceived(&records, batch, i);
+    }
+
+    std::unique_lock lock(mutex_);
+    for (size_t i = 0; i < batch.Size(); ++i) {
+        if (RecoveredLocked(batch[i].update_id)) {
+            next_offset_ = batch[i].update_id + 1;
+        } else {
+            Register(batch[i].update_id);
+        }
+    }
+    Append(records.data(), records.size(), batch.Size());
+    if (config_.durability == Durability::kFdatasync) {
+        Sync(lock, ++appended_);
+    }
+}
+
+void telegram::UpdateJournal::Handled(int64_t update_id) {
+    std::unique_lock lock(mutex_);
+    auto record = MakeRecord(update_id, kHandledMagic);
+    Append(&record, sizeof record, 1);
+    if (config_.durability != Durability::kFdatasync) {
+        MarkDone(update_id);
+        return;
+    }
+    unsynced_.push_back(update_id);
+    Sync(lock, ++appended_);
+}
+
+void telegram::UpdateJournal::Sync(std::unique_lock<std::mutex> &lock, uint64_t record) {
+    while (synced_ < record) {
+        if (syncing_) {
+            synced_changed_.wait(lock);
+            continue;
+        }
+        // This thread syncs for every record appended so far, its own included.
+        syncing_ = true;
+        auto group = std::move(unsynced_);
+        unsynced_.clear();
+        auto target = appended_;
+        auto fd = fd_;
+        lock.unlock();
+        auto result = ::fdatasync(fd);
+        auto error = errno;
+        lock.lock();
+        syncing_ = false;
+        if (result != 0) {
+            // The records are still owed a sync; a thread waiting for one retries.
+            unsynced_.insert(unsynced_.begin(), group.begin(), group.end());
+            synced_changed_.notify_all();
+            throw std::system_error(error, std::generic_category(), "journal fdatasync");
+        }
+        synced_ = target;
+        for (auto id : group) {
+            MarkDone(id);
+        }
+        synced_changed_.notify_all();
+    }
+}
+
+int64_t telegram::UpdateJournal::Watermark() const {
+    std::lock_guard lock(mutex_);
+    return WatermarkLocked();
+}
+
+void telegram::UpdateJournal::Checkpoint(int64_t committed_offset) {
+    std::unique_lock lock(mutex_);
+    recovered_.erase(recovered_.begin(),
+                     std::lower_bound(recovered_.begin(), recovered_.end(), committed_offset));
+    // Updates in flight keep their records, so behind a stuck handler the journal
+    // stays big; it is compacted again once it has doubled.
+    if (records_ < std::max(config_.compact_after, 2 * compacted_)) {
+        return;
+    }
+    synced_changed_.wait(lock, [this] { return !syncing_; });
+    Compact(committed_offset);
+}
+
+size_t telegram::UpdateJournal::Records() const {
+    std::lock_guard lock(mutex_);
+    return records_;
+}
+
+telegram::UpdateJournal::Record telegram::UpdateJournal::MakeRecord(int64_t update_id,
+                                                                     uint32_t magic) {
+    Record record{update_id, magic, 0};
+    record.crc = Crc32c(&record, offsetof(Record, crc));
+    return record;
+}
+
+void telegram::UpdateJournal::Recover(int64_t committed_offset) {
+    // Reads up to the first torn or spoiled record and cuts the file there, so new
+    // records follow the last good one.
+    auto data = ReadAll();
+    std::vector<std::pair<int64_t, std::string_view>> received;
+    auto valid = Scan(data, [&](uint32_t magic, int64_t update_id, std::string_view record) {
+        ++records_;
+        if (magic == kMarkMagic) {
+            handled_below_ = std::max(handled_below_, update_id);
+            poll_offset_ = std::max(poll_offset_, update_id);
+            return;
+        }
+        poll_offset_ = std::max(poll_offset_, update_id + 1);
+        if (update_id < committed_offset) {
+            return;
+        }
+        if (magic == kReceivedMagic) {
+            received.emplace_back(update_id, record);
+        } else {
+            recovered_.push_back(update_id);
+        }
+    });
+    if (::ftruncate(fd_, valid) != 0 || ::lseek(fd_, valid, SEEK_SET) < 0) {
+        ThrowErrno("truncate " + path_);
+    }
+
+    std::sort(recovered_.begin(), recovered_.end());
+    recovered_.erase(std::unique(recovered_.begin(), recovered_.end()), recovered_.end());
+
+    // The updates received and not handled are in flight again, and hold back the
+    // watermark until they are handled.
+    auto by_id = [](const auto &left, const auto &right) { return left.first < right.first; };
+    std::stable_sort(received.begin(), received.end(), by_id);
+    auto same_id = [](const auto &left, const auto &right) { return left.first == right.first; };
+    received.erase(std::unique(received.begin(), received.end(), same_id), received.end());
+    for (auto [update_id, record] : received) {
+        if (RecoveredLocked(update_id)) {
+            continue;
+        }
+        ReceivedHeader header;
+        std::memcpy(&header, record.data(), sizeof header);
+        unhandled_->Append(header.update_id, header.chat_id, header.message_id,
+                           record.substr(sizeof header), header.date);
+        Register(update_id);
+    }
+    next_offset_ = poll_offset_;
+}
+
+std::string telegram::UpdateJournal::ReadAll() const {
+    std::string data;
+    char chunk[65536];
+    while (true) {
+        auto got = ::pread(fd_, chunk, sizeof chunk, data.size());
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ThrowErrno("read " + path_);
+        }
+        if (got == 0) {
+            return data;
+        }
+        data.append(chunk, got);
+    }
+}
+
+void telegram::UpdateJournal::Append(const void *records, size_t size, size_t count) {
+    WriteAll(fd_, records, size);
+    records_ += count;
+}
+
+bool telegram::UpdateJournal::RecoveredLocked(int64_t update_id) const {
+    return update_id < handled_below_ ||
+           std::binary_search(recovered_.begin(), recovered_.end(), update_id);
+}
+
+void telegram::UpdateJournal::Register(int64_t update_id) {
+    if (tail_ - head_ == ids_.size()) {
+        Grow();
+    }
+    auto mask = ids_.size() - 1;
+    ids_[tail_ & mask] = update_id;
+    done_[(tail_ & mask) / 64] &= ~(uint64_t{1} << (tail_ % 64));
+    ++tail_;
+    next_offset_ = update_id + 1;
+}
+
+size_t telegram::UpdateJournal::Find(int64_t update_id) const {
+    // Ids grow with the arrival sequence, so the update is found by bisection.
+    auto mask = ids_.size() - 1;
+    size_t low = head_;
+    size_t high = tail_;
+    while (low < high) {
+        auto middle = low + (high - low) / 2;
+        if (ids_[middle & mask] < update_id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < tail_ && ids_[low & mask] == update_id ? low : tail_;
+}
+
+void telegram::UpdateJournal::MarkDone(int64_t update_id) {
+    auto sequence = Find(update_id);
+    if (sequence == tail_) {
+        return;
+    }
+    done_[(sequence & (ids_.size() - 1)) / 64] |= uint64_t{1} << (sequence % 64);
+    while (head_ < tail_ && IsDone(head_)) {
+        ++head_;
+    }
+}
+
+void telegram::UpdateJournal::Compact(int64_t committed_offset) {
+    // The new journal keeps what the old one says past the committed offset: a mark
+    // for the updates below the watermark, all handled, then the updates handled
+    // past it, recovered, out of order or waiting for a sync, and the received
+    // records of the updates still in flight. It is written beside the old one and
+    // renamed over it.
+    std::string keep;
+    size_t count = 0;
+    auto keep_handled = [&](int64_t update_id, uint32_t magic) {
+        auto record = MakeRecord(update_id, magic);
+        keep.append(reinterpret_cast<const char *>(&record), sizeof record);
+        ++count;
+    };
+    auto watermark = WatermarkLocked();
+    if (watermark > committed_offset) {
+        keep_handled(watermark, kMarkMagic);
+    }
+    for (auto update_id : recovered_) {
+        if (update_id >= watermark) {
+            keep_handled(update_id, kHandledMagic);
+        }
+    }
+    auto mask = ids_.size() - 1;
+    for (auto sequence = head_; sequence < tail_; ++sequence) {
+        if (IsDone(sequence)) {
+            keep_handled(ids_[sequence & mask], kHandledMagic);
+        }
+    }
+    for (auto update_id : unsynced_) {
+        keep_handled(update_id, kHandledMagic);
+    }
+    auto data = ReadAll();
+    Scan(data, [&](uint32_t magic, int64_t update_id, std::string_view record) {
+        if (magic != kReceivedMagic) {
+            return;
+        }
+        auto sequence = Find(update_id);
+        if (sequence != tail_ && !IsDone(sequence)) {
+            keep.append(record);
+            ++count;
+        }
+    });
+
+    auto temp = path_ + ".tmp";
+    int fd = OpenJournal(temp, config_.durability, O_TRUNC);
+    try {
+        WriteAll(fd, keep.data(), keep.size());
+        if (config_.durability != Durability::kNone && ::fsync(fd) != 0) {
+            ThrowErrno("fsync " + temp);
+        }
+        if (::rename(temp.c_str(), path_.c_str()) != 0) {
+            ThrowErrno("rename " + temp);
+        }
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd_);
+    fd_ = fd;
+    records_ = count;
+    compacted_ = count;
+
+    // The new journal is synced, so the records waiting for a sync are on disk.
+    synced_ = appended_;
+    for (auto update_id : unsynced_) {
+        MarkDone(update_id);
+    }
+    unsynced_.clear();
+    synced_changed_.notify_all();
+}
+
+int64_t telegram::UpdateJournal::WatermarkLocked() const {
+    return head_ < tail_ ? ids_[head_ & (ids_.size() - 1)] : next_offset_;
+}
+
+bool telegram::UpdateJournal::IsDone(size_t sequence) const {
+    auto at = sequence & (ids_.size() - 1);
+    return done_[at / 64] >> (sequence % 64) & 1;
+}
+
+void telegram::UpdateJournal::Grow() {
+    std::vector<int64_t> ids(ids_.size() * 2);
+    std::vector<uint64_t> done(done_.size() * 2);
+    auto old_mask = ids_.size() - 1;
+    auto mask = ids.size() - 1;
+    for (auto sequence = head_; sequence < tail_; ++sequence) {
+        ids[sequence & mask] = ids_[sequence & old_mask];
+        if (IsDone(sequence)) {
+            done[(sequence & mask) / 64] |= uint64_t{1} << (sequence % 64);
+        }
+    }
+    ids_ = std::move(ids);
+    done_ = std::move(done);
+}
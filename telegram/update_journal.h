@@ -0,0 +1,131 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
+#include "offset_store.h"
+#include "update_batch.h"
+
+namespace telegram {
+struct UpdateJournalConfig {
+    Durability durability = Durability::kFdatasync;
+    // Checkpoint() rewrites the journal once this many records have been appended,
+    // which bounds the recovery time.
+    size_t compact_after = 4096;
+};
+
+// Lets the offset be committed only after updates are handled, without handling
+// any of them twice. Received updates and handled update ids are appended to a
+// journal; the offset to commit is the oldest received update that is still being
+// handled. getUpdates may confirm an update as soon as it is on disk. After a crash
+// the journal gives back the updates received but not handled, and tells which of
+// the updates past the committed offset were handled already.
+//
+// A handler that never returns (std::abort) has to call Handled() itself first.
+class UpdateJournal {
+public:
+    // committed_offset is the offset the store holds; journal records below it are
+    // not needed and are skipped.
+    UpdateJournal(const std::string &path, int64_t committed_offset,
+                  const UpdateJournalConfig &config = {});
+    ~UpdateJournal();
+
+    UpdateJournal(const UpdateJournal &) = delete;
+    UpdateJournal &operator=(const UpdateJournal &) = delete;
+
+    // True for an update handled before the restart.
+    bool Recovered(int64_t update_id) const;
+
+    // Updates received before the restart and not handled, in update_id order. They
+    // count as received already.
+    std::shared_ptr<const UpdateBatch> Unhandled() const;
+
+    // Where getUpdates resumes: past every update the journal knows of.
+    int64_t PollOffset() const;
+
+    // Call for every update received, in update_id order. Returns false for an
+    // update handled before the restart, which must be skipped.
+    bool Received(int64_t update_id);
+
+    // Receives the updates of a batch, as above, and journals them with their texts.
+    // Returns once they are on disk, sharing the fdatasync with Handled(). Updates
+    // handled before the restart stay handled; skip them with Recovered().
+    void Received(const UpdateBatch &batch);
+
+    // Call once the update is handled; safe from any thread. Returns once the record
+    // is on disk. Threads that call at the same time share one fdatasync: records
+    // are appended under the lock and synced outside it, and each update counts as
+    // done only after the sync that covers its record.
+    void Handled(int64_t update_id);
+
+    // Every received update below this offset has been handled.
+    int64_t Watermark() const;
+
+    // Drops what an already committed offset makes redundant and compacts the
+    // journal when it has grown past compact_after records. Updates still being
+    // handled keep their records, so a stuck handler holds back the offset but not
+    // the compaction.
+    void Checkpoint(int64_t committed_offset);
+
+    size_t Records() const;
+
+private:
+    struct Record {
+        int64_t update_id;
+        uint32_t magic;
+        uint32_t crc;
+    };
+
+    static Record MakeRecord(int64_t update_id, uint32_t magic);
+
+    void Recover(int64_t committed_offset);
+    std::string ReadAll() const;
+    void Append(const void *records, size_t size, size_t count);
+    // Returns once the records appended so far, up to `record`, are on disk.
+    void Sync(std::unique_lock<std::mutex> &lock, uint64_t record);
+    bool RecoveredLocked(int64_t update_id) const;
+    void Register(int64_t update_id);
+    // The arrival sequence of an update in flight, tail_ if there is none.
+    size_t Find(int64_t update_id) const;
+    void MarkDone(int64_t update_id);
+    void Compact(int64_t committed_offset);
+    int64_t WatermarkLocked() const;
+    bool IsDone(size_t sequence) const;
+    void Grow();
+
+    const UpdateJournalConfig config_;
+    const std::string path_;
+    int fd_ = -1;
+
+    mutable std::mutex mutex_;
+    size_t records_ = 0;
+    // Records the last compaction kept.
+    size_t compacted_ = 0;
+    // Updates handled before the restart: every one received below handled_below_,
+    // and the ones in recovered_, sorted.
+    int64_t handled_below_ = 0;
+    std::vector<int64_t> recovered_;
+    std::shared_ptr<UpdateBatch> unhandled_;
+    int64_t poll_offset_;
+    // Updates in flight, in arrival order: a ring of ids and a bitmap of the ones
+    // handled. Positions are arrival sequence numbers, so gaps between update ids
+    // cost nothing.
+    std::vector<int64_t> ids_;
+    std::vector<uint64_t> done_;
+    size_t head_ = 0;
+    size_t tail_ = 0;
+    int64_t next_offset_;
+
+    // Group commit: records appended and synced so far, and the updates whose
+    // records wait for the next fdatasync. Compaction waits while one runs, since
+    // it replaces fd_.
+    uint64_t appended_ = 0;
+    uint64_t synced_ = 0;
+    std::vector<int64_t> unsynced_;
+    bool syncing_ = false;
+    std::condition_variable synced_changed_;
+};
+}  // namespace telegram
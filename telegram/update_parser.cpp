@@ -0,0 +1,598 @@
+#include "update_parser.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <string_view>
+#include <Poco/JSON/Parser.h>
+
+namespace {
+using Traits = std::char_traits<char>;
+
+template <class Out>
+void AppendUtf8(uint32_t code_point, Out *out) {
+    if (code_point < 0x80) {
+        out->push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+        out->push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+        out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else if (code_point < 0x10000) {
+        out->push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+        out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+        out->push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+        out->push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+}
+
+// Pull parser over the raw stream buffer: one character at a time, no lookahead
+// beyond sgetc(), so it works on a socket or inflating stream as well as on a string.
+class Reader {
+public:
+    explicit Reader(std::istream &is) : buf_(is.rdbuf()) {
+    }
+
+    explicit Reader(std::streambuf *buf) : buf_(buf) {
+    }
+
+    int Peek() {
+        return buf_->sgetc();
+    }
+
+    int Next() {
+        return buf_->sbumpc();
+    }
+
+    void SkipSpace() {
+        for (auto c = Peek(); c == ' ' || c == '\n' || c == '\r' || c == '\t'; c = Peek()) {
+            Next();
+        }
+    }
+
+    void Expect(char expected) {
+        SkipSpace();
+        if (Next() != Traits::to_int_type(expected)) {
+            Fail(std::string("expected '") + expected + "'");
+        }
+    }
+
+    bool Consume(char expected) {
+        SkipSpace();
+        if (Peek() != Traits::to_int_type(expected)) {
+            return false;
+        }
+        Next();
+        return true;
+    }
+
+    // Calls on_member(key) with the stream positioned at each member's value;
+    // on_member must consume the value. The key shares one buffer with nested
+    // objects, so it is only valid until the value is read.
+    template <class F>
+    void ForEachMember(F &&on_member) {
+        Expect('{');
+        if (Consume('}')) {
+            return;
+        }
+        do {
+            Expect('"');
+            ReadStringBody(&key_);
+            Expect(':');
+            on_member(std::string_view(key_));
+        } while (Consume(','));
+        Expect('}');
+    }
+
+    template <class F>
+    void ForEachElement(F &&on_element) {
+        Expect('[');
+        if (Consume(']')) {
+            return;
+        }
+        do {
+            on_element();
+        } while (Consume(','));
+        Expect(']');
+    }
+
+    int64_t ReadInteger() {
+        SkipSpace();
+        bool negative = Peek() == '-';
+        if (negative) {
+            Next();
+        }
+        uint64_t value = 0;
+        int digits = 0;
+        for (auto c = Peek(); c >= '0' && c <= '9'; c = Peek()) {
+            value = value * 10 + static_cast<uint64_t>(c - '0');
+            ++digits;
+            Next();
+        }
+        if (digits == 0 || digits > 19) {
+            Fail("expected an integer");
+        }
+        return negative ? -static_cast<int64_t>(value) : static_cast<int64_t>(value);
+    }
+
+    template <class Out>
+    void ReadString(Out *out) {
+        Expect('"');
+        ReadStringBody(out);
+    }
+
+    // Skips one value of any type without decoding it.
+    void SkipValue() {
+        SkipSpace();
+        int depth = 0;
+        do {
+            switch (auto c = Next()) {
+                case '"':
+                    SkipStringBody();
+                    break;
+                case '{':
+                case '[':
+                    ++depth;
+                    break;
+                case '}':
+                case ']':
+                    if (--depth < 0) {
+                        Fail("unbalanced brackets");
+                    }
+                    break;
+                case Traits::eof():
+                    Fail("unexpected end of input");
+                    break;
+                default:
+                    // Numbers, true, false and null run up to the next delimiter.
+                    if (depth == 0) {
+                        for (c = Peek(); !IsDelimiter(c); c = Peek()) {
+                            Next();
+                        }
+                    }
+            }
+        } while (depth > 0);
+    }
+
+    [[noreturn]] static void Fail(const std::string &what) {
+        throw telegram::ParseError("malformed getUpdates reply: " + what);
+    }
+
+private:
+    static bool IsDelimiter(int c) {
+        return c == ',' || c == '}' || c == ']' || c == ' ' || c == '\n' || c == '\r' ||
+               c == '\t' || c == Traits::eof();
+    }
+
+    template <class Out>
+    void ReadStringBody(Out *out) {
+        out->clear();
+        for (;;) {
+            auto c = Next();
+            if (c == '"') {
+                return;
+            }
+            if (c == Traits::eof()) {
+                Fail("unterminated string");
+            }
+            if (c != '\\') {
+                out->push_back(Traits::to_char_type(c));
+                continue;
+            }
+            switch (c = Next()) {
+                case '"':
+                case '\\':
+                case '/':
+                    out->push_back(Traits::to_char_type(c));
+                    break;
+                case 'b':
+                    out->push_back('\b');
+                    break;
+                case 'f':
+                    out->push_back('\f');
+                    break;
+                case 'n':
+                    out->push_back('\n');
+                    break;
+                case 'r':
+                    out->push_back('\r');
+                    break;
+                case 't':
+                    out->push_back('\t');
+                    break;
+                case 'u':
+                    AppendUtf8(ReadCodePoint(), out);
+                    break;
+                default:
+                    Fail("invalid escape");
+            }
+        }
+    }
+
+    void SkipStringBody() {
+        for (auto c = Next(); c != '"'; c = Next()) {
+            if (c == '\\') {
+                c = Next();
+            }
+            if (c == Traits::eof()) {
+                Fail("unterminated string");
+            }
+        }
+    }
+
+    uint32_t ReadHex4() {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            auto c = Next();
+            value <<= 4;
+            if (c >= '0' && c <= '9') {
+                value |= static_cast<uint32_t>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                value |= static_cast<uint32_t>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                value |= static_cast<uint32_t>(c - 'A' + 10);
+            } else {
+                Fail("invalid \\u escape");
+            }
+        }
+        return value;
+    }
+
+    // Called after "\u"; joins UTF-16 surrogate pairs.
+    uint32_t ReadCodePoint() {
+        auto unit = ReadHex4();
+        if (unit < 0xD800 || unit > 0xDFFF) {
+            return unit;
+        }
+        if (unit > 0xDBFF || Next() != '\\' || Next() != 'u') {
+            Fail("unpaired surrogate");
+        }
+        auto low = ReadHex4();
+        if (low < 0xDC00 || low > 0xDFFF) {
+            Fail("unpaired surrogate");
+        }
+        return 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+    }
+
+    std::streambuf *buf_;
+    std::string key_;
+};
+
+// Writes decoded text over the escaped text it was read from; never overtakes the reader.
+struct InPlaceWriter {
+    void clear() {
+        end = begin;
+    }
+
+    void push_back(char c) {
+        *end++ = c;
+    }
+
+    char *begin;
+    char *end;
+};
+
+// Reads a string in place, without copying it.
+class SpanBuf : public std::streambuf {
+public:
+    explicit SpanBuf(std::string_view span) {
+        auto *begin = const_cast<char *>(span.data());
+        setg(begin, begin, begin + span.size());
+    }
+};
+
+// Walks a structural index the way Reader walks a stream. Scalars have no entry of
+// their own: their text is what lies between the previous entry and the next one.
+class IndexCursor {
+public:
+    IndexCursor(std::string_view json, const std::vector<uint32_t> &index)
+        : json_(json), index_(index) {
+    }
+
+    bool Consume(char expected) {
+        if (next_ == index_.size() || json_[index_[next_]] != expected) {
+            return false;
+        }
+        ++next_;
+        return true;
+    }
+
+    void Expect(char expected) {
+        if (!Consume(expected)) {
+            Fail(std::string("expected '") + expected + "'");
+        }
+    }
+
+    template <class F>
+    void ForEachMember(F &&on_member) {
+        Expect('{');
+        if (Consume('}')) {
+            return;
+        }
+        do {
+            auto key = StringToken();
+            Expect(':');
+            on_member(key.substr(1, key.size() - 2));
+        } while (Consume(','));
+        Expect('}');
+    }
+
+    template <class F>
+    void ForEachElement(F &&on_element) {
+        Expect('[');
+        if (Consume(']')) {
+            return;
+        }
+        do {
+            on_element();
+        } while (Consume(','));
+        Expect(']');
+    }
+
+    int64_t ReadInteger() {
+        auto text = ScalarText();
+        int64_t value = 0;
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (text.empty() || error != std::errc{} || end != text.data() + text.size()) {
+            Fail("expected an integer");
+        }
+        return value;
+    }
+
+    void ReadString(std::string *out) {
+        auto token = StringToken();
+        if (std::memchr(token.data(), '\\', token.size()) == nullptr) {
+            out->assign(token.data() + 1, token.size() - 2);
+            return;
+        }
+        SpanBuf escaped(token);
+        Reader(&escaped).ReadString(out);
+    }
+
+    // Records where the text is instead of decoding it.
+    void ReadText(telegram::UpdateBatch::Entry *entry) {
+        auto token = StringToken();
+        auto offset = static_cast<uint32_t>(token.data() - json_.data());
+        if (std::memchr(token.data(), '\\', token.size()) == nullptr) {
+            entry->text_offset = offset + 1;
+            entry->text_size = static_cast<uint32_t>(token.size() - 2);
+            entry->state = telegram::UpdateBatch::kPlain;
+        } else {
+            entry->text_offset = offset;
+            entry->text_size = static_cast<uint32_t>(token.size());
+            entry->state = telegram::UpdateBatch::kEscaped;
+        }
+    }
+
+    void SkipValue() {
+        if (!ScalarText().empty()) {
+            return;
+        }
+        if (Consume('"')) {
+            return;
+        }
+        int depth = 0;
+        do {
+            if (next_ == index_.size()) {
+                Fail("unexpected end of input");
+            }
+            switch (json_[index_[next_++]]) {
+                case '{':
+                case '[':
+                    ++depth;
+                    break;
+                case '}':
+                case ']':
+                    if (--depth < 0) {
+                        Fail("unbalanced brackets");
+                    }
+                    break;
+                case ',':
+                case ':':
+                case '"':
+                    if (depth == 0) {
+                        Fail("expected a value");
+                    }
+                    break;
+            }
+        } while (depth > 0);
+    }
+
+private:
+    [[noreturn]] static void Fail(const std::string &what) {
+        Reader::Fail(what);
+    }
+
+    size_t NextPosition() const {
+        return next_ == index_.size() ? json_.size() : index_[next_];
+    }
+
+    // The text of a scalar value that follows the last consumed entry, or empty.
+    std::string_view ScalarText() const {
+        auto begin = next_ == 0 ? 0 : index_[next_ - 1] + 1;
+        auto text = json_.substr(begin, NextPosition() - begin);
+        auto first = text.find_first_not_of(" \t\r\n");
+        if (first == std::string_view::npos) {
+            return {};
+        }
+        return text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+    }
+
+    // A string from its opening to its closing quote: the last quote before the next entry.
+    std::string_view StringToken() {
+        if (next_ == index_.size() || json_[index_[next_]] != '"') {
+            Fail("expected a string");
+        }
+        auto begin = index_[next_++];
+        auto end = json_.rfind('"', NextPosition() - 1);
+        if (end == begin) {
+            Fail("unterminated string");
+        }
+        return json_.substr(begin, end - begin + 1);
+    }
+
+    std::string_view json_;
+    const std::vector<uint32_t> &index_;
+    size_t next_ = 0;
+};
+
+template <class Source>
+void ReadText(Source *reader, telegram::Client::Update *update) {
+    reader->ReadString(&update->message);
+}
+
+void ReadText(IndexCursor *cursor, telegram::UpdateBatch::Entry *entry) {
+    cursor->ReadText(entry);
+}
+
+template <class Source, class Update>
+void ParseMessage(Source *reader, Update *update) {
+    reader->ForEachMember([&](std::string_view key) {
+        if (key == "message_id") {
+            update->message_id = reader->ReadInteger();
+        } else if (key == "date") {
+            if constexpr (requires { update->date; }) {
+                update->date = reader->ReadInteger();
+            } else {
+                reader->SkipValue();
+            }
+        } else if (key == "text") {
+            ReadText(reader, update);
+        } else if (key == "chat") {
+            reader->ForEachMember([&](std::string_view chat_key) {
+                if (chat_key == "id") {
+                    update->chat_id = reader->ReadInteger();
+                } else {
+                    reader->SkipValue();
+                }
+            });
+        } else {
+            reader->SkipValue();
+        }
+    });
+}
+
+// One Update object; appended only if it carries a message.
+template <class Source, class Update>
+void ParseUpdate(Source &reader, std::vector<Update> *updates) {
+    Update update{};
+    bool has_message = false;
+    reader.ForEachMember([&](std::string_view key) {
+        if (key == "update_id") {
+            update.update_id = reader.ReadInteger();
+        } else if (key == "message") {
+            has_message = true;
+            ParseMessage(&reader, &update);
+        } else {
+            reader.SkipValue();
+        }
+    });
+    if (has_message) {
+        updates->push_back(std::move(update));
+    }
+}
+
+template <class Source, class Update>
+void ParseUpdateList(Source &reader, std::vector<Update> *updates) {
+    reader.ForEachMember([&](std::string_view key) {
+        if (key != "result") {
+            reader.SkipValue();
+            return;
+        }
+        reader.ForEachElement([&] { ParseUpdate(reader, updates); });
+    });
+}
+}  // namespace
+
+void telegram::ParseUpdates(std::istream &is, std::vector<Client::Update> *updates) {
+    Reader reader(is);
+    ParseUpdateList(reader, updates);
+}
+
+size_t telegram::UnescapeJsonString(char *quoted, size_t size) {
+    SpanBuf escaped(std::string_view(quoted, size));
+    InPlaceWriter out{quoted, quoted};
+    Reader(&escaped).ReadString(&out);
+    return static_cast<size_t>(out.end - out.begin);
+}
+
+void telegram::IndexedUpdateParser::ReadAll(std::istream &is, std::string *buffer) {
+    constexpr size_t kChunk = 16384;
+    buffer->clear();
+    while (is) {
+        auto size = buffer->size();
+        buffer->resize(size + kChunk);
+        is.read(buffer->data() + size, kChunk);
+        buffer->resize(size + static_cast<size_t>(is.gcount()));
+    }
+}
+
+void telegram::IndexedUpdateParser::Parse(std::istream &is, std::vector<Client::Update> *updates) {
+    ReadAll(is, &buffer_);
+    Parse(std::string_view(buffer_), updates);
+}
+
+void telegram::IndexedUpdateParser::Parse(std::istream &is, UpdateBatch *batch) {
+    Read(is, batch);
+    Parse(batch);
+}
+
+void telegram::IndexedUpdateParser::Read(std::istream &is, UpdateBatch *batch) {
+    ReadAll(is, &batch->arena_);
+}
+
+void telegram::IndexedUpdateParser::Parse(UpdateBatch *batch) {
+    BuildStructuralIndex(batch->arena_, &index_, level_);
+    IndexCursor cursor(batch->arena_, index_);
+    batch->entries_.clear();
+    ParseUpdateList(cursor, &batch->entries_);
+
+    auto by_id = [](const auto &l, const auto &r) { return l.update_id < r.update_id; };
+    if (!std::is_sorted(batch->entries_.begin(), batch->entries_.end(), by_id)) {
+        std::stable_sort(batch->entries_.begin(), batch->entries_.end(), by_id);
+    }
+}
+
+void telegram::IndexedUpdateParser::ParseWebhook(std::istream &is, UpdateBatch *batch) {
+    ReadAll(is, &batch->arena_);
+    BuildStructuralIndex(batch->arena_, &index_, level_);
+    IndexCursor cursor(batch->arena_, index_);
+    batch->entries_.clear();
+    ParseUpdate(cursor, &batch->entries_);
+}
+
+void telegram::IndexedUpdateParser::Parse(std::string_view json,
+                                          std::vector<Client::Update> *updates) {
+    BuildStructuralIndex(json, &index_, level_);
+    IndexCursor cursor(json, index_);
+    ParseUpdateList(cursor, updates);
+}
+
+void telegram::ParseUpdatesDom(std::istream &is, std::vector<Client::Update> *updates) {
+    Poco::JSON::Parser parser;
+    auto object = parser.parse(is).extract<Poco::JSON::Object::Ptr>();
+    auto arr = object->getArray("result");
+    for (auto &var : *arr) {
+        Client::Update update;
+        auto entry_ptr = var.extract<Poco::JSON::Object::Ptr>();
+        auto message = entry_ptr->get("message");
+        if (message.isEmpty()) {
+            continue;
+        }
+        auto message_ptr = message.extract<Poco::JSON::Object::Ptr>();
+        auto tmp = entry_ptr->get("update_id");
+        update.update_id = tmp.convert<int64_t>();
+        auto tmp1 = message_ptr->getObject("chat");
+        auto id_var = tmp1->get("id");
+        update.chat_id = id_var.convert<int64_t>();
+        auto tmp2 = message_ptr->get("message_id");
+        update.message_id = tmp2.convert<int64_t>();
+        auto tmp3 = message_ptr->get("text");
+        if (!tmp3.isEmpty()) {
+            update.message = tmp3.convert<std::string>();
+        }
+
+        updates->push_back(std::move(update));
+    }
+}
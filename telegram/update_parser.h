@@ -0,0 +1,50 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "client.h"
+#include "structural_index.h"
+#include "update_batch.h"
+
+namespace telegram {
+// Reads a getUpdates reply straight from the stream into Updates, one pass and no
+// DOM: only the fields Client::Update has are decoded, everything else is skipped.
+// Entries without a "message" are left out. Throws ParseError on malformed input.
+void ParseUpdates(std::istream &is, std::vector<Client::Update> *updates);
+
+// Same result, decoded from a structural index of the whole reply (see
+// BuildStructuralIndex). Reuses its buffers between calls, so one instance must
+// not be used from several threads at once.
+class IndexedUpdateParser {
+public:
+    explicit IndexedUpdateParser(SimdLevel level = DetectSimdLevel()) : level_(level) {
+    }
+
+    void Parse(std::istream &is, std::vector<Client::Update> *updates);
+    void Parse(std::string_view json, std::vector<Client::Update> *updates);
+    // The reply becomes the batch's arena; texts are left escaped until read.
+    void Parse(std::istream &is, UpdateBatch *batch);
+    // The same in two steps, to time reading the reply apart from parsing it.
+    static void Read(std::istream &is, UpdateBatch *batch);
+    void Parse(UpdateBatch *batch);
+    // A webhook request body: one Update object rather than a getUpdates reply.
+    // The batch is left empty for an update without a message.
+    void ParseWebhook(std::istream &is, UpdateBatch *batch);
+
+private:
+    static void ReadAll(std::istream &is, std::string *buffer);
+
+    const SimdLevel level_;
+    std::string buffer_;
+    std::vector<uint32_t> index_;
+};
+
+// Decodes the JSON string quoted[0..size), quotes included, over itself and returns
+// the length of the decoded text, which starts at quoted[0].
+size_t UnescapeJsonString(char *quoted, size_t size);
+
+// Same result through a Poco::JSON DOM. Kept as the reference for tests and benchmarks.
+void ParseUpdatesDom(std::istream &is, std::vector<Client::Update> *updates);
+}  // namespace telegram
@@ -0,0 +1,168 @@
+#include "watchdog.h"
+#include <execinfo.h>
+#include <cerrno>
+#include <cstdlib>
+#include <system_error>
+
+namespace {
+std::atomic<uint64_t> next_watchdog_id = 1;
+
+// A thread busy on another core or descheduled may take a while to take the signal.
+constexpr std::chrono::milliseconds kStackTimeout{100};
+
+int64_t NanosOf(telegram::Watchdog::Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+}  // namespace
+
+telegram::Watchdog::Watchdog(const WatchdogConfig &config,
+                             std::function<void(const Overrun &)> on_overrun)
+    : id_(next_watchdog_id.fetch_add(1)), config_(config), on_overrun_(std::move(on_overrun)) {
+    if (config_.capture_stacks) {
+        // The first backtrace() loads libgcc, which allocates; a signal handler must not.
+        void *frame;
+        backtrace(&frame, 1);
+
+        struct sigaction action {};
+        action.sa_handler = OnStackSignal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(config_.stack_signal, &action, nullptr) != 0) {
+            throw std::system_error(errno, std::generic_category(), "watchdog sigaction");
+        }
+    }
+    thread_ = std::thread([this] { Work(); });
+}
+
+telegram::Watchdog::~Watchdog() {
+    auto *self = this;
+    installed_.compare_exchange_strong(self, nullptr);
+    {
+        std::lock_guard lock(stop_mutex_);
+        stopping_ = true;
+    }
+    stop_changed_.notify_one();
+    thread_.join();
+}
+
+void telegram::Watchdog::Install(Watchdog *watchdog) {
+    installed_.store(watchdog, std::memory_order_release);
+}
+
+const std::shared_ptr<telegram::Watchdog::Slot> &telegram::Watchdog::SlotOfThisThread() {
+    // One entry is enough: a thread is watched by the installed watchdog only.
+    thread_local uint64_t cached_id = 0;
+    thread_local std::shared_ptr<Slot> cached;
+    if (cached_id == id_) {
+        return cached;
+    }
+
+    std::lock_guard lock(slots_mutex_);
+    cached = std::make_shared<Slot>();
+    cached->thread = std::this_thread::get_id();
+    cached->handle = pthread_self();
+    slots_.push_back(cached);
+    cached_id = id_;
+    return cached;
+}
+
+void telegram::Watchdog::OnStackSignal(int) {
+    if (auto *slot = running_) {
+        slot->frame_count = backtrace(slot->frames, kMaxFrames);
+        slot->stack_taken.store(true, std::memory_order_release);
+    }
+}
+
+std::string telegram::Watchdog::CaptureStack(Slot *slot, uint64_t run) {
+    slot->stack_taken.store(false, std::memory_order_relaxed);
+    if (pthread_kill(slot->handle, config_.stack_signal) != 0) {
+        return {};
+    }
+    // The handler may return meanwhile; then there is no stack worth having.
+    auto deadline = Clock::now() + kStackTimeout;
+    while (!slot->stack_taken.load(std::memory_order_acquire)) {
+        if (Clock::now() > deadline || slot->run.load(std::memory_order_acquire) != run) {
+            return {};
+        }
+        std::this_thread::yield();
+    }
+
+    std::string stack;
+    // Frame 0 is the signal handler, frame 1 the signal trampoline.
+    char **symbols = backtrace_symbols(slot->frames, slot->frame_count);
+    for (int i = 2; symbols && i < slot->frame_count; ++i) {
+        stack.append(symbols[i]).push_back('\n');
+    }
+    std::free(symbols);
+    return stack;
+}
+
+void telegram::Watchdog::Work() {
+    std::vector<Overrun> overruns;
+    std::unique_lock lock(stop_mutex_);
+    while (!stopping_) {
+        stop_changed_.wait_for(lock, config_.period, [this] { return stopping_; });
+        lock.unlock();
+
+        overruns.clear();
+        auto now = NanosOf(Clock::now());
+        {
+            std::lock_guard slots_lock(slots_mutex_);
+            for (auto &slot : slots_) {
+                auto run = slot->run.load(std::memory_order_acquire);
+                if (run % 2 == 0 || run == slot->reported) {
+                    continue;
+                }
+                auto start = slot->start.load(std::memory_order_acquire);
+                auto budget = slot->budget.load(std::memory_order_acquire);
+                auto *command = slot->command.load(std::memory_order_acquire);
+                auto chat_id = slot->chat_id.load(std::memory_order_acquire);
+                auto update_id = slot->update_id.load(std::memory_order_acquire);
+                if (slot->run.load(std::memory_order_acquire) != run || now - start <= budget) {
+                    continue;
+                }
+                slot->reported = run;
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::nanoseconds(now - start));
+                overruns.push_back({command, chat_id, update_id, elapsed, slot->thread,
+                                    config_.capture_stacks ? CaptureStack(slot.get(), run)
+                                                           : std::string()});
+            }
+        }
+        for (const auto &overrun : overruns) {
+            on_overrun_(overrun);
+        }
+
+        lock.lock();
+    }
+}
+
+telegram::Watched::Watched(const char *command, int64_t chat_id, int64_t update_id,
+                           std::chrono::milliseconds budget) {
+    auto *watchdog = Watchdog::Installed();
+    if (!watchdog) {
+        return;
+    }
+    if (budget.count() == 0) {
+        budget = watchdog->config_.default_budget;
+    }
+    slot_ = watchdog->SlotOfThisThread();
+    auto run = slot_->run.load(std::memory_order_relaxed);
+    // Release stores keep the end of the previous run ahead of these fields, as in
+    // Tracer::Record.
+    slot_->start.store(NanosOf(Watchdog::Clock::now()), std::memory_order_release);
+    slot_->budget.store(std::chrono::nanoseconds(budget).count(), std::memory_order_release);
+    slot_->command.store(command, std::memory_order_release);
+    slot_->chat_id.store(chat_id, std::memory_order_release);
+    slot_->update_id.store(update_id, std::memory_order_release);
+    slot_->run.store(run + 1, std::memory_order_release);
+    Watchdog::running_ = slot_.get();
+}
+
+telegram::Watched::~Watched() {
+    if (slot_) {
+        Watchdog::running_ = nullptr;
+        slot_->run.store(slot_->run.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_release);
+    }
+}
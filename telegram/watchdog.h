@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+
+namespace telegram {
+struct WatchdogConfig {
+    // How often running handlers are checked, which bounds how late an overrun is seen.
+    std::chrono::milliseconds period{10};
+    // For handlers watched without a budget of their own.
+    std::chrono::milliseconds default_budget{1000};
+    // Takes the stack of a handler over budget by interrupting its thread with
+    // stack_signal. Blocking calls that do not restart after a signal may fail
+    // with EINTR there.
+    bool capture_stacks = false;
+    int stack_signal = SIGUSR2;
+};
+
+// A handler that ran past its budget, reported once per run while it still runs.
+struct Overrun {
+    const char *command;
+    int64_t chat_id;
+    int64_t update_id;
+    std::chrono::milliseconds elapsed;
+    std::thread::id thread;
+    // One frame per line, empty unless stacks are captured.
+    std::string stack;
+};
+
+// Watches handlers from a thread of its own. A watched handler costs a few stores
+// into a slot of its thread at either end; the watchdog thread scans the slots
+// every period and reports each run over its budget to on_overrun, on that thread.
+class Watchdog {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Watchdog(const WatchdogConfig &config, std::function<void(const Overrun &)> on_overrun);
+    // Uninstalls the watchdog if it is installed. Handlers still running are no
+    // longer watched.
+    ~Watchdog();
+
+    Watchdog(const Watchdog &) = delete;
+    Watchdog &operator=(const Watchdog &) = delete;
+
+    // nullptr stops watching.
+    static void Install(Watchdog *watchdog);
+
+    static Watchdog *Installed() {
+        return installed_.load(std::memory_order_acquire);
+    }
+
+private:
+    friend class Watched;
+
+    static constexpr int kMaxFrames = 32;
+
+    // Written by its thread only; the watchdog checks run again after reading to
+    // drop fields of a run that ended meanwhile.
+    struct Slot {
+        // Odd while a watched handler runs.
+        std::atomic<uint64_t> run = 0;
+        std::atomic<int64_t> start = 0;
+        std::atomic<int64_t> budget = 0;
+        std::atomic<const char *> command = nullptr;
+        std::atomic<int64_t> chat_id = 0;
+        std::atomic<int64_t> update_id = 0;
+        std::thread::id thread;
+        pthread_t handle;
+        // The run last reported, used by the watchdog thread only.
+        uint64_t reported = 0;
+        // Filled in by the stack signal handler on the slot's thread.
+        void *frames[kMaxFrames];
+        int frame_count = 0;
+        std::atomic<bool> stack_taken = false;
+    };
+
+    const std::shared_ptr<Slot> &SlotOfThisThread();
+    std::string CaptureStack(Slot *slot, uint64_t run);
+    void Work();
+    static void OnStackSignal(int signal);
+
+    inline static std::atomic<Watchdog *> installed_ = nullptr;
+    // The slot of the handler running on this thread, for the stack signal handler.
+    inline static thread_local Slot *running_ = nullptr;
+
+    const uint64_t id_;
+    const WatchdogConfig config_;
+    const std::function<void(const Overrun &)> on_overrun_;
+
+    std::mutex slots_mutex_;
+    // Shared with the handlers running, which may outlive the watchdog.
+    std::vector<std::shared_ptr<Slot>> slots_;
+
+    std::mutex stop_mutex_;
+    std::condition_variable stop_changed_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+// Watches the scope as a run of command for chat_id in the installed watchdog.
+// A budget of zero stands for the watchdog's default one.
+class Watched {
+public:
+    Watched(const char *command, int64_t chat_id, int64_t update_id,
+            std::chrono::milliseconds budget);
+    ~Watched();
+
+    Watched(const Watched &) = delete;
+    Watched &operator=(const Watched &) = delete;
+
+private:
+    std::shared_ptr<Watchdog::Slot> slot_;
+};
+}  // namespace telegram
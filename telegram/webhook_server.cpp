@@ -0,0 +1,131 @@
+#include "webhook_server.h"
+
+#include <thread>
+#include <algorithm>
+#include <Poco/Net/HTTPServer.h>
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/HTTPRequestHandlerFactory.h>
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/SocketAddress.h>
+#include "update_parser.h"
+
+class telegram::WebhookServer::RequestHandler : public Poco::Net::HTTPRequestHandler {
+public:
+    explicit RequestHandler(const WebhookServer *server) : server_(server) {
+    }
+
+    void handleRequest(Poco::Net::HTTPServerRequest &request,
+                       Poco::Net::HTTPServerResponse &response) override {
+        using Poco::Net::HTTPResponse;
+        const auto &config = server_->config_;
+        if (request.getMethod() != Poco::Net::HTTPRequest::HTTP_POST ||
+            Path(request.getURI()) != config.path) {
+            Finish(HTTPResponse::HTTP_NOT_FOUND, {}, &response);
+            return;
+        }
+        if (!config.secret_token.empty() &&
+            request.get("X-Telegram-Bot-Api-Secret-Token", "") != config.secret_token) {
+            Finish(HTTPResponse::HTTP_UNAUTHORIZED, {}, &response);
+            return;
+        }
+
+        // One parser per server thread; the batch is shared with the handler.
+        thread_local IndexedUpdateParser parser;
+        auto batch = std::make_shared<UpdateBatch>();
+        try {
+            parser.ParseWebhook(request.stream(), batch.get());
+        } catch (const ParseError &) {
+            Finish(HTTPResponse::HTTP_BAD_REQUEST, {}, &response);
+            return;
+        }
+
+        std::string body;
+        try {
+            ReplyChannel replies(server_->client_, config.reply_in_response, server_->queue_);
+            for (size_t i = 0; i < batch->Size(); ++i) {
+                server_->handler_(UpdateView(batch, i), &replies);
+            }
+            replies.Wait();
+            if (!replies.TakeResponse(&body)) {
+                body.clear();
+            }
+        } catch (const std::exception &) {
+            Finish(HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, {}, &response);
+            return;
+        }
+        Finish(HTTPResponse::HTTP_OK, body, &response);
+    }
+
+private:
+    static std::string_view Path(std::string_view uri) {
+        return uri.substr(0, uri.find('?'));
+    }
+
+    static void Finish(Poco::Net::HTTPResponse::HTTPStatus status, std::string_view body,
+                       Poco::Net::HTTPServerResponse *response) {
+        response->setStatus(status);
+        if (!body.empty()) {
+            response->setContentType("application/json");
+        }
+        response->setContentLength(static_cast<std::streamsize>(body.size()));
+        response->send().write(body.data(), static_cast<std::streamsize>(body.size()));
+    }
+
+    const WebhookServer *server_;
+};
+
+class telegram::WebhookServer::HandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
+public:
+    explicit HandlerFactory(const WebhookServer *server) : server_(server) {
+    }
+
+    Poco::Net::HTTPRequestHandler *createRequestHandler(
+        const Poco::Net::HTTPServerRequest &) override {
+        return new RequestHandler(server_);
+    }
+
+private:
+    const WebhookServer *server_;
+};
+
+telegram::WebhookServer::WebhookServer(Client *client, const WebhookConfig &config,
+                                       Handler handler, SendQueue *queue)
+    : client_(client), queue_(queue), config_(config), handler_(std::move(handler)) {
+}
+
+telegram::WebhookServer::~WebhookServer() {
+    Stop();
+}
+
+void telegram::WebhookServer::Start() {
+    auto workers = config_.workers;
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    port_ = config_.port;
+    for (size_t i = 0; i < workers; ++i) {
+        // The first socket settles the port when it is 0; the rest join it.
+        Poco::Net::ServerSocket socket;
+        socket.bind(Poco::Net::SocketAddress(config_.host, port_), true, true);
+        socket.listen();
+        port_ = socket.address().port();
+
+        auto *params = new Poco::Net::HTTPServerParams;
+        params->setMaxThreads(static_cast<int>(config_.threads_per_worker));
+        params->setKeepAlive(true);
+        servers_.push_back(
+            std::make_unique<Poco::Net::HTTPServer>(new HandlerFactory(this), socket, params));
+        servers_.back()->start();
+    }
+}
+
+void telegram::WebhookServer::Stop() {
+    for (auto &server : servers_) {
+        server->stop();
+    }
+    servers_.clear();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include "client.h"
+#include "reply_channel.h"
+#include "update_batch.h"
+
+namespace Poco::Net {
+class HTTPServer;
+}  // namespace Poco::Net
+
+namespace telegram {
+struct WebhookConfig {
+    std::string host = "0.0.0.0";
+    // 0 picks a free port; see Port().
+    uint16_t port = 8443;
+    // Requests to any other path are answered 404.
+    std::string path = "/";
+    // Checked against X-Telegram-Bot-Api-Secret-Token when not empty.
+    std::string secret_token{};
+    // Listening sockets sharing the port through SO_REUSEPORT, so the kernel
+    // spreads connections over them; 0 means one per core.
+    size_t workers = 0;
+    size_t threads_per_worker = 2;
+    // Send a lone reply back as the webhook response instead of a sendMessage request.
+    bool reply_in_response = true;
+};
+
+// Receives updates as webhook POST requests and runs the handler for each on the
+// server thread that read it. Updates of one request are handled in order; requests
+// on different connections run in parallel.
+class WebhookServer {
+public:
+    // Replies go through the channel. A handler that throws fails the request, and
+    // the Bot API delivers the update again.
+    using Handler = std::function<void(const UpdateView &, ReplyChannel *)>;
+
+    // Replies that do not fit in the response go through the queue, if there is one.
+    WebhookServer(Client *client, const WebhookConfig &config, Handler handler,
+                  SendQueue *queue = nullptr);
+    ~WebhookServer();
+
+    void Start();
+    void Stop();
+
+    // The port the workers listen on, once started.
+    uint16_t Port() const {
+        return port_;
+    }
+
+private:
+    class RequestHandler;
+    class HandlerFactory;
+
+    Client *client_;
+    SendQueue *queue_;
+    const WebhookConfig config_;
+    Handler handler_;
+    uint16_t port_ = 0;
+    std::vector<std::unique_ptr<Poco::Net::HTTPServer>> servers_;
+};
+}  // namespace telegram
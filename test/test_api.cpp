@@ -2,7 +2,64 @@
 
 #include <catch.hpp>
 #include "telegram/client.h"
+#include "telegram/dispatcher.h"
+#include "telegram/async_client.h"
+#include "telegram/request_builder.h"
+#include "telegram/rate_limiter.h"
+#include "telegram/update_parser.h"
+#include "telegram/command_router.h"
+#include "telegram/offset_store.h"
+#include "telegram/update_journal.h"
+#include "telegram/webhook_server.h"
+#include "telegram/loopback_transport.h"
+#include "telegram/send_queue.h"
+#include "telegram/broadcast.h"
+#include "telegram/poll_controller.h"
+#include "telegram/poller.h"
+#include "telegram/metrics.h"
+#include "telegram/tracing.h"
+#include "telegram/logger.h"
+#include "telegram/flight_recorder.h"
+#include "telegram/watchdog.h"
+#include "fake/fake_data.h"
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <csignal>
+#include <new>
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include <filesystem>
+
+namespace {
+std::atomic<size_t> allocations = 0;
+}  // namespace
+
+void *operator new(size_t size) {
+    ++allocations;
+    if (auto *ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
 
 TEST_CASE("Single getMe") {
     telegram::FakeServer fake{"Single getMe"};
@@ -59,3 +116,1464 @@ TEST_CASE("Handle getUpdates offset") {
 
     fake.StopAndCheckExpectations();
 }
+
+TEST_CASE("Concurrent sendMessage") {
+    telegram::FakeServer fake{"Send message throughput"};
+    fake.Start();
+
+    telegram::Client client(fake.GetUrl(), "bot123",
+                            {.pool_size = 4, .rate_limit = {.enabled = false}});
+    std::vector<std::thread> senders;
+    std::atomic<int> failed = 0;
+    for (int i = 0; i < 8; ++i) {
+        senders.emplace_back([&client, &failed, i] {
+            for (int j = 0; j < 10; ++j) {
+                try {
+                    client.SendMessage("Hi!", 104519755 + i);
+                } catch (const std::exception &e) {
+                    ++failed;
+                }
+            }
+        });
+    }
+    for (auto &sender : senders) {
+        sender.join();
+    }
+    REQUIRE(failed == 0);
+
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Dispatcher keeps per-chat order") {
+    std::mutex mutex;
+    std::unordered_map<int64_t, int64_t> last_seen;
+    bool reordered = false;
+
+    telegram::Dispatcher dispatcher(4, [&](const telegram::UpdateView &update) {
+        std::lock_guard guard(mutex);
+        if (last_seen[update.chat_id] >= update.update_id || update.Text() != "/random") {
+            reordered = true;
+        }
+        last_seen[update.chat_id] = update.update_id;
+    });
+    auto batch = std::make_shared<telegram::UpdateBatch>();
+    for (int64_t id = 1; id <= 1000; ++id) {
+        batch->Append(id, id % 7, id, "/random");
+    }
+    std::weak_ptr<const telegram::UpdateBatch> alive = batch;
+    for (size_t i = 0; i < batch->Size(); ++i) {
+        dispatcher.Submit({batch, i});
+    }
+    batch.reset();
+    dispatcher.Wait();
+
+    REQUIRE_FALSE(reordered);
+    // The last handled update released the batch.
+    REQUIRE(alive.expired());
+    REQUIRE(last_seen.size() == 7);
+    uint64_t handled = 0;
+    for (const auto &shard : dispatcher.Stats()) {
+        REQUIRE(shard.queue_depth == 0);
+        handled += shard.handled;
+    }
+    REQUIRE(handled == 1000);
+}
+
+TEST_CASE("Asynchronous sendMessage") {
+    telegram::FakeServer fake{"Send message throughput"};
+    fake.Start();
+
+    telegram::Client client(fake.GetUrl(), "bot123", {.pool_size = 4, .io_threads = 4});
+    std::vector<std::future<void>> replies;
+    for (int i = 0; i < 16; ++i) {
+        replies.push_back(client.SendMessageAsync("Hi!", 104519755 + i));
+    }
+
+    std::promise<std::exception_ptr> callback_result;
+    client.SendMessageAsync("Hi!", 104519755, std::nullopt,
+                            [&](std::exception_ptr error) { callback_result.set_value(error); });
+
+    for (auto &reply : replies) {
+        REQUIRE_NOTHROW(reply.get());
+    }
+    REQUIRE(callback_result.get_future().get() == nullptr);
+
+    fake.StopAndCheckExpectations();
+}
+
+telegram::Task<> ReplyToUpdates(telegram::AsyncClient &client) {
+    auto updates = co_await client.FetchUpdates();
+    co_await client.SendMessage("Hi!", updates[0].chat_id);
+    co_await client.SendMessage("Reply", updates[1].chat_id, updates[1].message_id);
+    co_await client.SendMessage("Reply", updates[1].chat_id, updates[1].message_id);
+}
+
+TEST_CASE("Coroutine getUpdates and send messages") {
+    telegram::FakeServer fake{"Single getUpdates and send messages"};
+    fake.Start();
+
+    telegram::Client client(fake.GetUrl(), "bot123");
+    telegram::EventLoop loop;
+    telegram::AsyncClient async_client(&client, &loop);
+    loop.Spawn(ReplyToUpdates(async_client));
+    loop.Run();
+
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Coroutine requests go out from the event loop") {
+    telegram::FakeServer fake{"Single getUpdates and send messages"};
+    fake.Start();
+
+    // Without I/O threads a request taking the executor path would throw.
+    telegram::Client client(fake.GetUrl(), "bot123", {.io_threads = 0});
+    telegram::EventLoop loop;
+    telegram::AsyncClient async_client(&client, &loop, {.endpoint = fake.GetUrl()});
+    loop.Spawn(ReplyToUpdates(async_client));
+    loop.Run();
+
+    fake.StopAndCheckExpectations();
+}
+
+telegram::Task<> SleepUntilCancelled(telegram::EventLoop &loop, telegram::CancellationToken token,
+                                     bool *cancelled) {
+    try {
+        co_await loop.Sleep(std::chrono::hours(1), token);
+    } catch (const telegram::OperationCancelled &) {
+        *cancelled = true;
+    }
+}
+
+TEST_CASE("Coroutine cancellation") {
+    telegram::EventLoop loop;
+    telegram::CancellationSource source;
+    bool cancelled = false;
+
+    loop.Spawn(SleepUntilCancelled(loop, source.Token(), &cancelled));
+    loop.RunAt(telegram::EventLoop::Clock::now() + std::chrono::milliseconds(10),
+               [&] { source.Cancel(); });
+    loop.Run();
+
+    REQUIRE(cancelled);
+}
+
+telegram::Task<> AwaitUntilCancelled(telegram::AsyncClient::Awaiter<int> request, bool *cancelled) {
+    try {
+        co_await request;
+    } catch (const telegram::OperationCancelled &) {
+        *cancelled = true;
+    }
+}
+
+TEST_CASE("A request completes safely after its coroutine was cancelled") {
+    std::function<void(std::exception_ptr, int)> complete;
+    telegram::CancellationSource source;
+    bool cancelled = false;
+    {
+        telegram::EventLoop loop;
+        telegram::AsyncClient::Awaiter<int> request(
+            &loop, [&complete](auto done) { complete = std::move(done); }, source.Token());
+        loop.Spawn(AwaitUntilCancelled(std::move(request), &cancelled));
+        loop.RunAt(telegram::EventLoop::Clock::now() + std::chrono::milliseconds(10),
+                   [&] { source.Cancel(); });
+        loop.Run();
+    }
+    REQUIRE(cancelled);
+
+    // The coroutine with its awaiter and the loop are gone; the completion touches neither.
+    REQUIRE(complete);
+    complete(nullptr, 42);
+}
+
+TEST_CASE("Request building does not allocate once warmed up") {
+    telegram::RequestBuilder builder("bot123");
+    std::string path;
+    std::string body;
+
+    auto build = [&](int64_t i) {
+        builder.BuildPath(telegram::ApiMethod::kSendMessage, &path);
+        telegram::RequestBuilder::BuildSendMessageBody("Reply \"quoted\"\n", 104519755 + i, i,
+                                                       &body);
+        builder.BuildGetUpdatesPath(20, 851793506 + i, &path);
+    };
+    build(1000000);
+
+    auto before = allocations.load();
+    for (int64_t i = 0; i < 1000; ++i) {
+        build(i);
+    }
+    REQUIRE(allocations == before);
+
+    REQUIRE(path == "/bot123/getUpdates?timeout=20&offset=851794505");
+    REQUIRE(body == R"({"chat_id":104520754,"text":"Reply \"quoted\"\n","reply_to_message_id":999})");
+
+    // The whole sendMessage exchange, reply included, once the buffers have grown.
+    class OkHandler : public telegram::LoopbackHandler {
+    public:
+        void Handle(const Request &, Response *response) override {
+            ++sent;
+            response->body << fake_data::kSendMessageHiJson;
+        }
+
+        std::atomic<int64_t> sent = 0;
+    };
+    auto handler = std::make_shared<OkHandler>();
+    telegram::Client client(std::make_shared<telegram::LoopbackTransport>(handler), "bot123",
+                            {.rate_limit = {.enabled = false}});
+    const std::string text = "Reply \"quoted\"\n";
+    client.SendMessage(text, 104519755, 1);
+
+    before = allocations.load();
+    for (int64_t i = 0; i < 1000; ++i) {
+        client.SendMessage(text, 104519755, i);
+    }
+    REQUIRE(allocations == before);
+    REQUIRE(handler->sent == 1001);
+}
+
+TEST_CASE("Poll controller grows batches under load and backs off when idle") {
+    using namespace std::chrono_literals;
+
+    telegram::RequestBuilder builder("bot123");
+    std::string path;
+    builder.BuildGetUpdatesPath(
+        {.timeout = 0, .offset = 7, .limit = 100, .allowed_updates = R"(["message"])"}, &path);
+    REQUIRE(path ==
+            "/bot123/getUpdates?timeout=0&offset=7&limit=100&allowed_updates=%5B%22message%22%5D");
+
+    telegram::PollController controller({.timeout = 0, .min_limit = 10, .max_limit = 100});
+    REQUIRE(controller.Next().limit == 10);
+    for (auto limit : {20, 40, 80, 100, 100}) {
+        controller.Received(controller.Next().limit, 5ms);
+        REQUIRE(controller.Next().limit == limit);
+        REQUIRE(controller.Next().delay == 0ms);
+    }
+    for (auto delay : {50ms, 100ms, 200ms}) {
+        controller.Received(0, 5ms);
+        REQUIRE(controller.Next().delay == delay);
+    }
+    REQUIRE(controller.Next().limit == 12);
+    controller.Received(1, 5ms);
+    REQUIRE(controller.Next().delay == 0ms);
+
+    // An empty long poll that ran its course is no reason to wait.
+    telegram::PollController long_poll({.timeout = 20});
+    long_poll.Received(0, 20s);
+    REQUIRE(long_poll.Next().delay == 0ms);
+    long_poll.Received(0, 10ms);
+    REQUIRE(long_poll.Next().delay == 50ms);
+}
+
+TEST_CASE("Loopback getUpdates and send messages") {
+    telegram::FakeServer fake{"Single getUpdates and send messages"};
+    telegram::Client client(fake.MakeLoopbackTransport(), "bot123");
+
+    auto updates = client.FetchUpdates();
+    client.SendMessage("Hi!", updates[0].chat_id);
+    client.SendMessage("Reply", updates[1].chat_id, updates[1].message_id);
+    client.SendMessage("Reply", updates[1].chat_id, updates[1].message_id);
+
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Compressed getUpdates and send messages") {
+    for (auto content_encoding : {"gzip", "deflate"}) {
+        telegram::FakeServer fake{"Single getUpdates and send messages", content_encoding};
+        telegram::Client client(fake.MakeLoopbackTransport(), "bot123");
+
+        auto updates = client.FetchUpdates();
+        REQUIRE(updates.size() == 4);
+        client.SendMessage("Hi!", updates[0].chat_id);
+        client.SendMessage("Reply", updates[1].chat_id, updates[1].message_id);
+        client.SendMessage("Reply", updates[1].chat_id, updates[1].message_id);
+
+        fake.StopAndCheckExpectations();
+    }
+}
+
+TEST_CASE("Rate limiter keeps to the global and per-chat limits") {
+    using namespace std::chrono_literals;
+    auto start = telegram::RateLimiter::Clock::now();
+
+    telegram::RateLimiter chat_limiter({.global = {30, 30}, .per_chat = {1, 3}});
+    for (int i = 0; i < 3; ++i) {
+        REQUIRE(chat_limiter.Reserve(1, start) == start);
+    }
+    REQUIRE(chat_limiter.Reserve(2, start) == start);
+    REQUIRE(chat_limiter.Reserve(1, start) - start == 1s);
+
+    // TryReserve takes a slot only when it is due, so asking early costs nothing.
+    REQUIRE(chat_limiter.TryReserve(1, start) - start == 2s);
+    REQUIRE(chat_limiter.TryReserve(1, start + 1s) - start == 2s);
+    REQUIRE(chat_limiter.TryReserve(1, start + 2s) == start + 2s);
+    REQUIRE(chat_limiter.TryReserve(1, start + 2s) - start == 3s);
+
+    chat_limiter.Pause(3, 5s, start);
+    REQUIRE(chat_limiter.Reserve(3, start) - start >= 5s);
+
+    // After the burst the bot as a whole settles at 30 messages per second.
+    telegram::RateLimiter global_limiter({.global = {30, 30}, .per_chat = {1, 3}});
+    telegram::RateLimiter::Clock::time_point last;
+    for (int64_t chat_id = 0; chat_id < 300; ++chat_id) {
+        last = global_limiter.Reserve(chat_id, start);
+    }
+    REQUIRE(last - start > 9s - 1ms);
+    REQUIRE(last - start < 9s + 1ms);
+
+    // Chats whose bucket has refilled are forgotten.
+    telegram::RateLimiter busy_limiter({.global = {1e6, 1000}, .per_chat = {1, 3}});
+    for (int64_t chat_id = 0; chat_id < 100000; ++chat_id) {
+        busy_limiter.Reserve(chat_id, start + chat_id * 1ms);
+    }
+    REQUIRE(busy_limiter.TrackedChats() < 4096);
+}
+
+namespace {
+// The most sends that fall into any one second.
+size_t MostInOneSecond(std::vector<telegram::RateLimiter::Clock::time_point> sends) {
+    std::sort(sends.begin(), sends.end());
+    size_t most = 0;
+    for (size_t first = 0, last = 0; last < sends.size(); ++last) {
+        while (sends[last] - sends[first] >= std::chrono::seconds(1)) {
+            ++first;
+        }
+        most = std::max(most, last - first + 1);
+    }
+    return most;
+}
+}  // namespace
+
+TEST_CASE("Rate limiter keeps chats held back by their own limit within the global one") {
+    using namespace std::chrono_literals;
+    auto start = telegram::RateLimiter::Clock::now();
+
+    // Ten chats send four messages each, the fourth held back a second by the chat's
+    // limit; then sixty chats without a backlog send one each, just as those go out.
+    telegram::RateLimiter limiter({.global = {30, 1}, .per_chat = {1, 3}});
+    std::vector<telegram::RateLimiter::Clock::time_point> sends;
+    for (int64_t chat_id = 0; chat_id < 10; ++chat_id) {
+        for (int i = 0; i < 4; ++i) {
+            sends.push_back(limiter.Reserve(chat_id, start));
+        }
+    }
+    for (int64_t chat_id = 100; chat_id < 160; ++chat_id) {
+        sends.push_back(limiter.Reserve(chat_id, start + 1s));
+    }
+    REQUIRE(MostInOneSecond(sends) <= 30);
+}
+
+TEST_CASE("Rate limiter defaults stay within Telegram's limits") {
+    using namespace std::chrono_literals;
+    auto start = telegram::RateLimiter::Clock::now();
+
+    // A hundred chats with five messages each, all asked for at once.
+    telegram::RateLimiter limiter(telegram::RateLimiterConfig{});
+    std::vector<telegram::RateLimiter::Clock::time_point> sends;
+    std::vector<std::vector<telegram::RateLimiter::Clock::time_point>> chats(100);
+    for (int round = 0; round < 5; ++round) {
+        for (int64_t chat_id = 0; chat_id < 100; ++chat_id) {
+            auto send = limiter.Reserve(chat_id, start);
+            sends.push_back(send);
+            chats[chat_id].push_back(send);
+        }
+    }
+
+    REQUIRE(MostInOneSecond(sends) <= 30);
+    for (const auto &chat : chats) {
+        REQUIRE(MostInOneSecond(chat) == 1);
+    }
+    // Close to the global rate all along.
+    REQUIRE(*std::max_element(sends.begin(), sends.end()) - start < 18s);
+
+    // A lone chat gets no burst either.
+    auto later = start + 60s;
+    std::vector<telegram::RateLimiter::Clock::time_point> lone;
+    for (int i = 0; i < 3; ++i) {
+        lone.push_back(limiter.Reserve(1000, later));
+    }
+    REQUIRE(MostInOneSecond(lone) == 1);
+}
+
+TEST_CASE("sendMessage waits out retry_after") {
+    telegram::FakeServer fake{"sendMessage flood wait"};
+    fake.Start();
+    telegram::Client client(fake.GetUrl(), "bot123");
+
+    auto start = std::chrono::steady_clock::now();
+    client.SendMessage("Hi!", 104519755);
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::seconds(1));
+
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Streaming getUpdates parser matches the DOM parser") {
+    for (const auto &json :
+         {fake_data::kGetUpdatesFourMessagesJson, fake_data::kGetUpdatesTwoMessages,
+          fake_data::kGetUpdatesZeroMessages, fake_data::kGetupdatesOneMessage,
+          fake_data::GetUpdatesJson(100)}) {
+        std::vector<telegram::Client::Update> streamed, dom;
+        std::istringstream streamed_input(json), dom_input(json);
+        telegram::ParseUpdates(streamed_input, &streamed);
+        telegram::ParseUpdatesDom(dom_input, &dom);
+
+        REQUIRE(streamed.size() == dom.size());
+        for (size_t i = 0; i < dom.size(); ++i) {
+            REQUIRE(streamed[i].update_id == dom[i].update_id);
+            REQUIRE(streamed[i].chat_id == dom[i].chat_id);
+            REQUIRE(streamed[i].message_id == dom[i].message_id);
+            REQUIRE(streamed[i].message == dom[i].message);
+        }
+    }
+
+    std::vector<telegram::Client::Update> updates;
+    std::istringstream escaped(
+        R"({"ok":true,"result":[{"update_id":1,"edited_message":{"text":"skipped"}},)"
+        R"({"update_id":2,"message":{"message_id":3,"chat":{"id":-100},)"
+        R"("text":"a\"\u263A\ud83d\ude00"}}]})");
+    telegram::ParseUpdates(escaped, &updates);
+    REQUIRE(updates.size() == 1);
+    REQUIRE(updates[0].chat_id == -100);
+    REQUIRE(updates[0].message == "a\"\u263A\U0001F600");
+
+    std::istringstream truncated(R"({"ok":true,"result":[{"update_id":1,"message":{"text":"a)");
+    REQUIRE_THROWS_AS(telegram::ParseUpdates(truncated, &updates), telegram::ParseError);
+}
+
+TEST_CASE("Structural index is the same at every SIMD level") {
+    std::vector<std::string> documents = {
+        fake_data::kGetUpdatesFourMessagesJson, fake_data::kGetUpdatesTwoMessages,
+        fake_data::kGetUpdatesZeroMessages, fake_data::kGetupdatesOneMessage,
+        fake_data::GetUpdatesJson(100)};
+    // Escape runs and quoted brackets at every offset of a 64-byte block.
+    for (size_t padding = 0; padding < 70; ++padding) {
+        for (size_t backslashes = 0; backslashes < 4; ++backslashes) {
+            documents.push_back(std::string(padding, ' ') + R"({"a":")" +
+                                std::string(backslashes, '\\') + (backslashes % 2 ? "\"" : "") +
+                                R"(x\\","b":[1,{"c":"}"}]})");
+        }
+    }
+
+    for (const auto &json : documents) {
+        std::vector<uint32_t> scalar, simd;
+        telegram::BuildStructuralIndex(json, &scalar, telegram::SimdLevel::kScalar);
+        for (auto level : {telegram::SimdLevel::kSse42, telegram::SimdLevel::kAvx2}) {
+            telegram::BuildStructuralIndex(json, &simd, level);
+            REQUIRE(simd == scalar);
+        }
+    }
+
+    for (size_t i = 0; i < 5; ++i) {
+        std::vector<telegram::Client::Update> dom;
+        std::istringstream dom_input(documents[i]);
+        telegram::ParseUpdatesDom(dom_input, &dom);
+        for (auto level : {telegram::SimdLevel::kScalar, telegram::DetectSimdLevel()}) {
+            std::vector<telegram::Client::Update> indexed;
+            telegram::IndexedUpdateParser parser(level);
+            parser.Parse(documents[i], &indexed);
+
+            REQUIRE(indexed.size() == dom.size());
+            for (size_t j = 0; j < dom.size(); ++j) {
+                REQUIRE(indexed[j].update_id == dom[j].update_id);
+                REQUIRE(indexed[j].chat_id == dom[j].chat_id);
+                REQUIRE(indexed[j].message_id == dom[j].message_id);
+                REQUIRE(indexed[j].message == dom[j].message);
+            }
+        }
+    }
+
+    std::vector<uint32_t> index;
+    REQUIRE_THROWS_AS(telegram::BuildStructuralIndex(R"({"text":"a)", &index),
+                      telegram::ParseError);
+}
+
+TEST_CASE("Update batches decode texts in place and allocate per batch") {
+    auto json = fake_data::GetUpdatesJson(100);
+    std::vector<telegram::Client::Update> expected;
+    std::istringstream expected_input(json);
+    telegram::ParseUpdatesDom(expected_input, &expected);
+
+    telegram::IndexedUpdateParser parser;
+    for (int round = 0; round < 2; ++round) {
+        std::istringstream input(json);
+        auto before = allocations.load();
+        auto batch = std::make_shared<telegram::UpdateBatch>();
+        parser.Parse(input, batch.get());
+        for (size_t i = 0; i < batch->Size(); ++i) {
+            batch->Text(i);
+        }
+        // The arena and the entries grow geometrically; nothing is allocated per update.
+        REQUIRE(allocations.load() - before < 40);
+
+        REQUIRE(batch->Size() == expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            REQUIRE((*batch)[i].update_id == expected[i].update_id);
+            REQUIRE((*batch)[i].chat_id == expected[i].chat_id);
+            REQUIRE((*batch)[i].message_id == expected[i].message_id);
+            REQUIRE(batch->Text(i) == expected[i].message);
+        }
+    }
+
+    // Concurrent first reads of one escaped text decode it once.
+    std::istringstream input(json);
+    auto batch = std::make_shared<telegram::UpdateBatch>();
+    parser.Parse(input, batch.get());
+    std::vector<std::thread> readers;
+    std::atomic<int> mismatches = 0;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&] {
+            if (batch->Text(3) != expected[3].message) {
+                ++mismatches;
+            }
+        });
+    }
+    for (auto &reader : readers) {
+        reader.join();
+    }
+    REQUIRE(mismatches == 0);
+}
+
+namespace {
+constexpr auto kTestRouter = telegram::MakeCommandRouter<int>({
+    {"start", 1},
+    {"help", 2},
+    {"random", 3},
+    {"weather", 4},
+    {"stop", 5},
+});
+
+static_assert(*kTestRouter.Find("random") == 3);
+static_assert(!kTestRouter.Find("rand"));
+static_assert(telegram::ParseBotCommand("/help@bot  x")->args == "x");
+}  // namespace
+
+TEST_CASE("Bot commands are parsed and routed") {
+    auto command = telegram::ParseBotCommand("/weather@test_bot  in Moscow ");
+    REQUIRE(command);
+    REQUIRE(command->name == "weather");
+    REQUIRE(command->bot == "test_bot");
+    REQUIRE(command->args == "in Moscow ");
+
+    command = telegram::ParseBotCommand("/stop");
+    REQUIRE(command);
+    REQUIRE(command->name == "stop");
+    REQUIRE(command->bot.empty());
+    REQUIRE(command->args.empty());
+
+    REQUIRE(!telegram::ParseBotCommand("stop"));
+    REQUIRE(!telegram::ParseBotCommand("/"));
+    REQUIRE(!telegram::ParseBotCommand("/@bot"));
+
+    for (auto [name, handler] : {std::pair{"start", 1}, {"help", 2}, {"random", 3},
+                                 {"weather", 4}, {"stop", 5}}) {
+        REQUIRE(kTestRouter.Find(name));
+        REQUIRE(*kTestRouter.Find(name) == handler);
+    }
+    REQUIRE(!kTestRouter.Find(""));
+    REQUIRE(!kTestRouter.Find("stopp"));
+
+    // Prepared replies serialize like plain ones.
+    std::string plain, prepared;
+    telegram::RequestBuilder::BuildSendMessageBody("Winter \"Is\" Coming", 1, 2, &plain);
+    telegram::RequestBuilder::BuildSendMessageBody(
+        telegram::PreparedText("Winter \"Is\" Coming"), 1, 2, &prepared);
+    REQUIRE(plain == prepared);
+}
+
+TEST_CASE("Offset store survives torn writes and commits in groups") {
+    auto path = (std::filesystem::temp_directory_path() / "telegram_offset_store_test").string();
+    std::filesystem::remove(path);
+
+    {
+        telegram::OffsetStore store(path, {.durability = telegram::Durability::kNone,
+                                           .commit_every = 3});
+        REQUIRE(store.Load() == 0);
+        store.Store(10);
+        store.Store(11);
+        REQUIRE(telegram::OffsetStore(path).Load() == 0);
+        store.Store(12);
+        REQUIRE(telegram::OffsetStore(path).Load() == 12);
+        store.Store(13);
+    }
+    // The destructor commits what is left.
+    REQUIRE(telegram::OffsetStore(path).Load() == 13);
+
+    {
+        telegram::OffsetStore store(path, {.durability = telegram::Durability::kDsync});
+        store.Store(14);
+    }
+    REQUIRE(telegram::OffsetStore(path).Load() == 14);
+
+    // Spoil the newest slot: the previous commit is read back.
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        for (std::streamoff at : {0, 512}) {
+            char slot[24];
+            file.seekg(at);
+            file.read(slot, sizeof slot);
+            int64_t offset;
+            std::memcpy(&offset, slot + 8, sizeof offset);
+            if (offset == 14) {
+                file.seekp(at + 8);
+                file.put(0x7f);
+            }
+        }
+    }
+    REQUIRE(telegram::OffsetStore(path).Load() == 13);
+
+    // The old format is the bare offset.
+    std::filesystem::remove(path);
+    {
+        std::ofstream file(path, std::ios::binary);
+        int64_t offset = 42;
+        file.write(reinterpret_cast<const char *>(&offset), sizeof offset);
+    }
+    REQUIRE(telegram::OffsetStore(path).Load() == 42);
+    REQUIRE(std::filesystem::file_size(path) == 4096);
+    REQUIRE(telegram::OffsetStore(path).Load() == 42);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Update journal skips updates handled before a crash") {
+    auto path = (std::filesystem::temp_directory_path() / "telegram_journal_test").string();
+    std::filesystem::remove(path);
+    const telegram::UpdateJournalConfig config{.durability = telegram::Durability::kNone,
+                                               .compact_after = 64};
+
+    {
+        telegram::UpdateJournal journal(path, 100, config);
+        REQUIRE(journal.Watermark() == 100);
+        for (int64_t update_id : {100, 101, 105, 106}) {
+            REQUIRE(journal.Received(update_id));
+        }
+        journal.Handled(101);
+        journal.Handled(106);
+        REQUIRE(journal.Watermark() == 100);
+        journal.Handled(100);
+        REQUIRE(journal.Watermark() == 105);
+        // The bot dies here with 105 unhandled.
+    }
+    {
+        std::ofstream torn(path, std::ios::binary | std::ios::app);
+        torn << "torn";
+    }
+
+    telegram::UpdateJournal journal(path, 105, config);
+    REQUIRE(journal.Records() == 3);
+    REQUIRE(journal.Received(105));
+    REQUIRE(!journal.Received(106));
+    REQUIRE(journal.Watermark() == 105);
+    journal.Handled(105);
+    REQUIRE(journal.Watermark() == 107);
+
+    // Many updates in flight at once, handled in reverse; the journal stays bounded.
+    for (int64_t update_id = 1000; update_id < 2000; ++update_id) {
+        REQUIRE(journal.Received(update_id));
+    }
+    for (int64_t update_id = 1999; update_id > 1000; --update_id) {
+        journal.Handled(update_id);
+    }
+    REQUIRE(journal.Watermark() == 1000);
+    journal.Handled(1000);
+    REQUIRE(journal.Watermark() == 2000);
+    journal.Checkpoint(2000);
+    REQUIRE(journal.Records() == 0);
+    REQUIRE(std::filesystem::file_size(path) == 0);
+    std::filesystem::remove(path);
+
+    // Workers handling at once share their syncs; compaction runs in between.
+    int64_t committed = 0;
+    {
+        telegram::UpdateJournal synced(path, 0, {.compact_after = 100});
+        for (int64_t update_id = 0; update_id < 800; ++update_id) {
+            REQUIRE(synced.Received(update_id));
+        }
+        std::vector<std::thread> workers;
+        for (int64_t worker = 0; worker < 8; ++worker) {
+            workers.emplace_back([&synced, worker] {
+                for (int64_t update_id = worker; update_id < 800; update_id += 8) {
+                    synced.Handled(update_id);
+                }
+            });
+        }
+        while (committed < 400) {
+            committed = synced.Watermark();
+            synced.Checkpoint(committed);
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        REQUIRE(synced.Watermark() == 800);
+    }
+    telegram::UpdateJournal reopened(path, committed, config);
+    for (int64_t update_id = committed; update_id < 800; ++update_id) {
+        REQUIRE(reopened.Recovered(update_id));
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Update journal gives back the updates received but not handled") {
+    auto path = (std::filesystem::temp_directory_path() / "telegram_journal_replay_test").string();
+    std::filesystem::remove(path);
+    const telegram::UpdateJournalConfig config{.durability = telegram::Durability::kNone,
+                                               .compact_after = 4};
+
+    {
+        telegram::UpdateJournal journal(path, 10, config);
+        telegram::UpdateBatch batch;
+        batch.Append(10, 1, 100, "first", 1700000000);
+        batch.Append(11, 2, 101, "second", 1700000001);
+        batch.Append(12, 1, 102, "third");
+        batch.Append(13, 3, 103, "");
+        journal.Received(batch);
+        journal.Handled(10);
+        journal.Handled(12);
+        REQUIRE(journal.Watermark() == 11);
+        // 11 is stuck, yet the journal is compacted past what was handled.
+        journal.Checkpoint(10);
+        REQUIRE(journal.Records() == 4);
+
+        telegram::UpdateBatch next;
+        next.Append(14, 1, 104, "fifth");
+        journal.Received(next);
+        // The bot dies here with 11, 13 and 14 unhandled.
+    }
+
+    telegram::UpdateJournal journal(path, 10, config);
+    REQUIRE(journal.PollOffset() == 15);
+    REQUIRE(journal.Recovered(10));
+    REQUIRE(journal.Recovered(12));
+    REQUIRE(!journal.Recovered(11));
+    auto unhandled = journal.Unhandled();
+    REQUIRE(unhandled->Size() == 3);
+    REQUIRE((*unhandled)[0].update_id == 11);
+    REQUIRE((*unhandled)[0].chat_id == 2);
+    REQUIRE((*unhandled)[0].message_id == 101);
+    REQUIRE((*unhandled)[0].date == 1700000001);
+    REQUIRE(unhandled->Text(0) == "second");
+    REQUIRE((*unhandled)[1].update_id == 13);
+    REQUIRE(unhandled->Text(1).empty());
+    REQUIRE((*unhandled)[2].update_id == 14);
+    REQUIRE(unhandled->Text(2) == "fifth");
+
+    REQUIRE(journal.Watermark() == 11);
+    journal.Handled(11);
+    journal.Handled(14);
+    REQUIRE(journal.Watermark() == 13);
+    journal.Handled(13);
+    REQUIRE(journal.Watermark() == 15);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Poller journals updates before confirming them, so a crash loses none") {
+    // Like the Bot API: getUpdates forgets the updates below its offset and answers
+    // with up to two of the rest.
+    class UpdatesHandler : public telegram::LoopbackHandler {
+    public:
+        void Handle(const Request &request, Response *response) override {
+            std::lock_guard guard(mutex);
+            auto at = request.uri.find("offset=");
+            auto offset = at == std::string::npos ? 0 : std::stoll(request.uri.substr(at + 7));
+            while (!pending.empty() && pending.front() < offset) {
+                pending.erase(pending.begin());
+            }
+            response->body << R"({"ok":true,"result":[)";
+            for (size_t i = 0; i < std::min<size_t>(pending.size(), 2); ++i) {
+                response->body << (i ? "," : "") << R"({"update_id":)" << pending[i]
+                               << R"(,"message":{"message_id":1,"chat":{"id":7},"text":"hi"}})";
+            }
+            response->body << "]}";
+        }
+
+        std::mutex mutex;
+        std::vector<int64_t> pending = {1, 2, 3, 4, 5, 6};
+    };
+
+    auto directory = std::filesystem::temp_directory_path();
+    auto offset_path = (directory / "telegram_poller_offset_test").string();
+    auto journal_path = (directory / "telegram_poller_journal_test").string();
+    std::filesystem::remove(offset_path);
+    std::filesystem::remove(journal_path);
+    auto handler = std::make_shared<UpdatesHandler>();
+    telegram::Client client(std::make_shared<telegram::LoopbackTransport>(handler), "bot123");
+
+    // Polls and handles updates as RunPolling does, until handle returns false.
+    auto run = [&](const std::function<bool(int64_t)> &handle) {
+        telegram::OffsetStore offsets(offset_path, {.durability = telegram::Durability::kNone});
+        telegram::UpdateJournal journal(journal_path, offsets.Load(),
+                                        {.durability = telegram::Durability::kNone});
+        telegram::Poller poller(&client, {.timeout = 0, .min_limit = 2, .max_limit = 2},
+                                journal.PollOffset());
+        poller.SetOnReceived([&journal](const telegram::UpdateBatch &batch) {
+            journal.Received(batch);
+        });
+        poller.Start();
+        auto handle_batch = [&](const telegram::UpdateBatch &batch) {
+            for (size_t i = 0; i < batch.Size(); ++i) {
+                auto update_id = batch[i].update_id;
+                if (journal.Recovered(update_id)) {
+                    continue;
+                }
+                if (!handle(update_id)) {
+                    return false;
+                }
+                journal.Handled(update_id);
+            }
+            offsets.Store(journal.Watermark());
+            return true;
+        };
+        if (!handle_batch(*journal.Unhandled())) {
+            return;
+        }
+        while (const auto batch = poller.Next()) {
+            if (!handle_batch(*batch)) {
+                return;
+            }
+        }
+    };
+
+    // Dies handling update 4, once the server has forgotten every update: the
+    // poller goes on while a handler is stuck.
+    run([&](int64_t update_id) {
+        if (update_id < 4) {
+            return true;
+        }
+        while (true) {
+            {
+                std::lock_guard guard(handler->mutex);
+                if (handler->pending.empty()) {
+                    break;
+                }
+            }
+            std::this_thread::yield();
+        }
+        return false;
+    });
+
+    std::vector<int64_t> handled;
+    run([&](int64_t update_id) {
+        handled.push_back(update_id);
+        return update_id < 6;
+    });
+    REQUIRE(handled == std::vector<int64_t>{4, 5, 6});
+    std::filesystem::remove(offset_path);
+    std::filesystem::remove(journal_path);
+}
+
+namespace {
+// Records the sendMessage bodies the client sends; holds requests while closed.
+class RecordingHandler : public telegram::LoopbackHandler {
+public:
+    void Handle(const Request &request, Response *response) override {
+        std::string body(std::istreambuf_iterator<char>(request.body), {});
+        std::unique_lock guard(mutex);
+        opened.wait(guard, [this] { return open; });
+        bodies.push_back(std::move(body));
+        response->body << fake_data::kSendMessageHiJson;
+    }
+
+    void Open() {
+        std::lock_guard guard(mutex);
+        open = true;
+        opened.notify_all();
+    }
+
+    std::mutex mutex;
+    std::condition_variable opened;
+    bool open = true;
+    std::vector<std::string> bodies;
+};
+
+std::string PostWebhook(uint16_t port, const std::string &path, const std::string &update,
+                        int *status) {
+    Poco::Net::HTTPClientSession session("localhost", port);
+    Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_POST, path,
+                                   Poco::Net::HTTPMessage::HTTP_1_1);
+    request.setContentType("application/json");
+    request.setContentLength(static_cast<std::streamsize>(update.size()));
+    session.sendRequest(request) << update;
+    Poco::Net::HTTPResponse response;
+    auto &body = session.receiveResponse(response);
+    *status = response.getStatus();
+    return std::string(std::istreambuf_iterator<char>(body), std::istreambuf_iterator<char>());
+}
+}  // namespace
+
+TEST_CASE("Webhook answers a lone reply in the response") {
+    auto recorder = std::make_shared<RecordingHandler>();
+    telegram::Client client(std::make_shared<telegram::LoopbackTransport>(recorder), "bot123",
+                            {.rate_limit = {.enabled = false}});
+    const telegram::PreparedText kPong("pong");
+
+    telegram::WebhookServer server(
+        &client, {.host = "127.0.0.1", .port = 0, .path = "/hook", .workers = 2},
+        [&](const telegram::UpdateView &update, telegram::ReplyChannel *replies) {
+            replies->SendMessage(kPong, update.chat_id, update.message_id);
+            if (update.Text() == "twice") {
+                replies->SendMessage("again", update.chat_id);
+            }
+        });
+    server.Start();
+    REQUIRE(server.Port() != 0);
+
+    auto update = [](const std::string &text) {
+        return R"({"update_id":5,"message":{"message_id":7,"chat":{"id":-3},"text":")" + text +
+               R"("}})";
+    };
+    int status = 0;
+    auto body = PostWebhook(server.Port(), "/hook", update("once"), &status);
+    REQUIRE(status == 200);
+    REQUIRE(body ==
+            R"({"method":"sendMessage","chat_id":-3,"text":"pong","reply_to_message_id":7})");
+    REQUIRE(recorder->bodies.empty());
+
+    // Two replies both go out as requests, in order.
+    body = PostWebhook(server.Port(), "/hook", update("twice"), &status);
+    REQUIRE(status == 200);
+    REQUIRE(body.empty());
+    REQUIRE(recorder->bodies.size() == 2);
+    REQUIRE(recorder->bodies[0] == R"({"chat_id":-3,"text":"pong","reply_to_message_id":7})");
+    REQUIRE(recorder->bodies[1] == R"({"chat_id":-3,"text":"again"})");
+
+    PostWebhook(server.Port(), "/other", update("once"), &status);
+    REQUIRE(status == 404);
+    PostWebhook(server.Port(), "/hook", "{\"update_id\":", &status);
+    REQUIRE(status == 400);
+    server.Stop();
+}
+
+TEST_CASE("Send queue serves by priority, then chats in turn") {
+    auto recorder = std::make_shared<RecordingHandler>();
+    recorder->open = false;
+    telegram::Client client(std::make_shared<telegram::LoopbackTransport>(recorder), "bot123",
+                            {.rate_limit = {.enabled = false}});
+    auto text = [](const std::string &body) {
+        auto begin = body.find("\"text\":\"") + 8;
+        return body.substr(begin, body.find('"', begin) - begin);
+    };
+
+    {
+        telegram::SendQueue queue(&client, {.senders = 1, .quantum = 4});
+        // Takes the only sender and is held there.
+        queue.Send(telegram::SendPriority::kBulk, "first", 9);
+        while (queue.Stats()[2].queued > 0) {
+            std::this_thread::yield();
+        }
+        for (int i = 0; i < 6; ++i) {
+            queue.Send(telegram::SendPriority::kBulk, "a" + std::to_string(i), 1);
+        }
+        queue.Send(telegram::SendPriority::kBulk, "b0", 2);
+        queue.Send(telegram::SendPriority::kBulk, "b1", 2);
+        queue.Send(telegram::SendPriority::kNotification, "note", 3);
+        std::atomic<bool> sent = false;
+        queue.Send(telegram::SendPriority::kInteractive, "reply", 4, 7,
+                   [&](std::exception_ptr error) { sent = !error; });
+        recorder->Open();
+        queue.Flush();
+        REQUIRE(sent);
+
+        auto stats = queue.Stats();
+        REQUIRE(stats[0].sent == 1);
+        REQUIRE(stats[1].sent == 1);
+        REQUIRE(stats[2].sent == 9);
+        REQUIRE(stats[2].max_delay >= stats[2].mean_delay);
+    }
+
+    std::vector<std::string> order;
+    for (const auto &body : recorder->bodies) {
+        order.push_back(text(body));
+    }
+    REQUIRE(order == std::vector<std::string>{"first", "reply", "note", "a0", "b0", "a1", "b1",
+                                              "a2", "a3", "a4", "a5"});
+}
+
+TEST_CASE("Send queue keeps each chat in order") {
+    auto recorder = std::make_shared<RecordingHandler>();
+    telegram::Client client(std::make_shared<telegram::LoopbackTransport>(recorder), "bot123",
+                            {.rate_limit = {.enabled = false}});
+    {
+        telegram::SendQueue queue(&client, {.senders = 4});
+        for (int i = 0; i < 300; ++i) {
+            queue.Send(telegram::SendPriority::kBulk, std::to_string(i), i % 3);
+        }
+    }
+
+    REQUIRE(recorder->bodies.size() == 300);
+    std::array<int, 3> last{-1, -1, -1};
+    for (const auto &body : recorder->bodies) {
+        auto chat = body[11] - '0';
+        auto begin = body.find("\"text\":\"") + 8;
+        auto value = std::stoi(body.substr(begin));
+        REQUIRE(value > last[chat]);
+        last[chat] = value;
+    }
+}
+
+TEST_CASE("Send queue passes over a paused chat instead of waiting for it") {
+    // Answers the first message to chat 1 with a 429.
+    class FloodHandler : public telegram::LoopbackHandler {
+    public:
+        void Handle(const Request &request, Response *response) override {
+            std::string body(std::istreambuf_iterator<char>(request.body), {});
+            std::lock_guard guard(mutex);
+            sent.emplace_back(std::move(body), std::chrono::steady_clock::now());
+            if (sent.back().first.starts_with(R"({"chat_id":1,)") && !flooded) {
+                flooded = true;
+                response->status = 429;
+                response->body << R"({"ok":false,"error_code":429,"description":"Too Many )"
+                                  R"(Requests: retry after 1","parameters":{"retry_after":1}})";
+                return;
+            }
+            response->body << fake_data::kSendMessageHiJson;
+        }
+
+        std::mutex mutex;
+        bool flooded = false;
+        std::vector<std::pair<std::string, std::chrono::steady_clock::time_point>> sent;
+    };
+
+    auto handler = std::make_shared<FloodHandler>();
+    telegram::Client client(std::make_shared<telegram::LoopbackTransport>(handler), "bot123");
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<bool> delivered = false;
+    {
+        telegram::SendQueue queue(&client, {.senders = 1});
+        queue.Send(telegram::SendPriority::kBulk, "a", 1, std::nullopt,
+                   [&](std::exception_ptr error) { delivered = !error; });
+        queue.Send(telegram::SendPriority::kBulk, "b", 2);
+        queue.Flush();
+        REQUIRE(queue.Stats()[2].sent == 2);
+        REQUIRE(queue.Stats()[2].failed == 0);
+    }
+    REQUIRE(delivered);
+
+    // The only sender went on to chat 2 while chat 1 waited out retry_after.
+    REQUIRE(handler->sent.size() == 3);
+    REQUIRE(handler->sent[1].first == R"({"chat_id":2,"text":"b"})");
+    REQUIRE(handler->sent[1].second - start < std::chrono::milliseconds(500));
+    REQUIRE(handler->sent[2].first == R"({"chat_id":1,"text":"a"})");
+    REQUIRE(handler->sent[2].second - start >= std::chrono::seconds(1));
+}
+
+TEST_CASE("Broadcast reaches every subscriber and resumes from its checkpoint") {
+    auto directory = std::filesystem::temp_directory_path();
+    auto list = (directory / "telegram_subscribers_test").string();
+    auto checkpoint = (directory / "telegram_broadcast_checkpoint_test").string();
+    std::filesystem::remove(checkpoint);
+
+    std::vector<int64_t> chat_ids = {42, -1001234567890, 7, 42, int64_t{1} << 40, 0};
+    for (int64_t i = 0; i < 500; ++i) {
+        chat_ids.push_back(104519755 + i * 3);
+    }
+    telegram::SubscriberList::Write(list, chat_ids);
+    std::sort(chat_ids.begin(), chat_ids.end());
+    chat_ids.erase(std::unique(chat_ids.begin(), chat_ids.end()), chat_ids.end());
+
+    telegram::SubscriberList subscribers(list);
+    REQUIRE(subscribers.Size() == chat_ids.size());
+    // Deltas of 3 take one byte each.
+    REQUIRE(std::filesystem::file_size(list) < 600);
+    std::vector<int64_t> decoded;
+    auto cursor = subscribers.Begin();
+    for (int64_t chat_id; cursor.Next(&chat_id);) {
+        decoded.push_back(chat_id);
+    }
+    REQUIRE(decoded == chat_ids);
+
+    // A previous run got through the first 200.
+    telegram::OffsetStore(checkpoint, {.durability = telegram::Durability::kNone}).Store(200);
+
+    auto recorder = std::make_shared<RecordingHandler>();
+    telegram::Client client(std::make_shared<telegram::LoopbackTransport>(recorder), "bot123",
+                            {.rate_limit = {.enabled = false}});
+    telegram::SendQueue queue(&client);
+    const telegram::PreparedText text("News");
+    auto result = telegram::Broadcast(&queue, text, subscribers,
+                                      {.window = 32, .checkpoint_path = checkpoint});
+    REQUIRE(result.resumed == 200);
+    REQUIRE(result.sent == chat_ids.size() - 200);
+    REQUIRE(result.failed == 0);
+
+    std::vector<std::string> expected;
+    for (size_t i = 200; i < chat_ids.size(); ++i) {
+        expected.push_back("{\"chat_id\":" + std::to_string(chat_ids[i]) + ",\"text\":\"News\"}");
+    }
+    std::sort(expected.begin(), expected.end());
+    std::sort(recorder->bodies.begin(), recorder->bodies.end());
+    REQUIRE(recorder->bodies == expected);
+
+    // Finished: running again sends nothing.
+    REQUIRE(telegram::Broadcast(&queue, text, subscribers, {.checkpoint_path = checkpoint}).sent ==
+            0);
+    std::filesystem::remove(list);
+    std::filesystem::remove(checkpoint);
+}
+
+TEST_CASE("Broadcast lets its sends finish before it throws") {
+    using namespace std::chrono_literals;
+    auto list = (std::filesystem::temp_directory_path() / "telegram_subscribers_bad").string();
+    telegram::SubscriberList::Write(list, {1, 2});
+    std::string data;
+    {
+        std::ifstream in(list, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), {});
+    }
+    auto rewrite = [&list](const std::string &contents) {
+        std::ofstream(list, std::ios::binary | std::ios::trunc) << contents;
+    };
+
+    // The header counts more ids than there are.
+    auto missing = data;
+    missing[8] = 3;
+    rewrite(missing);
+    REQUIRE_THROWS_AS(telegram::SubscriberList(list), std::runtime_error);
+
+    // The second id runs past 64 bits, found only once the first is in flight.
+    rewrite(data.substr(0, 16) + '\x02' + std::string(10, '\x80') + '\x01');
+    telegram::SubscriberList subscribers(list);
+    auto recorder = std::make_shared<RecordingHandler>();
+    recorder->open = false;
+    telegram::Client client(std::make_shared<telegram::LoopbackTransport>(recorder), "bot123",
+                            {.rate_limit = {.enabled = false}});
+    telegram::SendQueue queue(&client);
+    const telegram::PreparedText text("News");
+    auto broadcast = std::async(std::launch::async,
+                                [&] { return telegram::Broadcast(&queue, text, subscribers); });
+    REQUIRE(broadcast.wait_for(100ms) == std::future_status::timeout);
+    recorder->Open();
+    REQUIRE_THROWS_AS(broadcast.get(), std::runtime_error);
+    REQUIRE(recorder->bodies.size() == 1);
+    std::filesystem::remove(list);
+}
+
+TEST_CASE("Send queue coalesces a burst to one chat") {
+    auto recorder = std::make_shared<RecordingHandler>();
+    telegram::Client client(std::make_shared<telegram::LoopbackTransport>(recorder), "bot123",
+                            {.rate_limit = {.enabled = false}});
+    {
+        telegram::SendQueue queue(&client, {.coalesce_window = std::chrono::milliseconds(20),
+                                            .max_text_length = 12});
+        const telegram::PreparedText reply("Reply");
+        std::atomic<int> done = 0;
+        auto count = [&](std::exception_ptr error) { done += !error; };
+        queue.Send(telegram::SendPriority::kInteractive, reply, 104519755, 7, count);
+        queue.Send(telegram::SendPriority::kInteractive, reply, 104519755, 7, count);
+        // A different reply_to_message_id starts a new message.
+        queue.Send(telegram::SendPriority::kInteractive, "Hi", 104519755, std::nullopt, count);
+        // 11 characters with the "Hi", which is as far as the limit goes.
+        queue.Send(telegram::SendPriority::kInteractive, "Привет!!", 104519755);
+        queue.Send(telegram::SendPriority::kInteractive, "Bye", 104519755);
+        queue.Flush();
+        REQUIRE(done == 3);
+
+        auto stats = queue.Stats()[0];
+        REQUIRE(stats.sent == 5);
+        REQUIRE(stats.coalesced == 2);
+    }
+
+    REQUIRE(recorder->bodies == std::vector<std::string>{
+                                    R"({"chat_id":104519755,"text":"Reply\nReply",)"
+                                    R"("reply_to_message_id":7})",
+                                    R"({"chat_id":104519755,"text":"Hi\nПривет!!"})",
+                                    R"({"chat_id":104519755,"text":"Bye"})"});
+
+    // Each merged message is charged to the chat's deficit: a quantum of 10 pays
+    // for three texts of cost 3.
+    recorder->bodies.clear();
+    {
+        telegram::SendQueue queue(&client, {.senders = 1,
+                                            .quantum = 10,
+                                            .coalesce_window = std::chrono::milliseconds(20)});
+        for (int i = 1; i <= 4; ++i) {
+            queue.Send(telegram::SendPriority::kBulk, "a" + std::to_string(i), 1);
+        }
+        queue.Flush();
+        REQUIRE(queue.Stats()[2].coalesced == 2);
+    }
+    REQUIRE(recorder->bodies == std::vector<std::string>{R"({"chat_id":1,"text":"a1\na2\na3"})",
+                                                         R"({"chat_id":1,"text":"a4"})"});
+}
+
+TEST_CASE("Metrics record requests and render in the Prometheus format") {
+    using namespace std::chrono_literals;
+    static_assert(telegram::Histogram::BucketOf(7) == 7);
+    static_assert(telegram::Histogram::BucketOf(1024) == 64);
+    static_assert(telegram::Histogram::LowerBoundOf(telegram::Histogram::BucketOf(1500)) == 1408);
+
+    telegram::MetricsRegistry metrics;
+    telegram::FakeServer fake{"Single getUpdates and send messages"};
+    telegram::Client client(fake.MakeLoopbackTransport(), "bot123", {.metrics = &metrics});
+
+    auto batch = client.FetchUpdateBatch();
+    REQUIRE((*batch)[0].date == 1510493105);
+    client.SendMessage("Hi!", (*batch)[0].chat_id);
+    client.SendMessage("Reply", (*batch)[1].chat_id, (*batch)[1].message_id);
+    client.SendMessage("Reply", (*batch)[1].chat_id, (*batch)[1].message_id);
+    fake.StopAndCheckExpectations();
+
+    auto &counter = metrics.GetCounter("test_events_total", "Events");
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&counter] {
+            for (int j = 0; j < 1000; ++j) {
+                counter.Add();
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    auto &latency = metrics.GetHistogram("test_seconds", "Latency", {{"kind", "a\"b"}});
+    for (int i = 1; i <= 100; ++i) {
+        latency.Record(i * 1ms);
+    }
+    REQUIRE(&latency == &metrics.GetHistogram("test_seconds", "Latency", {{"kind", "a\"b"}}));
+    auto snapshot = latency.Read();
+    REQUIRE(snapshot.count == 100);
+    REQUIRE(snapshot.sum == 5050ms);
+    REQUIRE(snapshot.Quantile(0.5) >= 50ms);
+    REQUIRE(snapshot.Quantile(0.5) <= 50ms * 9 / 8);
+    metrics.AddGauge("test_depth", "Depth", {}, [] { return 3; });
+
+    std::string text;
+    metrics.WritePrometheus(&text);
+    auto has = [&](const std::string &line) {
+        return text.find(line + "\n") != std::string::npos;
+    };
+    REQUIRE(has("# TYPE telegram_api_request_seconds histogram"));
+    REQUIRE(has(R"(telegram_api_request_seconds_count{method="getUpdates",status="200"} 1)"));
+    REQUIRE(has(R"(telegram_api_request_seconds_count{method="sendMessage",status="200"} 3)"));
+    REQUIRE(has("test_events_total 4000"));
+    REQUIRE(has(R"(test_seconds_bucket{kind="a\"b",le="+Inf"} 100)"));
+    REQUIRE(has(R"(test_seconds_sum{kind="a\"b"} 5.05)"));
+    REQUIRE(has("test_depth 3"));
+}
+
+TEST_CASE("Tracer exports the spans of one update as a Chrome trace") {
+    telegram::Tracer tracer;
+    telegram::Tracer::Install(&tracer);
+
+    telegram::FakeServer fake{"Large getUpdates"};
+    telegram::Client client(fake.MakeLoopbackTransport(), "bot123");
+    auto batch = client.FetchUpdateBatch();
+    fake.StopAndCheckExpectations();
+    auto id = (*batch)[50].update_id;
+
+    {
+        telegram::Span idle("idle");
+    }
+    std::thread worker([&] {
+        for (auto update : {id, id + 1000}) {
+            telegram::TraceScope scope(update);
+            telegram::Span handle("handle");
+            telegram::Span nested("nested");
+        }
+    });
+    worker.join();
+
+    std::string trace;
+    tracer.WriteChromeTrace(&trace, id);
+    auto count = [&](std::string_view name) {
+        auto needle = R"("name":")" + std::string(name) + '"';
+        size_t found = 0;
+        for (auto at = trace.find(needle); at != std::string::npos;
+             at = trace.find(needle, at + 1)) {
+            ++found;
+        }
+        return found;
+    };
+    REQUIRE(trace.starts_with(R"({"displayTimeUnit":"ms","traceEvents":[)"));
+    REQUIRE(trace.ends_with("]}"));
+    for (auto name : {"getUpdates", "request", "reply", "read", "parse"}) {
+        REQUIRE(count(name) == 1);
+    }
+    REQUIRE(count("handle") == 1);
+    REQUIRE(count("nested") == 1);
+    REQUIRE(count("idle") == 0);
+    REQUIRE(trace.find(R"("args":{"first_update_id":)" + std::to_string((*batch)[0].update_id)) !=
+            std::string::npos);
+
+    tracer.WriteChromeTrace(&trace);
+    REQUIRE(count("handle") == 2);
+    REQUIRE(count("idle") == 1);
+
+    // Only the newest spans of a thread are kept; unsampled updates leave none.
+    telegram::Tracer small({.events_per_thread = 4, .sample_every = 2});
+    telegram::Tracer::Install(&small);
+    for (int64_t update = 1; update <= 20; ++update) {
+        telegram::Span span("update", update);
+    }
+    small.WriteChromeTrace(&trace);
+    REQUIRE(count("update") >= 3);
+    REQUIRE(count("update") <= 4);
+    REQUIRE(trace.find(R"("first_update_id":20)") != std::string::npos);
+    REQUIRE(trace.find(R"("first_update_id":9,)") == std::string::npos);
+    telegram::Tracer::Install(nullptr);
+}
+
+TEST_CASE("Logger writes records of every thread in batches") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    std::string written;
+    {
+        telegram::Logger logger(
+            {.level = telegram::LogLevel::kInfo, .fd = fds[1], .burst = 30, .sample_every = 10});
+        telegram::Logger::Install(&logger);
+        std::thread worker([] {
+            for (int i = 0; i < 5; ++i) {
+                telegram::Log(telegram::LogLevel::kWarning, "worker {} of {}", i, "five");
+            }
+        });
+        worker.join();
+        telegram::Log(telegram::LogLevel::kDebug, "filtered");
+        telegram::Log(telegram::LogLevel::kInfo, "/{} {}", std::string_view("random"), 0.5);
+        logger.Flush();
+        // Beyond the burst, one record in ten is kept.
+        for (int i = 0; i < 100; ++i) {
+            logger.Log(telegram::LogLevel::kInfo, "flood {}", i);
+        }
+        auto stats = logger.GetStats();
+        REQUIRE(stats.written == 6);
+        REQUIRE(stats.sampled_out == 0);
+    }
+    close(fds[1]);
+    char buffer[4096];
+    for (ssize_t size; (size = read(fds[0], buffer, sizeof buffer)) > 0;) {
+        written.append(buffer, static_cast<size_t>(size));
+    }
+    close(fds[0]);
+
+    REQUIRE(written.find("Z WARNING worker 0 of five\n") != std::string::npos);
+    REQUIRE(written.find("worker 4 of five\n") > written.find("worker 3 of five\n"));
+    REQUIRE(written.find("Z INFO /random 0.5\n") != std::string::npos);
+    REQUIRE(written.find("filtered") == std::string::npos);
+    REQUIRE(written.find("flood 28\n") != std::string::npos);
+    REQUIRE(written.find("flood 29\n") != std::string::npos);
+    REQUIRE(written.find("flood 30\n") == std::string::npos);
+    REQUIRE(written.find("flood 39\n") != std::string::npos);
+    REQUIRE(written.find("WARNING logger: 0 records dropped, 63 sampled out\n") !=
+            std::string::npos);
+}
+
+// Never returns: each frame keeps a buffer the compiler cannot drop.
+[[gnu::noinline]] int64_t Recurse(int64_t depth) {
+    volatile char frame[1024];
+    frame[0] = static_cast<char>(depth);
+    return Recurse(depth + 1) + frame[0];
+}
+
+TEST_CASE("Flight recorder keeps the last events and writes them on a crash") {
+    auto path = (std::filesystem::temp_directory_path() / "telegram_flight_record").string();
+    auto read = [&] {
+        std::ifstream file(path);
+        return std::string(std::istreambuf_iterator<char>(file), {});
+    };
+
+    auto recorder = std::make_unique<telegram::FlightRecorder>();
+    for (int64_t i = 0; i < static_cast<int64_t>(telegram::FlightRecorder::kEvents) + 10; ++i) {
+        recorder->Record("update", i, -i);
+    }
+    recorder->Record("status", 200, 1500, "sendMessage");
+    REQUIRE(recorder->Dump(path.c_str(), "test"));
+    auto record = read();
+    REQUIRE(record.starts_with("flight recorder: test, events 11..4107\n"));
+    REQUIRE(record.find(" update 10 -10\n") == std::string::npos);
+    REQUIRE(record.find(" update 11 -11\n") != std::string::npos);
+    REQUIRE(record.ends_with(" status sendMessage 200 1500\n"));
+    REQUIRE(std::count(record.begin(), record.end(), '\n') == 4097);
+
+    // The crash handler writes the global recorder before the process dies.
+    std::filesystem::remove(path);
+    auto child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+        telegram::InstallCrashHandler(path);
+        telegram::FlightRecorder::Global().Record("update", 42, 7);
+        std::abort();
+    }
+    int status = 0;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFSIGNALED(status));
+    REQUIRE(WTERMSIG(status) == SIGABRT);
+    record = read();
+    REQUIRE(record.starts_with("flight recorder: SIGABRT"));
+    REQUIRE(record.ends_with(" update 42 7\n"));
+
+    // A stack overflow leaves no stack for the handler but the alternate one.
+    std::filesystem::remove(path);
+    child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+        telegram::InstallCrashHandler(path);
+        telegram::FlightRecorder::Global().Record("update", 43, 7);
+        Recurse(1);
+        std::_Exit(0);
+    }
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFSIGNALED(status));
+    REQUIRE(WTERMSIG(status) == SIGSEGV);
+    record = read();
+    REQUIRE(record.starts_with("flight recorder: SIGSEGV"));
+    REQUIRE(record.ends_with(" update 43 7\n"));
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Watchdog reports a stuck handler and its chat moves off the worker") {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<int64_t> handled;
+    std::vector<telegram::Overrun> overruns;
+    bool reassigned_all = true;
+    std::atomic<bool> released = false;
+
+    telegram::Dispatcher dispatcher(1, [&](const telegram::UpdateView &update) {
+        telegram::Watched watched("slow", update.chat_id, update.update_id,
+                                  std::chrono::milliseconds(20));
+        while (update.update_id == 1 && !released) {
+            std::this_thread::yield();
+        }
+        std::lock_guard guard(mutex);
+        handled.push_back(update.update_id);
+        changed.notify_all();
+    });
+    telegram::Watchdog watchdog(
+        {.period = std::chrono::milliseconds(5), .capture_stacks = true},
+        [&](const telegram::Overrun &overrun) {
+            auto reassigned = dispatcher.Reassign(overrun.thread);
+            std::lock_guard guard(mutex);
+            reassigned_all = reassigned_all && reassigned;
+            overruns.push_back(overrun);
+            changed.notify_all();
+        });
+    telegram::Watchdog::Install(&watchdog);
+
+    auto batch = std::make_shared<telegram::UpdateBatch>();
+    batch->Append(1, 1, 1, "/slow");
+    batch->Append(2, 1, 2, "/slow");
+    batch->Append(3, 2, 3, "/slow");
+    batch->Append(4, 2, 4, "/slow");
+    for (size_t i = 0; i < batch->Size(); ++i) {
+        dispatcher.Submit({batch, i});
+    }
+
+    {
+        // The one worker is stuck on update 1; chat 2 gets through on a spare.
+        std::unique_lock lock(mutex);
+        REQUIRE(changed.wait_for(lock, std::chrono::seconds(5),
+                                 [&] { return handled.size() == 2 && !overruns.empty(); }));
+        REQUIRE(handled == std::vector<int64_t>{3, 4});
+        REQUIRE(overruns.size() == 1);
+        REQUIRE(reassigned_all);
+        REQUIRE(std::string_view(overruns[0].command) == "slow");
+        REQUIRE(overruns[0].chat_id == 1);
+        REQUIRE(overruns[0].update_id == 1);
+        REQUIRE(overruns[0].elapsed >= std::chrono::milliseconds(20));
+        REQUIRE(!overruns[0].stack.empty());
+        REQUIRE_FALSE(dispatcher.Reassign(overruns[0].thread));
+        REQUIRE_FALSE(dispatcher.Reassign(std::this_thread::get_id()));
+    }
+    released = true;
+    dispatcher.Wait();
+    REQUIRE(handled == std::vector<int64_t>{3, 4, 1, 2});
+    REQUIRE(overruns.size() == 1);
+    telegram::Watchdog::Install(nullptr);
+}